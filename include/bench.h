@@ -0,0 +1,7 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+int bench_run(const char *name);
+void bench_list(void);
+
+#endif
@@ -7,9 +7,13 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
+#include <pthread.h>
 #include "mem_alloc.h"
+#include "pktbuf.h"
 
 #define PCI_PRI_STR_SIZE sizeof("XXXXXXXX:XX:XX.X")
+#define E1000_BAR_SIZE 0x20000 // 寄存器空间大小
+#define E1000_MAX_DEVICES 16
 
 // 寄存器偏移
 enum REGISTERS
@@ -17,6 +21,7 @@ enum REGISTERS
     E1000_CTRL = 0x00,   // Device Control 设备控制
     E1000_STATUS = 0x08, // Device Status 设备状态
     E1000_EERD = 0x14,   // EEPROM Read EEPROM 读取
+    E1000_VET = 0x38,    // VLAN Ether Type 识别802.1Q标签的以太类型
     /**
      *
      * +-------+---------+----------+------+----------+-------+
@@ -31,7 +36,7 @@ enum REGISTERS
      */
 
     E1000_ICR = 0xC0, // Interrupt Cause Read 中断原因读
-    E1000_ITR = 0xC4, // Interrupt Throttling 中断节流
+    E1000_ITR = 0xC4, // Interrupt Throttling 中断节流，两次中断的最小间隔，单位256ns
     E1000_ICS = 0xC8, // Interrupt Cause Set 中断原因设置
     E1000_IMS = 0xD0, // Interrupt Mask Set/Read 中断掩码设置/读
     E1000_IMC = 0xD8, // Interrupt Mask Clear 中断掩码清除
@@ -42,6 +47,8 @@ enum REGISTERS
     E1000_RDLEN = 0x2808, // Receive Descriptor Length 接收描述符长度
     E1000_RDH = 0x2810,   // Receive Descriptor Head 接收描述符头
     E1000_RDT = 0x2818,   // Receive Descriptor Tail 接收描述符尾
+    E1000_RDTR = 0x2820,  // Receive Delay Timer 接收包延迟定时器，单位1.024us
+    E1000_RADV = 0x282C,  // Receive Interrupt Absolute Delay Timer 接收绝对延迟定时器，单位1.024us
 
     E1000_TCTL = 0x400,   // Transmit Control 发送控制
     E1000_TDBAL = 0x3800, // Transmit Descriptor Base Low 传输描述符低地址
@@ -49,9 +56,77 @@ enum REGISTERS
     E1000_TDLEN = 0x3808, // Transmit Descriptor Length 传输描述符长度
     E1000_TDH = 0x3810,   // TDH Transmit Descriptor Head 传输描述符头
     E1000_TDT = 0x3818,   // TDT Transmit Descriptor Tail 传输描述符尾
+    E1000_TIDV = 0x3820,  // Transmit Interrupt Delay Value 发送包延迟定时器，单位1.024us
+    E1000_TADV = 0x382C,  // Transmit Absolute Interrupt Delay Value 发送绝对延迟定时器，单位1.024us
+
+    E1000_RXCSUM = 0x5000, // Receive Checksum Control 接收校验和控制
+    E1000_MTA = 0x5200,  // Multicast Table Array 05200h-053FCh 组播表数组
+    E1000_RAL0 = 0x5400, // Receive Address Low 接收地址低32位，共16组，每组8字节
+    E1000_RAH0 = 0x5404, // Receive Address High 接收地址高16位
+    E1000_VFTA = 0x5600, // VLAN Filter Table Array 05600h-057FCh VLAN过滤表
+};
+
+// 设备控制
+enum CTRL
+{
+    CTRL_VME = 1 << 30, // VLAN Mode Enable 接收时剥离VLAN标签，发送时按VLE插入
+};
+
+#define E1000_VLAN_ETHERTYPE 0x8100
+#define E1000_VFTA_SIZE 128 // 128个32位寄存器，每一位对应一个VLAN ID
 
-    E1000_MAT0 = 0x5200, // Multicast Table Array 05200h-053FCh 组播表数组
-    E1000_MAT1 = 0x5400, // Multicast Table Array 05200h-053FCh 组播表数组
+#define E1000_RAH_AV (1U << 31) // Address Valid
+#define E1000_RAR_ENTRIES 16    // 精确匹配的单播地址个数，第0个是网卡自己的地址
+#define E1000_MTA_SIZE 128      // 128个32位寄存器，组播地址按12位哈希对应其中一位
+
+/**
+ * @brief 组播地址在MTA中的位置，RCTL.MO为0时取目的地址的第36~47位
+ */
+static inline uint16_t e1000_mta_hash(const uint8_t *addr)
+{
+    return ((addr[4] >> 4) | ((uint16_t)addr[5] << 4)) & 0xfff;
+}
+
+// 统计寄存器，读后清零；GORC/GOTC/TOR/TOT是64位的，先读低32位再读高32位
+enum STATS
+{
+    E1000_CRCERRS = 0x4000,  // CRC Error Count
+    E1000_ALGNERRC = 0x4004, // Alignment Error Count
+    E1000_SYMERRS = 0x4008,  // Symbol Error Count
+    E1000_RXERRC = 0x400C,   // RX Error Count
+    E1000_MPC = 0x4010,      // Missed Packets Count 接收FIFO满导致的丢包
+    E1000_SCC = 0x4014,      // Single Collision Count
+    E1000_ECOL = 0x4018,     // Excessive Collisions Count
+    E1000_MCC = 0x401C,      // Multiple Collision Count
+    E1000_LATECOL = 0x4020,  // Late Collisions Count
+    E1000_COLC = 0x4028,     // Collision Count
+    E1000_DC = 0x4030,       // Defer Count
+    E1000_TNCRS = 0x4034,    // Transmit with No CRS
+    E1000_SEC = 0x4038,      // Sequence Error Count
+    E1000_CEXTERR = 0x403C,  // Carrier Extension Error Count
+    E1000_RLEC = 0x4040,     // Receive Length Error Count
+    E1000_XONRXC = 0x4048,   // XON Received Count
+    E1000_XONTXC = 0x404C,   // XON Transmitted Count
+    E1000_XOFFRXC = 0x4050,  // XOFF Received Count
+    E1000_XOFFTXC = 0x4054,  // XOFF Transmitted Count
+    E1000_FCRUC = 0x4058,    // FC Received Unsupported Count
+    E1000_GPRC = 0x4074,     // Good Packets Received Count
+    E1000_BPRC = 0x4078,     // Broadcast Packets Received Count
+    E1000_MPRC = 0x407C,     // Multicast Packets Received Count
+    E1000_GPTC = 0x4080,     // Good Packets Transmitted Count
+    E1000_GORCL = 0x4088,    // Good Octets Received Count
+    E1000_GOTCL = 0x4090,    // Good Octets Transmitted Count
+    E1000_RNBC = 0x40A0,     // Receive No Buffers Count 没有空闲接收描述符
+    E1000_RUC = 0x40A4,      // Receive Undersize Count
+    E1000_RFC = 0x40A8,      // Receive Fragment Count
+    E1000_ROC = 0x40AC,      // Receive Oversize Count
+    E1000_RJC = 0x40B0,      // Receive Jabber Count
+    E1000_TORL = 0x40C0,     // Total Octets Received
+    E1000_TOTL = 0x40C8,     // Total Octets Transmitted
+    E1000_TPR = 0x40D0,      // Total Packets Received
+    E1000_TPT = 0x40D4,      // Total Packets Transmitted
+    E1000_MPTC = 0x40F0,     // Multicast Packets Transmitted Count
+    E1000_BPTC = 0x40F4,     // Broadcast Packets Transmitted Count
 };
 
 // 接收控制
@@ -128,6 +203,7 @@ enum RS
 {
     RS_DD = 1 << 0,    // Descriptor done
     RS_EOP = 1 << 1,   // End of packet
+    RS_IXSM = 1 << 2,  // Ignore Checksum Indication，设置时忽略IPCS/L4CS
     RS_VP = 1 << 3,    // Packet is 802.1q (matched VET);
                        // indicates strip VLAN in 802.1q packet
     RS_UDPCS = 1 << 4, // UDP checksum calculated on packet
@@ -136,6 +212,29 @@ enum RS
     RS_PIF = 1 << 7,   // Passed in-exact filter
 };
 
+// 接收错误
+enum RE
+{
+    RE_CE = 1 << 0,   // CRC Error or Alignment Error
+    RE_SE = 1 << 1,   // Symbol Error
+    RE_SEQ = 1 << 2,  // Sequence Error
+    RE_CXE = 1 << 4,  // Carrier Extension Error
+    RE_TCPE = 1 << 5, // TCP/UDP Checksum Error
+    RE_IPE = 1 << 6,  // IP Checksum Error
+    RE_RXE = 1 << 7,  // RX Data Error
+};
+
+// 帧本身有错误，只在RCTL_SBP打开时才会交给驱动，驱动直接丢弃
+#define RE_FRAME_MASK (RE_CE | RE_SE | RE_SEQ | RE_CXE | RE_RXE)
+
+// 接收校验和控制
+enum RXCSUM
+{
+    RXCSUM_PCSS = 0,        // Packet Checksum Start，低8位，描述符checksum字段从这里开始累加
+    RXCSUM_IPOFLD = 1 << 8, // IP Checksum Off-load Enable
+    RXCSUM_TUOFLD = 1 << 9, // TCP/UDP Checksum Off-load Enable
+};
+
 // 传输控制
 enum TCTL
 {
@@ -154,18 +253,42 @@ enum TCMD
     TCMD_EOP = 1 << 0,  // When set, indicates the last descriptor making up the packet. One or many descriptors can be used to form a packet
     TCMD_IFCS = 1 << 1, // Insert FCS/CRC filed
     TCMD_IC = 1 << 2,   // Insert Checksum
+    TCMD_TSE = 1 << 2,  // 扩展数据描述符里同一位是TCP Segmentation Enable
     TCMD_RS = 1 << 3,   // Report Status 如果设置，将在传输完成后设置状态位
     TCMD_RPS = 1 << 4,  // Report Packet Sent
+    TCMD_DEXT = 1 << 5, // Descriptor Extension，设置时是上下文描述符或扩展数据描述符
     TCMD_VLE = 1 << 6,  // VLAN Packet Enable
     TCMD_IDE = 1 << 7,  // Interrupt Delay Enable
 };
 
+// 上下文描述符的TUCMD，RS/DEXT/IDE和TCMD相同
+enum TUCMD
+{
+    TUCMD_TCP = 1 << 0, // 1: TCP，0: UDP
+    TUCMD_IP = 1 << 1,  // 1: IPv4，0: IPv6
+    TUCMD_TSE = 1 << 2, // TCP Segmentation Enable
+};
+
+// 扩展描述符的类型，在length后面那个字节的高4位
+#define TDESC_DTYP_CTX  0x00 // TCP/IP上下文描述符
+#define TDESC_DTYP_DATA 0x10 // TCP/IP数据描述符
+
+// 扩展数据描述符的POPTS
+enum TPOPTS
+{
+    TPOPTS_IXSM = 1 << 0, // Insert IP Checksum
+    TPOPTS_TXSM = 1 << 1, // Insert TCP/UDP Checksum
+};
+
 #define E1000_READ_REG(hw, reg) \
     (*((volatile uint32_t *)((char *)(hw) + (reg))))
 
 #define E1000_WRITE_REG(hw, reg, value) \
     (*((volatile uint32_t *)((char *)(hw) + (reg))) = (value))
 
+#define E1000_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#define E1000_PREFETCH_W(p) __builtin_prefetch((p), 1, 3) // 马上要写的缓存行
+
 struct rx_desc_t
 {
     uint64_t addr;     // 地址
@@ -187,6 +310,29 @@ typedef struct tx_desc_t
     uint16_t special; // 特殊
 } __attribute__((packed)) tx_desc_t;
 
+/**
+ * TCP/IP上下文描述符，占一个发送描述符的位置
+ * 
+ * 网卡记住最近一个上下文，之后的扩展数据描述符按POPTS使用它插入校验和，
+ * 所以只有报文的首部布局变化时才需要重新发送。
+ * 扩展数据描述符和传统描述符布局相同，只是cso字段变成了DTYP，css字段变成了POPTS。
+ */
+typedef struct tx_ctx_desc_t
+{
+    uint8_t ipcss;    // IP Checksum Start
+    uint8_t ipcso;    // IP Checksum Offset
+    uint16_t ipcse;   // IP Checksum Ending，包含这个字节
+    uint8_t tucss;    // TCP/UDP Checksum Start
+    uint8_t tucso;    // TCP/UDP Checksum Offset
+    uint16_t tucse;   // TCP/UDP Checksum Ending，0表示到报文末尾
+    uint16_t paylen;  // TSO负载长度的低16位
+    uint8_t dtyp;     // 高4位DTYP，低4位是负载长度的19:16位
+    uint8_t tucmd;    // 命令
+    uint8_t status;   // 状态
+    uint8_t hdr_len;  // TSO首部长度
+    uint16_t mss;     // TSO每个分段的最大负载
+} __attribute__((packed)) tx_ctx_desc_t;
+
 // 发送状态
 enum TS
 {
@@ -196,25 +342,208 @@ enum TS
     TS_TU = 1 << 3, // Transmit Underrun
 };
 
-#define RX_DESC_NR 32
-#define TX_DESC_NR 32
+#define E1000_DESC_ALIGN 128 // 描述符环基地址按128字节对齐
+#define E1000_DESC_PER_LINE 4 // 一个64字节缓存行里的描述符个数，环基地址对齐后不会跨行
+#define E1000_DESC_MIN 8    // 描述符环长度必须是128字节的整数倍
+#define E1000_DESC_MAX 4096
+#define RX_DESC_NR 1024     // 默认接收描述符个数
+#define TX_DESC_NR 1024     // 默认发送描述符个数
+#define TX_RS_THRESH 8      // 每8个发送描述符设置一次RS，每次发送的最后一个描述符也设置
+#define TX_FREE_THRESH 32   // 默认在空闲发送描述符少于32个时才回收，不超过发送环的一半
+#define E1000_TX_RING_FULL -2 // e1000_send(): 缓冲区或空闲描述符不够，报文没有发送
+#define E1000_MAX_DATA_PER_TXD 4096 // 每个发送描述符最多4K，TSO负载按4K边界拆到多个描述符
+#define E1000_POOL_EXTRA 1024 // 缓冲池中除了挂在描述符上的，额外预留的缓冲区个数
+
+#define E1000_MTU_DEFAULT 1500
+#define E1000_MTU_MAX 9000 // 巨帧，接收时一帧最多占5个2K的缓冲区
+#define E1000_FRAME_OVERHEAD 18 // 以太网首部加一个VLAN标签，不含CRC
+
+#define E1000_IDLE_BUDGET_US 100   // 默认空转100us后进入中断模式
+#define E1000_SLEEP_TIMEOUT_MS 10  // 中断模式下最长阻塞时间
+
+#define E1000_ITR_UPDATE_NS 100000000ULL // 自动中断调节时统计报文速率的周期
+
+// 中断调节参数，0表示不延迟
+struct e1000_intr_mod {
+    uint32_t itr_ns;  // 两次中断之间的最小间隔
+    uint32_t rdtr_us; // 收到报文后延迟多久产生中断，期间再收到报文会重新计时
+    uint32_t radv_us; // 收到第一个报文后最多延迟多久产生中断，rdtr_us为0时无效
+    uint32_t tidv_us; // 发送完成后延迟多久产生中断
+    uint32_t tadv_us; // 发送完成后最多延迟多久产生中断，tidv_us为0时无效
+};
+
+// 自适应接收各状态的耗时
+struct e1000_poll_stats {
+    uint64_t busy_ns;  // 忙轮询的时间，包括两次轮询之间处理报文的时间
+    uint64_t sleep_ns; // 阻塞等待中断的时间
+    uint64_t sleeps;   // 进入中断模式的次数
+    uint64_t wakeups;  // 被中断唤醒的次数
+    uint64_t timeouts; // 等待超时的次数
+};
+
+#define E1000_STATS_INTERVAL_MS 1000 // 默认每秒采样一次硬件统计寄存器
+
+// 硬件统计，由采样线程从读后清零的寄存器累加
+struct e1000_hw_stats {
+    uint64_t crcerrs;
+    uint64_t algnerrc;
+    uint64_t symerrs;
+    uint64_t rxerrc;
+    uint64_t mpc;
+    uint64_t scc;
+    uint64_t ecol;
+    uint64_t mcc;
+    uint64_t latecol;
+    uint64_t colc;
+    uint64_t dc;
+    uint64_t tncrs;
+    uint64_t sec;
+    uint64_t cexterr;
+    uint64_t rlec;
+    uint64_t xonrxc;
+    uint64_t xontxc;
+    uint64_t xoffrxc;
+    uint64_t xofftxc;
+    uint64_t fcruc;
+    uint64_t gprc;
+    uint64_t bprc;
+    uint64_t mprc;
+    uint64_t gptc;
+    uint64_t gorc;
+    uint64_t gotc;
+    uint64_t rnbc;
+    uint64_t ruc;
+    uint64_t rfc;
+    uint64_t roc;
+    uint64_t rjc;
+    uint64_t tor;
+    uint64_t tot;
+    uint64_t tpr;
+    uint64_t tpt;
+    uint64_t mptc;
+    uint64_t bptc;
+};
+
+// 队列的软件统计，只由收发线程更新
+struct e1000_queue_stats {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t drops;     // 接收: 驱动丢弃的报文，比如CRC错误的帧
+    uint64_t cksum_errors; // 接收: 硬件校验和检查失败的报文，仍然交给上层
+    uint64_t ring_full; // 接收: 缓冲池为空无法补充描述符；发送: 描述符不够，没能全部放入
+};
+
+struct e1000_stats {
+    struct e1000_hw_stats hw;
+    struct e1000_queue_stats rx;
+    struct e1000_queue_stats tx;
+};
+
+struct e1000_emu;
 
 struct e1000_device {
     char name[PCI_PRI_STR_SIZE + 1];
+    int port_id; // 在设备表中的下标
     int eeprom;
     void *hw_addr;
     int uio_fd;
     int config_fd;
+    int epoll_fd;
+    uint32_t idle_budget_us; // 空转多久后进入中断模式，0表示一直忙轮询
+    struct e1000_poll_stats poll_stats;
+    uint64_t poll_last_ns;   // 上次e1000_rx_poll()返回的时间
+    struct e1000_intr_mod intr_mod;
+    int intr_mod_auto;     // 根据报文速率自动调节中断
+    int itr_level;         // 自动调节时当前所处的档位
+    uint64_t itr_pkts;     // 本周期内收到的报文数
+    uint64_t itr_start_ns; // 本周期开始的时间
+    struct e1000_queue_stats rx_stats;
+    struct e1000_queue_stats tx_stats;
+    struct e1000_hw_stats hw_stats;
+    pthread_mutex_t stats_lock; // 保护hw_stats
+    pthread_t stats_tid;
+    volatile int stats_running;
+    uint32_t stats_interval_ms;
+    uint16_t rx_nr;   // 接收描述符个数，2的幂
+    uint16_t rx_mask;
+    uint16_t tx_nr;   // 发送描述符个数，2的幂
+    uint16_t tx_mask;
     uint16_t rx_cur;
     uint16_t tx_cur;
+    uint16_t tx_clean; // 下一个待回收的发送描述符
+    uint16_t tx_free;  // 空闲的发送描述符个数
+    uint16_t tx_free_thresh; // 空闲描述符少于这个数时才回收，0表示使用默认值
+    uint32_t tx_ctx;   // 网卡当前的校验和上下文，0表示还没有设置过
+    uint16_t max_frame; // 接收帧的最大长度，不含CRC，超过的丢弃
+    int vlan_strip;     // 打开了CTRL.VME
+    int vlan_filter;    // 打开了RCTL.VFE
+    uint32_t vfta[E1000_VFTA_SIZE]; // VLAN过滤表的副本，复位后重新写入网卡
+    int promisc;  // 接收所有单播和组播(RCTL.UPE|MPE)
+    int allmulti; // 接收所有组播(RCTL.MPE)
+    uint8_t uc_addrs[E1000_RAR_ENTRIES][6]; // RAR1~15上的单播地址，全0表示空闲，RAR0是mac_addr
+    uint32_t mta[E1000_MTA_SIZE];           // 组播哈希表的副本
+    struct pktbuf *rx_seg_head; // 正在组装的多描述符报文，还没有收到EOP
+    struct pktbuf *rx_seg_tail;
     struct rx_desc_t *rx_desc;
     struct tx_desc_t *tx_desc;
+    struct pktbuf **rx_bufs; // 挂在接收描述符上的报文缓冲区
+    struct pktbuf **tx_bufs; // 挂在发送描述符上、等待发送完成的报文缓冲区
+    struct mempool *pool;
     uint8_t mac_addr[6];
+    struct e1000_emu *emu; // 软件模拟的设备，真实设备为NULL
+};
+
+#define E1000_RX_SCAN_MAX 32 // e1000_rx_scan()一次最多检查的描述符个数，掩码是32位的
+
+// e1000_rx_scan()从描述符里取出的元数据，每个描述符一项
+struct e1000_rx_meta {
+    uint16_t length;
+    uint8_t status;
+    uint8_t error;
+    uint16_t special;
+    uint16_t rsvd;
 };
 
-int e1000_init(struct e1000_device *dev);
+/**
+ * 从desc开始最多检查max个描述符，返回连续完成(DD)的个数，
+ * 它们的长度、状态等写到meta里，eop/err按位对应每个描述符的EOP和帧错误。
+ * 有SSE4.1/AVX2和标量几种实现，第一次调用时按CPU选择，见src/e1000_vec.c。
+ */
+typedef int (*e1000_rx_scan_fn)(const struct rx_desc_t *desc, int max, struct e1000_rx_meta *meta,
+                                 uint32_t *eop, uint32_t *err);
+extern e1000_rx_scan_fn e1000_rx_scan;
+int e1000_rx_scan_select(const char *name);
+const char *e1000_rx_scan_name(void);
+
+int e1000_init(struct e1000_device *dev, uint16_t rx_nr, uint16_t tx_nr);
 struct e1000_device *e1000_device_get(const char *pci_id);
+int e1000_device_count(void);
+struct e1000_device *e1000_device_at(int port_id);
+size_t e1000_dma_mem_size(uint16_t rx_nr, uint16_t tx_nr);
 int e1000_recv(struct e1000_device *dev, char *buf, size_t len);
+int e1000_rx_burst(struct e1000_device *dev, struct pktbuf **pkts, int n);
+int e1000_tx_burst(struct e1000_device *dev, struct pktbuf **pkts, int n);
+int e1000_tx_reclaim(struct e1000_device *dev);
+void e1000_tx_set_free_thresh(struct e1000_device *dev, uint16_t thresh);
+int e1000_rx_poll(struct e1000_device *dev, struct pktbuf **pkts, int n);
+void e1000_rx_set_idle_budget(struct e1000_device *dev, uint32_t us);
+void e1000_poll_stats_get(struct e1000_device *dev, struct e1000_poll_stats *stats);
+void e1000_intr_mod_set(struct e1000_device *dev, const struct e1000_intr_mod *mod);
+void e1000_intr_mod_get(struct e1000_device *dev, struct e1000_intr_mod *mod);
+void e1000_intr_mod_auto(struct e1000_device *dev, int enable);
+int e1000_stats_start(struct e1000_device *dev, uint32_t interval_ms);
+void e1000_stats_stop(struct e1000_device *dev);
+void e1000_stats_get(struct e1000_device *dev, struct e1000_stats *stats);
 int e1000_send(struct e1000_device *dev, char *buf, size_t len);
+int e1000_set_mtu(struct e1000_device *dev, uint16_t mtu);
+int e1000_mac_addr_add(struct e1000_device *dev, const uint8_t *addr);
+int e1000_mac_addr_remove(struct e1000_device *dev, const uint8_t *addr);
+int e1000_set_mc_addr_list(struct e1000_device *dev, const uint8_t (*addrs)[6], int n);
+void e1000_promisc(struct e1000_device *dev, int enable);
+void e1000_allmulti(struct e1000_device *dev, int enable);
+void e1000_vlan_strip(struct e1000_device *dev, int enable);
+void e1000_vlan_filter(struct e1000_device *dev, int enable);
+int e1000_vlan_filter_set(struct e1000_device *dev, uint16_t vid, int on);
+int e1000_send_tso(struct e1000_device *dev, struct pktbuf *hdr, struct pktbuf *payload, uint16_t mss);
 
 #endif
@@ -0,0 +1,78 @@
+#ifndef _E1000_EMU_H_
+#define _E1000_EMU_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "e1000.h"
+#include "pcap.h"
+
+#define E1000_EMU_PREFIX "emu"
+#define E1000_EMU_BURST  64 // 模拟网卡每轮最多处理的描述符个数
+#define E1000_EMU_FRAME_LEN 60     // 合成帧的默认长度
+#define E1000_EMU_FRAME_MAX 16384  // 合成帧的最大长度
+#define E1000_EMU_STD_FRAME 1518   // 没有打开RCTL_LPE时能接收的最大帧，不含CRC
+#define E1000_EMU_DST_MAX 16       // 合成帧轮流使用的目的地址个数上限
+#define E1000_EMU_TX_FRAME_MAX 65536 // 发送时组装一帧的缓冲区，TSO的报文可以到64K
+#define E1000_EMU_TX_SEG_MAX 16384   // TSO切出来的一个分段
+
+/**
+ * @brief 模拟网卡每"发出"一帧调用一次，在模拟线程里执行
+ */
+typedef void (*e1000_emu_tx_hook_t)(void *arg, const uint8_t *frame, uint32_t len);
+
+/**
+ * 软件模拟的e1000网卡
+ *
+ * 寄存器空间是一块进程内存，驱动照常读写寄存器和描述符环。
+ * 模拟线程充当网卡：把回放的报文写进接收描述符，消费发送描述符，
+ * 通过socketpair模拟uio设备的中断。DMA地址直接使用虚拟地址。
+ */
+struct e1000_emu {
+    void *hw_addr;
+    pthread_t tid;
+    volatile int running;
+    int irq_fd;      // socketpair的另一端，驱动那端当作uio_fd
+    int irq_enabled; // 驱动写1打开中断，产生一次中断后自动关闭，和igb_uio一致
+    struct pcap_trace trace; // 回放的报文，为空时发送合成的广播帧
+    unsigned next_pkt;
+    uint16_t frame_len;
+    uint16_t frame_tci;   // 合成帧的VLAN标签，frame_vlans个VLAN ID从这里开始轮流使用
+    uint16_t frame_vlans; // 0表示合成帧不带标签
+    uint16_t next_vlan;
+    uint16_t frame_dsts;  // 合成帧轮流使用的目的地址个数
+    uint16_t next_dst;
+    uint8_t frame_dst[E1000_EMU_DST_MAX][6];
+    uint8_t frame[E1000_EMU_FRAME_MAX];
+    uint8_t rx_frame[E1000_EMU_FRAME_MAX + 4]; // 加上或剥离VLAN标签后的帧
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_oversize; // 没有打开长帧接收而丢弃的帧
+    uint64_t rx_vlan_filtered; // 不在VLAN过滤表里而丢弃的帧
+    uint64_t rx_addr_filtered; // 目的地址不匹配而丢弃的帧
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_cksum; // 插入了校验和的报文数
+    uint64_t tx_tso;   // 做了TCP分段的报文数，切出来的分段计入tx_packets
+    tx_ctx_desc_t tx_ctx; // 最近一个上下文描述符
+    uint8_t tx_popts;     // 当前报文第一个描述符的POPTS
+    uint8_t tx_tse;       // 当前报文要做TCP分段
+    uint8_t tx_vle;       // 当前报文要插入VLAN标签
+    uint16_t tx_vlan_tci;
+    uint32_t tx_len;      // tx_frame中已组装的长度
+    const uint8_t *tx_last; // 最近发出的一帧，指向tx_frame或tx_seg
+    uint32_t tx_last_len;
+    e1000_emu_tx_hook_t tx_hook;
+    void *tx_hook_arg;
+    uint8_t tx_frame[E1000_EMU_TX_FRAME_MAX]; // 驱动交来的报文，校验和插在这里，不改驱动的缓冲区
+    uint8_t tx_seg[E1000_EMU_TX_SEG_MAX];     // TSO切出来的分段
+};
+
+int e1000_is_emu(const char *pci_id);
+struct e1000_device *e1000_emu_device_get(const char *spec);
+void e1000_emu_stop(struct e1000_device *dev);
+int e1000_emu_set_frame_len(struct e1000_device *dev, uint16_t len);
+void e1000_emu_set_frame_vlan(struct e1000_device *dev, uint16_t tci, uint16_t nr);
+int e1000_emu_set_frame_dst(struct e1000_device *dev, const uint8_t (*addrs)[6], int n);
+void e1000_emu_set_tx_hook(struct e1000_device *dev, e1000_emu_tx_hook_t hook, void *arg);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "e1000.h"
+#include "pktbuf.h"
+
+#define ENGINE_MAX_WORKERS 16
+#define ENGINE_BURST 32
+
+/**
+ * @brief 报文处理回调
+ *
+ * 处理从port_id收到的n个报文，把要发送的报文移到pkts前面并返回个数，
+ * 不发送的报文由回调自己释放。*tx_port进入时等于port_id，可以改成
+ * 同一个工作线程负责的其它端口，否则报文会被丢弃。
+ */
+typedef int (*engine_handler_t)(int port_id, struct pktbuf **pkts, int n, int *tx_port, void *arg);
+
+/**
+ * 每个工作线程的计数，只由工作线程自己写，其它线程只读
+ */
+struct engine_worker_stats {
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t tx_drops;  // 发送环满或者发送端口不属于本线程
+    uint64_t loops;     // 轮询所有端口的次数
+    uint64_t idle_loops; // 所有端口都没有收到报文的次数
+};
+
+/**
+ * 工作线程：绑定到一个CPU，独占若干端口，运行 RX突发 -> 回调 -> TX突发
+ *
+ * 端口只属于一个线程，收发都不需要加锁。
+ */
+struct engine_worker {
+    pthread_t tid;
+    int id;
+    int cpu; // -1: 不绑定
+    int nr_ports;
+    int ports[E1000_MAX_DEVICES];
+    struct engine *engine;
+    struct engine_worker_stats stats __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+struct engine {
+    int nr_workers;
+    struct engine_worker workers[ENGINE_MAX_WORKERS];
+    int port_owner[E1000_MAX_DEVICES]; // 端口所属的工作线程，-1表示未分配
+    engine_handler_t handler;
+    void *arg;
+    volatile int running;
+};
+
+int engine_init(struct engine *eng, engine_handler_t handler, void *arg);
+int engine_add_worker(struct engine *eng, int cpu);
+int engine_assign(struct engine *eng, int worker, int port_id);
+int engine_parse(struct engine *eng, const char *spec);
+int engine_start(struct engine *eng);
+void engine_stop(struct engine *eng);
+void engine_stats_get(struct engine *eng, int worker, struct engine_worker_stats *stats);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _IP_H_
+#define _IP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define IP_PROTO_TCP 6
+#define IP_PROTO_UDP 17
+
+struct ipv4_hdr {
+    uint8_t ver_ihl;    // 版本(4) | 首部长度(4)，单位4字节
+    uint8_t tos;
+    uint16_t total_len;
+    uint16_t id;
+    uint16_t frag_off;
+    uint8_t ttl;
+    uint8_t proto;
+    uint16_t cksum;
+    uint32_t src;
+    uint32_t dst;
+} __attribute__((packed));
+
+struct udp_hdr {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t len;
+    uint16_t cksum;
+} __attribute__((packed));
+
+struct tcp_hdr {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t data_off; // 高4位是首部长度，单位4字节
+    uint8_t flags;
+    uint16_t window;
+    uint16_t cksum;
+    uint16_t urg_ptr;
+} __attribute__((packed));
+
+#define IPV4_HDR_LEN(ip) (((ip)->ver_ihl & 0x0f) * 4)
+#define TCP_HDR_LEN(tcp) (((tcp)->data_off >> 4) * 4)
+
+/*
+ * 校验和都按内存中的字节序计算，结果直接存进报文即可，不需要再转网络字节序
+ */
+uint32_t ip_cksum_add(uint32_t sum, const void *data, size_t len);
+uint16_t ip_cksum_fold(uint32_t sum);
+uint16_t ip_cksum(const void *data, size_t len);
+uint16_t ipv4_phdr_cksum(const struct ipv4_hdr *ip, uint16_t l4_len);
+uint16_t ipv4_udptcp_cksum(const struct ipv4_hdr *ip, const void *l4, uint16_t l4_len);
+
+#endif
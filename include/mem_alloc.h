@@ -1,15 +1,36 @@
 #ifndef _MEM_ALLOC_H_
 #define _MEM_ALLOC_H_
 
-struct page {
-    void *addr;
-    void *phys_addr;
+#include <stddef.h>
+#include <stdint.h>
+
+#define DMA_MEM_DEFAULT_SIZE (64UL << 20)
+
+struct addr_map_entry {
+    uint64_t key; // 页帧号 + 1，0表示空槽
+    uint64_t val; // 对应的页帧号
 };
 
-struct page *alloc_page();
-void free_page(struct page *p);
+// 虚拟地址和物理地址互相转换的映射表，以页帧号为键
+struct addr_map {
+    unsigned page_shift;
+    size_t mask;
+    size_t nr;
+    struct addr_map_entry *v2p;
+    struct addr_map_entry *p2v;
+};
+
+int addr_map_init(struct addr_map *m, size_t nr_pages, unsigned page_shift);
+void addr_map_destroy(struct addr_map *m);
+int addr_map_add(struct addr_map *m, void *virt, void *phys);
+void *addr_map_v2p(const struct addr_map *m, void *virt);
+void *addr_map_p2v(const struct addr_map *m, void *phys);
+
+int dma_mem_init(size_t size);
+void *dma_alloc(size_t size, size_t align);
+void mem_set_iova_va(int enable);
 
 void *phys_to_virt(void *phys_addr);
 void *virt_to_phys(void *virt_addr);
 
-#endif
\ No newline at end of file
+#endif
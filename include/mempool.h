@@ -0,0 +1,41 @@
+#ifndef _MEMPOOL_H_
+#define _MEMPOOL_H_
+
+#include <stdint.h>
+#include "ring.h"
+
+#define MEMPOOL_CACHE_SIZE  32 // 每个线程缓存的对象个数
+#define MEMPOOL_CACHE_FLUSH (MEMPOOL_CACHE_SIZE * 3 / 2)
+#define MEMPOOL_MAX_THREADS 64 // 超过这个数的线程直接访问共享环，不使用缓存
+
+struct mempool_cache {
+    unsigned len;
+    void *objs[MEMPOOL_CACHE_SIZE * 3]; // 放入一批后才检查是否需要刷回共享环，所以要留足空间
+} __attribute__((aligned(64)));
+
+/**
+ * 固定大小对象的缓冲池
+ *
+ * 对象在创建时从DMA内存区分配，之后只在共享环和线程缓存之间流转。
+ * 线程优先从自己的缓存里分配和释放，缓存空了或满了才批量访问共享环，
+ * 整个过程不加锁也没有系统调用。
+ * 线程退出前应调用 mempool_cache_flush() 把缓存的对象还给共享环。
+ */
+struct mempool {
+    struct ring *ring; // 多生产者多消费者的共享环
+    unsigned size;     // 对象个数
+    unsigned elt_size; // 每个对象的大小
+    struct mempool_cache caches[MEMPOOL_MAX_THREADS];
+};
+
+typedef void (*mempool_obj_init_t)(struct mempool *mp, void *obj, void *arg);
+
+struct mempool *mempool_create(unsigned n, unsigned elt_size, mempool_obj_init_t init, void *arg);
+void *mempool_get(struct mempool *mp);
+void mempool_put(struct mempool *mp, void *obj);
+int mempool_get_bulk(struct mempool *mp, void **objs, unsigned n);
+void mempool_put_bulk(struct mempool *mp, void **objs, unsigned n);
+void mempool_cache_flush(struct mempool *mp);
+unsigned mempool_avail(struct mempool *mp);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef _PCAP_H_
+#define _PCAP_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "pktbuf.h"
+
+#define PCAP_MAGIC      0xa1b2c3d4 // 时间戳精度为微秒
+#define PCAP_MAGIC_NSEC 0xa1b23c4d // 时间戳精度为纳秒
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_SNAPLEN_MAX 65535
+#define PCAP_CHUNK_SIZE (4 << 20) // 写文件时每次映射的大小
+#define PCAP_PATH_MAX 256
+#define PCAP_PATH_SUFFIX 16 // 文件名后面可能加上的轮转序号".4294967295"和".part"
+
+struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} __attribute__((packed));
+
+struct pcap_pkt_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_frac; // 微秒或纳秒
+    uint32_t caplen;  // 文件中保存的长度
+    uint32_t len;     // 报文原始长度
+} __attribute__((packed));
+
+struct pcap_pkt {
+    const uint8_t *data;
+    uint32_t len;
+    uint64_t ts_ns;
+};
+
+// 整个读进内存的pcap文件
+struct pcap_trace {
+    uint8_t *buf;
+    struct pcap_pkt *pkts;
+    unsigned nr;
+};
+
+// 文件中映射到内存的一块，写满后换成后台线程准备好的下一块
+struct pcap_chunk {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    off_t off;   // 在文件中的偏移
+    int fd;
+    char path[PCAP_PATH_MAX]; // 所在的文件
+};
+
+struct pcap_writer_stats {
+    uint64_t packets;
+    uint64_t bytes;  // 写进文件的字节数，包括文件头和报文头
+    uint64_t files;
+    uint64_t stalls; // 写满一块时下一块还没准备好，等待后台线程的次数
+};
+
+/**
+ * 通过mmap写pcap文件（纳秒时间戳）
+ *
+ * 同时映射两块：写报文的线程只往当前块里拷贝，不做系统调用；
+ * 后台线程提前扩展文件、映射并预先缺页下一块，解除写满的块的映射，
+ * 文件写完后截掉预留的多余部分。写报文只能在一个线程里进行。
+ */
+struct pcap_writer {
+    char path[PCAP_PATH_MAX - PCAP_PATH_SUFFIX];
+    uint32_t snaplen;
+    uint64_t rotate_size;  // 每个文件的大小上限，按块向上取整，0表示不轮转
+    unsigned rotate_files; // 轮转的文件个数，写满后覆盖最早的文件，0表示不限
+    unsigned file_seq;     // 下一个文件的序号
+    struct pcap_chunk chunks[2];
+    int cur;               // 正在写的块
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int next_ready;        // chunks[!cur]已经准备好
+    int retire;            // chunks[!cur]是换下来的块，等待后台线程回收
+    int running;
+    int error;
+    struct pcap_writer_stats stats;
+};
+
+int pcap_load(const char *path, struct pcap_trace *trace);
+void pcap_trace_free(struct pcap_trace *trace);
+struct pcap_writer *pcap_writer_open(const char *path, uint32_t snaplen,
+                                     uint64_t rotate_size, unsigned rotate_files);
+int pcap_writer_begin(struct pcap_writer *w, uint64_t ts_ns, uint32_t len, uint32_t *caplen);
+int pcap_writer_append(struct pcap_writer *w, const void *data, uint32_t n);
+int pcap_write(struct pcap_writer *w, uint64_t ts_ns, const void *data, uint32_t len);
+int pcap_write_pkt(struct pcap_writer *w, uint64_t ts_ns, struct pktbuf *pkt);
+void pcap_writer_close(struct pcap_writer *w, struct pcap_writer_stats *stats);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _PKTBUF_H_
+#define _PKTBUF_H_
+
+#include <stdint.h>
+#include "mempool.h"
+
+#define PKTBUF_HDR_SIZE  128  // struct pktbuf 所在的区域
+#define PKTBUF_HEADROOM  128  // 数据前面预留的空间，方便添加报文头
+#define PKTBUF_DATA_SIZE 2048 // 默认数据区大小，和RCTL_BSIZE_2048对应
+#define PKTBUF_DATA_SIZE_MAX (UINT16_MAX - PKTBUF_HEADROOM) // buf_len是16位的
+
+// 发送卸载标志，放在ol_flags里
+#define PKTBUF_TX_IP_CKSUM  (1ULL << 0) // 网卡计算IPv4首部校验和
+#define PKTBUF_TX_TCP_CKSUM (1ULL << 1) // 网卡计算TCP校验和
+#define PKTBUF_TX_UDP_CKSUM (1ULL << 2) // 网卡计算UDP校验和
+#define PKTBUF_TX_VLAN      (1ULL << 3) // 网卡插入vlan_tci，需要打开VLAN剥离(CTRL.VME)
+#define PKTBUF_TX_L4_MASK   (PKTBUF_TX_TCP_CKSUM | PKTBUF_TX_UDP_CKSUM)
+#define PKTBUF_TX_CKSUM_MASK (PKTBUF_TX_IP_CKSUM | PKTBUF_TX_L4_MASK)
+
+// 接收元数据，由驱动根据描述符填写
+#define PKTBUF_RX_IP_CKSUM_GOOD (1ULL << 8)  // 硬件检查过IPv4首部校验和，正确
+#define PKTBUF_RX_IP_CKSUM_BAD  (1ULL << 9)  // 硬件检查过IPv4首部校验和，错误
+#define PKTBUF_RX_L4_CKSUM_GOOD (1ULL << 10) // 硬件检查过TCP/UDP校验和，正确
+#define PKTBUF_RX_L4_CKSUM_BAD  (1ULL << 11) // 硬件检查过TCP/UDP校验和，错误
+#define PKTBUF_RX_UDP           (1ULL << 12) // 硬件识别出是UDP报文
+#define PKTBUF_RX_VLAN          (1ULL << 13) // vlan_tci有效
+#define PKTBUF_RX_VLAN_STRIPPED (1ULL << 14) // VLAN标签已经从报文里剥离
+
+/**
+ * 报文缓冲区，类似于 dpdk 的 mbuf
+ *
+ * +-----------------+----------+-----------------+
+ * | struct pktbuf   | headroom |      data       |
+ * +-----------------+----------+-----------------+
+ * ^                 ^          ^
+ * 分配的起始地址     buf_addr   buf_addr + data_off
+ *
+ * 缓冲区的物理地址在创建时就算好了，收发时可以直接填进描述符。
+ *
+ * 一个报文可以由多个缓冲区用next串起来，比如巨帧，或者首部和负载分开存放。
+ * 第一个缓冲区的nb_segs和pkt_len描述整个报文，data_len是每一段自己的长度。
+ * 单段报文只需要设置data_len，发送时按每段的data_len填描述符。
+ */
+struct pktbuf {
+    void *buf_addr;           // 缓冲区虚拟地址
+    uint64_t buf_phys;        // 缓冲区物理地址
+    uint16_t buf_len;         // 缓冲区长度
+    uint16_t data_off;        // 数据相对 buf_addr 的偏移
+    uint16_t data_len;        // 数据长度
+    struct mempool *pool;     // 所属的缓冲池
+    uint64_t ol_flags;        // 卸载标志，PKTBUF_TX_*
+    uint8_t l2_len;           // 以太网首部长度，校验和卸载时使用
+    uint16_t l3_len;          // IP首部长度
+    uint16_t vlan_tci;        // 接收时网卡报告的VLAN标签，发送时由网卡插入的标签
+    struct pktbuf *next;      // 下一段，NULL表示最后一段
+    uint16_t nb_segs;         // 段数，只在第一段有效
+    uint32_t pkt_len;         // 报文总长度，只在第一段有效
+};
+
+#define pktbuf_data(p) ((char *)(p)->buf_addr + (p)->data_off)
+#define pktbuf_data_phys(p) ((p)->buf_phys + (p)->data_off)
+#define pktbuf_tailroom(p) ((p)->buf_len - (p)->data_off - (p)->data_len)
+// 报文总长度，单段报文可以只设置data_len
+#define pktbuf_pkt_len(p) ((p)->next ? (p)->pkt_len : (p)->data_len)
+
+struct mempool *pktbuf_pool_create(unsigned n);
+struct mempool *pktbuf_pool_create_size(unsigned n, uint16_t data_size);
+struct pktbuf *pktbuf_alloc(struct mempool *pool);
+void pktbuf_free(struct pktbuf *p);
+void pktbuf_free_seg(struct pktbuf *p);
+int pktbuf_chain(struct pktbuf *head, struct pktbuf *tail);
+int pktbuf_tx_cksum_prepare(struct pktbuf *p);
+
+#endif
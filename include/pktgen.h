@@ -0,0 +1,60 @@
+#ifndef _PKTGEN_H_
+#define _PKTGEN_H_
+
+#include <stdint.h>
+#include "e1000.h"
+#include "pktbuf.h"
+#include "pcap.h"
+
+#define PKTGEN_BURST 32
+#define PKTGEN_MAX_FLOWS 65536
+#define PKTGEN_PKT_LEN_MIN 60   // 不含FCS
+#define PKTGEN_WIRE_OVERHEAD 24 // 前导码8 + 帧间隔12 + FCS 4
+#define PKTGEN_MAX_LAG_US 1000  // 落后计划超过这么久就不再追赶
+
+struct pktgen_cfg {
+    const char *pcap;  // 回放的pcap文件，NULL表示合成UDP报文
+    uint16_t pkt_len;  // 合成报文的帧长，不含FCS
+    uint32_t nr_flows; // 合成报文轮流使用的流个数，源IP和源端口依次递增
+    uint64_t rate_pps; // 目标速率，0表示不限速
+    uint64_t rate_bps; // 目标线路速率，包括前导码、帧间隔和FCS，设置后忽略rate_pps
+    uint64_t count;    // 发送的报文数，0表示一直发
+    uint8_t dst_mac[6];
+};
+
+/**
+ * 发送计数，只由发送线程自己写，其它线程只读
+ */
+struct pktgen_stats {
+    uint64_t tx_packets;
+    uint64_t tx_bytes;   // 帧长之和，不含FCS
+    uint64_t ring_full;  // 发送队列放不下整批报文的次数
+    uint64_t late;       // 落后计划太多、放弃追赶的次数，说明达不到目标速率
+};
+
+/**
+ * 报文生成器：按TSC计时，把到了发送时间的报文攒成一批调用e1000_tx_burst()
+ *
+ * 报文从生成器自己的缓冲池分配。合成UDP报文时缓冲池创建后整个填好负载，
+ * 每个报文只拷贝一份按流预先算好校验和的首部；回放时从读进内存的pcap拷贝整帧。
+ */
+struct pktgen {
+    struct pktgen_cfg cfg;
+    struct e1000_device *dev;
+    struct mempool *pool;
+    struct pcap_trace trace; // 回放的报文
+    uint8_t (*hdrs)[64];     // 合成报文每个流的首部
+    uint32_t next_pkt;       // 下一个发送的报文或者流
+    uint64_t tsc_hz;
+    uint64_t gap;            // 限速时每个报文的间隔，TSC周期左移16位，按bps限速时是每字节的间隔
+    struct pktgen_stats stats __attribute__((aligned(64)));
+};
+
+uint64_t pktgen_tsc_hz(void);
+size_t pktgen_dma_mem_size(int tx_nr);
+int pktgen_init(struct pktgen *gen, struct e1000_device *dev, const struct pktgen_cfg *cfg);
+int pktgen_run(struct pktgen *gen, volatile int *running);
+void pktgen_stats_get(struct pktgen *gen, struct pktgen_stats *stats);
+void pktgen_free(struct pktgen *gen);
+
+#endif
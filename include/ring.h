@@ -0,0 +1,51 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdint.h>
+
+#define RING_F_SP_ENQ 0x1 // 只有一个生产者
+#define RING_F_SC_DEQ 0x2 // 只有一个消费者
+
+struct ring_headtail {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    int single; // 单生产者/单消费者时不需要CAS
+};
+
+/**
+ * 无锁环形队列，存放指针，用来在线程之间传递报文缓冲区
+ *
+ * 生产者先移动head占住一段位置，写完对象后再移动tail发布出去，
+ * 消费者同理。多生产者/多消费者时head用CAS抢占，tail按抢占顺序推进；
+ * 单生产者/单消费者时都是普通的store。
+ * 生产者、消费者的索引和对象数组各自占用不同的cache line，避免伪共享。
+ */
+struct ring {
+    struct ring_headtail prod __attribute__((aligned(64)));
+    struct ring_headtail cons __attribute__((aligned(64)));
+    uint32_t size; // 2的幂
+    uint32_t mask;
+    unsigned flags;
+    void *objs[] __attribute__((aligned(64)));
+};
+
+struct ring *ring_create(unsigned count, unsigned flags);
+void ring_free(struct ring *r);
+unsigned ring_enqueue_bulk(struct ring *r, void *const *objs, unsigned n);
+unsigned ring_enqueue_burst(struct ring *r, void *const *objs, unsigned n);
+unsigned ring_dequeue_bulk(struct ring *r, void **objs, unsigned n);
+unsigned ring_dequeue_burst(struct ring *r, void **objs, unsigned n);
+unsigned ring_count(const struct ring *r);
+unsigned ring_free_count(const struct ring *r);
+
+static inline int ring_enqueue(struct ring *r, void *obj)
+{
+    return ring_enqueue_bulk(r, &obj, 1) ? 0 : -1;
+}
+
+static inline int ring_dequeue(struct ring *r, void **obj)
+{
+    return ring_dequeue_bulk(r, obj, 1) ? 0 : -1;
+}
+
+#endif
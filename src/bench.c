@@ -0,0 +1,2813 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "e1000.h"
+#include "mem_alloc.h"
+#include "mempool.h"
+#include "ring.h"
+#include "ip.h"
+#include "ethernet.h"
+#include <arpa/inet.h>
+#include "e1000_emu.h"
+#include "pcap.h"
+#include "pktgen.h"
+#include "engine.h"
+#include "bench.h"
+
+#define BENCH_PKT_LEN  64
+#define BENCH_RX_PKTS  (10 * 1000 * 1000)
+#define BENCH_BURST    32
+#define BENCH_LOOKUPS  (10 * 1000 * 1000)
+#define BENCH_MP_OBJS  8192
+#define BENCH_MP_OPS   (2 * 1000 * 1000)
+#define BENCH_EMU_NS   (2 * 1000000000ULL)
+#define BENCH_CKSUM_PKTS (2 * 1000 * 1000)
+#define BENCH_TSO_PAYLOAD 64000
+#define BENCH_TSO_MSS     1460
+#define BENCH_TSO_SENDS   (100 * 1000)
+#define BENCH_TSO_CHAIN     4
+#define BENCH_TSO_CHAIN_SEG 2000 // 链上每段依次少100字节
+#define BENCH_JUMBO_LEN 9014
+#define BENCH_JUMBO_CHECKS 1000
+#define BENCH_JUMBO_NS (1000000000ULL)
+#define BENCH_VLAN_TCI  ((3 << 13) | 100) // 优先级3，VLAN 100
+#define BENCH_VLAN_NR   8                 // 合成帧轮流使用VLAN 100~107
+#define BENCH_VLAN_CHECKS 1000
+#define BENCH_VLAN_PKTS (5 * 1000 * 1000)
+#define BENCH_FILTER_DSTS 6
+#define BENCH_FILTER_NS (200 * 1000000ULL)
+#define BENCH_SCAN_DESCS 4096
+#define BENCH_SCAN_CHECKS 100000
+#define BENCH_SCAN_ROUNDS 20000
+#define BENCH_CAPTURE_CHECKS 100000
+#define BENCH_CAPTURE_SNAPLEN 96
+#define BENCH_CAPTURE_FILES 3
+#define BENCH_CAPTURE_NS (1000000000ULL)
+#define BENCH_PKTGEN_FLOWS 4
+#define BENCH_PKTGEN_LEN 128
+#define BENCH_PKTGEN_CHECKS 100000
+#define BENCH_PKTGEN_NS (500 * 1000000ULL)
+#define BENCH_POLL_NS (200 * 1000000ULL)
+#define BENCH_POLL_WAKE_US 3000 // 睡眠之后多久恢复流量，小于E1000_SLEEP_TIMEOUT_MS
+#define BENCH_INTR_PPS 40000 // 自动中断调节中间一档的速率，10000~100000pps
+#define BENCH_STATS_NS (200 * 1000000ULL)
+#define BENCH_STATS_INTERVAL_MS 10
+#define BENCH_PORTS 4
+#define BENCH_PORTS_CHECKS 1000
+#define BENCH_ENGINE_NS (300 * 1000000ULL)
+#define BENCH_RING_SIZE 1024
+#define BENCH_RING_OBJS (20 * 1000 * 1000)
+#define BENCH_RING_RTTS (100 * 1000)
+#define BENCH_RING_SPINS 1024 // 空转这么多次后让出CPU，单核上对端才能运行
+
+struct bench {
+    const char *name;
+    const char *desc;
+    int (*run)(void);
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief 时间戳计数器，x86以外的平台用纳秒代替
+ */
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+static void bench_report(const char *name, uint64_t pkts, uint64_t ns, uint64_t cycles, uint64_t doorbells)
+{
+    printf("%-10s %10lu pkts  %7.2f ns/pkt  %7.2f cycles/pkt  %7.2f Mpps  %.3f doorbell/pkt\n",
+           name, pkts, (double)ns / pkts, (double)cycles / pkts, pkts * 1000.0 / ns,
+           (double)doorbells / pkts);
+}
+
+/**
+ * @brief 创建一个寄存器空间位于进程内存中的e1000设备
+ * 
+ * 只用来驱动描述符环，DMA地址直接使用虚拟地址。
+ */
+static struct e1000_device *bench_dev_create(void)
+{
+    struct e1000_device *dev = calloc(1, sizeof(struct e1000_device));
+    if (!dev)
+        return NULL;
+    dev->hw_addr = calloc(1, E1000_BAR_SIZE);
+    if (!dev->hw_addr) {
+        free(dev);
+        return NULL;
+    }
+    snprintf(dev->name, PCI_PRI_STR_SIZE, "bench");
+    dev->uio_fd = -1;
+    dev->config_fd = -1;
+    mem_set_iova_va(1);
+    if (e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0)
+        return NULL;
+    return dev;
+}
+
+/**
+ * @brief 把p所在的缓存行逐出，模拟网卡DMA写内存后CPU缓存里的副本失效
+ */
+static inline void bench_dma_flush(const void *p)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_clflush(p);
+#else
+    (void)p;
+#endif
+}
+
+/**
+ * @brief 模拟网卡接收，把RDH到RDT之间的描述符都填上报文
+ * 
+ * @param cold: 写完后逐出描述符和报文数据所在的缓存行，和真实网卡DMA之后一样，
+ *              驱动读描述符、应用读首部时都要从内存取
+ * @return 新的RDH
+ */
+static uint16_t bench_nic_rx(struct e1000_device *dev, uint16_t head, int *filled, int cold)
+{
+    uint16_t tail = E1000_READ_REG(dev->hw_addr, E1000_RDT);
+    *filled = 0;
+    while (head != tail) {
+        struct rx_desc_t *desc = &dev->rx_desc[head];
+        desc->length = BENCH_PKT_LEN;
+        desc->error = 0;
+        desc->status = RS_DD | RS_EOP;
+        if (cold) {
+            bench_dma_flush(desc);
+            bench_dma_flush(pktbuf_data(dev->rx_bufs[head]));
+        }
+        head = (head + 1) & dev->rx_mask;
+        (*filled)++;
+    }
+    E1000_WRITE_REG(dev->hw_addr, E1000_RDH, head);
+    return head;
+}
+
+static int bench_rx(void)
+{
+    struct e1000_device *dev = bench_dev_create();
+    if (!dev) {
+        printf("bench_dev_create failed\n");
+        return -1;
+    }
+
+    char buf[2048];
+    struct pktbuf *pkts[BENCH_BURST];
+    uint16_t head = 0;
+    uint64_t total, doorbells, start, cycles;
+    int filled;
+
+    // 单包接收：每个报文都写一次RDT，并拷贝到调用者的缓冲区
+    total = 0;
+    doorbells = 0;
+    start = now_ns();
+    cycles = bench_cycles();
+    while (total < BENCH_RX_PKTS) {
+        head = bench_nic_rx(dev, head, &filled, 0);
+        for (int i = 0; i < filled; i++) {
+            e1000_recv(dev, buf, sizeof(buf));
+            doorbells++;
+        }
+        total += filled;
+    }
+    bench_report("rx single", total, now_ns() - start, bench_cycles() - cycles, doorbells);
+
+    // 批量接收：每个burst只写一次RDT，报文缓冲区直接交给调用者；
+    // 第二遍像真正的应用一样读一下以太网首部，第三遍再模拟DMA让描述符和报文数据不在缓存里。
+    // 只统计驱动和应用的时间，不算模拟网卡的时间
+    static const char *names[] = {"rx burst", "rx hdr", "rx cold"};
+    for (int mode = 0; mode < 3; mode++) {
+        volatile uint16_t sink = 0;
+        uint64_t nic_ns = 0, nic_cycles = 0;
+        total = 0;
+        doorbells = 0;
+        start = now_ns();
+        cycles = bench_cycles();
+        while (total < BENCH_RX_PKTS) {
+            uint64_t t = now_ns(), c = bench_cycles();
+            head = bench_nic_rx(dev, head, &filled, mode == 2);
+            nic_cycles += bench_cycles() - c;
+            nic_ns += now_ns() - t;
+            int got = 0;
+            while (got < filled) {
+                int nb_rx = e1000_rx_burst(dev, pkts, BENCH_BURST);
+                for (int i = 0; i < nb_rx; i++) {
+                    if (mode > 0)
+                        sink += ((struct eth_hdr *)pktbuf_data(pkts[i]))->type;
+                    pktbuf_free(pkts[i]);
+                }
+                got += nb_rx;
+                doorbells++;
+            }
+            total += filled;
+        }
+        bench_report(names[mode], total, now_ns() - start - nic_ns,
+                     bench_cycles() - cycles - nic_cycles, doorbells);
+    }
+    return 0;
+}
+
+/**
+ * @brief 模拟网卡发送，消费TDH到TDT之间的描述符，设置了RS的回写DD
+ * 
+ * @return 新的TDH
+ */
+static uint16_t bench_nic_tx(struct e1000_device *dev, uint16_t head)
+{
+    uint16_t tail = E1000_READ_REG(dev->hw_addr, E1000_TDT);
+    while (head != tail) {
+        struct tx_desc_t *desc = &dev->tx_desc[head];
+        if (desc->cmd & TCMD_RS)
+            desc->status = TS_DD;
+        head = (head + 1) & dev->tx_mask;
+    }
+    E1000_WRITE_REG(dev->hw_addr, E1000_TDH, head);
+    return head;
+}
+
+/**
+ * @brief 从缓冲池取n个报文
+ */
+static int bench_pkts_alloc(struct e1000_device *dev, struct pktbuf **pkts, int n)
+{
+    for (int i = 0; i < n; i++) {
+        pkts[i] = pktbuf_alloc(dev->pool);
+        if (!pkts[i])
+            return i;
+        pkts[i]->data_len = BENCH_PKT_LEN;
+    }
+    return n;
+}
+
+static void bench_pkts_free(struct pktbuf **pkts, int n)
+{
+    for (int i = 0; i < n; i++)
+        pktbuf_free(pkts[i]);
+}
+
+/**
+ * @brief 批量发送：报文缓冲区直接挂到描述符上，每个burst只写一次TDT
+ */
+static uint16_t bench_tx_burst(struct e1000_device *dev, uint16_t head, const char *name)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t total = 0, doorbells = 0;
+    uint64_t start = now_ns(), cycles = bench_cycles();
+    int n = 0, sent;
+
+    while (total < BENCH_RX_PKTS) {
+        // 没发出去的报文留到下一轮重发
+        n += bench_pkts_alloc(dev, pkts + n, BENCH_BURST - n);
+        sent = e1000_tx_burst(dev, pkts, n);
+        memmove(pkts, pkts + sent, (n - sent) * sizeof(pkts[0]));
+        n -= sent;
+        total += sent;
+        doorbells += sent > 0;
+        if (n > 0)
+            head = bench_nic_tx(dev, head);
+    }
+    bench_pkts_free(pkts, n);
+    bench_report(name, total, now_ns() - start, bench_cycles() - cycles, doorbells);
+    return head;
+}
+
+static int bench_tx(void)
+{
+    struct e1000_device *dev = bench_dev_create();
+    if (!dev) {
+        printf("bench_dev_create failed\n");
+        return -1;
+    }
+
+    char buf[BENCH_PKT_LEN] = {0};
+    uint16_t head = 0;
+    uint64_t total, doorbells, start, cycles;
+
+    // 单包发送：每个报文都拷贝一次、写一次TDT，队列满时e1000_send()立即返回
+    total = 0;
+    doorbells = 0;
+    start = now_ns();
+    cycles = bench_cycles();
+    while (total < BENCH_RX_PKTS) {
+        while (e1000_send(dev, buf, sizeof(buf)) == 0) {
+            total++;
+            doorbells++;
+        }
+        head = bench_nic_tx(dev, head);
+    }
+    bench_report("tx single", total, now_ns() - start, bench_cycles() - cycles, doorbells);
+
+    // 每次发送都回收，和空闲描述符低于阈值时才批量回收对比
+    e1000_tx_set_free_thresh(dev, dev->tx_nr - 1);
+    head = bench_tx_burst(dev, head, "tx eager");
+    e1000_tx_set_free_thresh(dev, 0);
+    head = bench_tx_burst(dev, head, "tx burst");
+
+    // 发送停在一组中间时，网卡发完后要能全部回收
+    struct pktbuf *pkts[BENCH_BURST];
+    head = bench_nic_tx(dev, head);
+    e1000_tx_reclaim(dev);
+    for (int n = 1; n < TX_RS_THRESH; n++) {
+        int sent = e1000_tx_burst(dev, pkts, bench_pkts_alloc(dev, pkts, n));
+        head = bench_nic_tx(dev, head);
+        e1000_tx_reclaim(dev);
+        if (sent != n || dev->tx_free != dev->tx_nr - 1) {
+            printf("BAD: sent %d of %d, %u descriptors not reclaimed\n",
+                   sent, n, dev->tx_nr - 1 - dev->tx_free);
+            return -1;
+        }
+    }
+    printf("tx reclaim partial groups: ok\n");
+    return 0;
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/**
+ * @brief 地址转换耗时随登记页数的变化
+ * 
+ * 虚拟地址连续、物理页帧随机打乱，查询的地址随机落在页内任意位置。
+ */
+static int bench_xlate(void)
+{
+    static const size_t nr_pages[] = {1024, 16384, 262144, 524288};
+    const size_t nr_addrs = 1 << 20;
+    const uint64_t virt_base = 0x7f0000000000ULL;
+    const uint64_t phys_base = 0x100000000ULL;
+    uint64_t seed = 0x123456789ULL;
+
+    void **addrs = malloc(nr_addrs * sizeof(void *));
+    void **phys = malloc(nr_addrs * sizeof(void *));
+    if (!addrs || !phys) {
+        printf("malloc failed\n");
+        return -1;
+    }
+
+    for (size_t k = 0; k < sizeof(nr_pages) / sizeof(nr_pages[0]); k++) {
+        size_t n = nr_pages[k];
+        struct addr_map map;
+        uint64_t *frames = malloc(n * sizeof(uint64_t));
+        if (!frames || addr_map_init(&map, n, 12) < 0) {
+            printf("addr_map_init failed\n");
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++)
+            frames[i] = i;
+        for (size_t i = n - 1; i > 0; i--) {
+            size_t j = xorshift64(&seed) % (i + 1);
+            uint64_t t = frames[i];
+            frames[i] = frames[j];
+            frames[j] = t;
+        }
+        for (size_t i = 0; i < n; i++)
+            addr_map_add(&map, (void *)(virt_base + (i << 12)), (void *)(phys_base + (frames[i] << 12)));
+        for (size_t i = 0; i < nr_addrs; i++)
+            addrs[i] = (void *)(virt_base + xorshift64(&seed) % (n << 12));
+
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++)
+            phys[i & (nr_addrs - 1)] = addr_map_v2p(&map, addrs[i & (nr_addrs - 1)]);
+        uint64_t v2p_ns = now_ns() - start;
+
+        size_t bad = 0;
+        start = now_ns();
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++)
+            bad += addr_map_p2v(&map, phys[i & (nr_addrs - 1)]) != addrs[i & (nr_addrs - 1)];
+        uint64_t p2v_ns = now_ns() - start;
+
+        printf("%7zu pages  virt_to_phys %6.2f ns  phys_to_virt %6.2f ns  %zu mismatches\n",
+               n, (double)v2p_ns / BENCH_LOOKUPS, (double)p2v_ns / BENCH_LOOKUPS, bad);
+        addr_map_destroy(&map);
+        free(frames);
+    }
+    free(addrs);
+    free(phys);
+    return 0;
+}
+
+struct bench_mp_arg {
+    struct mempool *mp;
+    int id;
+    unsigned bulk;    // 每次分配释放的个数，0表示随机
+    uint64_t ops;
+    uint64_t errors;
+};
+
+/**
+ * @brief 多线程反复分配释放，用对象里的owner字段检查同一个对象是否被重复分配
+ */
+static void *bench_mp_worker(void *arg)
+{
+    struct bench_mp_arg *a = arg;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL * (a->id + 1);
+    void *objs[MEMPOOL_CACHE_SIZE];
+
+    for (uint64_t i = 0; i < a->ops; i++) {
+        unsigned n = a->bulk ? a->bulk : 1 + xorshift64(&seed) % MEMPOOL_CACHE_SIZE;
+        if (mempool_get_bulk(a->mp, objs, n) < 0)
+            continue;
+        if (a->bulk == 0) {
+            for (unsigned j = 0; j < n; j++) {
+                uint64_t expected = 0;
+                if (!__atomic_compare_exchange_n((uint64_t *)objs[j], &expected, a->id + 1, 0,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                    a->errors++;
+            }
+            for (unsigned j = 0; j < n; j++) {
+                if (__atomic_exchange_n((uint64_t *)objs[j], 0, __ATOMIC_ACQ_REL) != (uint64_t)a->id + 1)
+                    a->errors++;
+            }
+        }
+        mempool_put_bulk(a->mp, objs, n);
+    }
+    mempool_cache_flush(a->mp);
+    return NULL;
+}
+
+static uint64_t bench_mp_run(struct mempool *mp, int nr_threads, unsigned bulk, uint64_t *errors)
+{
+    pthread_t tids[8];
+    struct bench_mp_arg args[8];
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < nr_threads; i++) {
+        args[i].mp = mp;
+        args[i].id = i;
+        args[i].bulk = bulk;
+        args[i].ops = BENCH_MP_OPS;
+        args[i].errors = 0;
+        pthread_create(&tids[i], NULL, bench_mp_worker, &args[i]);
+    }
+    *errors = 0;
+    for (int i = 0; i < nr_threads; i++) {
+        pthread_join(tids[i], NULL);
+        *errors += args[i].errors;
+    }
+    return now_ns() - start;
+}
+
+static int bench_mempool(void)
+{
+    static const int threads[] = {1, 2, 4, 8};
+    uint64_t errors, ns;
+
+    mem_set_iova_va(1);
+    struct mempool *mp = mempool_create(BENCH_MP_OBJS, 64, NULL, NULL);
+    if (!mp) {
+        printf("mempool_create failed\n");
+        return -1;
+    }
+
+    // 压力测试：随机批量大小，检查重复分配和丢失
+    for (size_t k = 0; k < sizeof(threads) / sizeof(threads[0]); k++) {
+        bench_mp_run(mp, threads[k], 0, &errors);
+        unsigned avail = mempool_avail(mp);
+        printf("stress  %d threads: %lu errors, %u/%u objects available\n",
+               threads[k], errors, avail, BENCH_MP_OBJS);
+        if (errors || avail != BENCH_MP_OBJS)
+            return -1;
+    }
+
+    // 吞吐：每秒分配+释放的对象对数
+    for (unsigned bulk = 1; bulk <= MEMPOOL_CACHE_SIZE; bulk *= MEMPOOL_CACHE_SIZE) {
+        for (size_t k = 0; k < sizeof(threads) / sizeof(threads[0]); k++) {
+            ns = bench_mp_run(mp, threads[k], bulk, &errors);
+            uint64_t pairs = (uint64_t)threads[k] * BENCH_MP_OPS * bulk;
+            printf("bulk %2u %d threads: %8.2f M alloc/free pairs/s\n",
+                   bulk, threads[k], pairs * 1000.0 / ns);
+        }
+    }
+    return 0;
+}
+
+struct bench_ring_arg {
+    struct ring *r;
+    struct ring *back; // 测延迟时的回程环
+    unsigned burst;
+    uint64_t objs;
+    uint32_t *samples;
+};
+
+/**
+ * @brief 创建线程，CPU足够时生产者和消费者分别绑定到CPU 0和1，测的是跨核的开销
+ */
+static int bench_ring_thread(pthread_t *tid, int cpu, void *(*fn)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    int ret = pthread_create(tid, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+static inline void bench_ring_wait(unsigned *spins)
+{
+    if (++*spins >= BENCH_RING_SPINS) {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+static void *bench_ring_producer(void *arg)
+{
+    struct bench_ring_arg *a = arg;
+    void *objs[BENCH_BURST];
+    unsigned spins = 0;
+    for (unsigned i = 0; i < a->burst; i++)
+        objs[i] = (void *)(uintptr_t)(i + 1);
+    for (uint64_t done = 0; done < a->objs;) {
+        unsigned n = a->objs - done < a->burst ? a->objs - done : a->burst;
+        unsigned k = ring_enqueue_burst(a->r, objs, n);
+        if (k == 0)
+            bench_ring_wait(&spins);
+        done += k;
+    }
+    return NULL;
+}
+
+static void *bench_ring_consumer(void *arg)
+{
+    struct bench_ring_arg *a = arg;
+    void *objs[BENCH_BURST];
+    unsigned spins = 0;
+    for (uint64_t done = 0; done < a->objs;) {
+        unsigned k = ring_dequeue_burst(a->r, objs, a->burst);
+        if (k == 0)
+            bench_ring_wait(&spins);
+        done += k;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 对端：收到什么就原样送回去
+ */
+static void *bench_ring_echo(void *arg)
+{
+    struct bench_ring_arg *a = arg;
+    void *obj;
+    unsigned spins = 0;
+    for (uint64_t i = 0; i < a->objs; i++) {
+        while (ring_dequeue(a->r, &obj) < 0)
+            bench_ring_wait(&spins);
+        while (ring_enqueue(a->back, obj) < 0)
+            bench_ring_wait(&spins);
+    }
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 环形队列：单线程入队出队开销、两个线程之间的吞吐和单向延迟
+ */
+static int bench_ring(void)
+{
+    static const struct {
+        const char *name;
+        unsigned flags;
+    } modes[] = {
+        {"spsc", RING_F_SP_ENQ | RING_F_SC_DEQ},
+        {"mpmc", 0},
+    };
+    void *objs[BENCH_BURST] = {0};
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        struct ring *r = ring_create(BENCH_RING_SIZE, modes[m].flags);
+        if (!r) {
+            printf("ring_create failed\n");
+            return -1;
+        }
+
+        // 单线程：入队后马上出队，只有原子操作本身的开销
+        for (unsigned burst = 1; burst <= BENCH_BURST; burst *= BENCH_BURST) {
+            uint64_t start = now_ns();
+            for (uint64_t i = 0; i < BENCH_RING_OBJS; i += burst) {
+                ring_enqueue_bulk(r, objs, burst);
+                ring_dequeue_bulk(r, objs, burst);
+            }
+            uint64_t ns = now_ns() - start;
+            printf("%s 1 thread   burst %2u: %7.2f ns/obj  %8.2f M enq+deq/s\n", modes[m].name, burst,
+                   (double)ns / BENCH_RING_OBJS, BENCH_RING_OBJS * 1000.0 / ns);
+        }
+
+        // 两个线程：一个只入队，一个只出队
+        for (unsigned burst = 1; burst <= BENCH_BURST; burst *= BENCH_BURST) {
+            struct bench_ring_arg a = {.r = r, .burst = burst, .objs = BENCH_RING_OBJS};
+            pthread_t prod, cons;
+            uint64_t start = now_ns();
+            if (bench_ring_thread(&cons, 1, bench_ring_consumer, &a) != 0
+                || bench_ring_thread(&prod, 0, bench_ring_producer, &a) != 0) {
+                printf("pthread_create failed\n");
+                return -1;
+            }
+            pthread_join(prod, NULL);
+            pthread_join(cons, NULL);
+            uint64_t ns = now_ns() - start;
+            printf("%s 2 threads  burst %2u: %7.2f ns/obj  %8.2f M objs/s\n", modes[m].name, burst,
+                   (double)ns / BENCH_RING_OBJS, BENCH_RING_OBJS * 1000.0 / ns);
+        }
+        if (ring_count(r) != 0) {
+            printf("%s: %u objects left in ring\n", modes[m].name, ring_count(r));
+            return -1;
+        }
+        ring_free(r);
+    }
+
+    // 延迟：两个SPSC环来回传一个对象，往返时间的一半是单向延迟
+    struct ring *ping = ring_create(BENCH_RING_SIZE, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    struct ring *pong = ring_create(BENCH_RING_SIZE, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    uint32_t *samples = malloc(BENCH_RING_RTTS * sizeof(uint32_t));
+    if (!ping || !pong || !samples)
+        return -1;
+    struct bench_ring_arg a = {.r = ping, .back = pong, .objs = BENCH_RING_RTTS};
+    pthread_t echo;
+    if (bench_ring_thread(&echo, 1, bench_ring_echo, &a) != 0) {
+        printf("pthread_create failed\n");
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1)
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    void *obj = (void *)1;
+    unsigned spins = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < BENCH_RING_RTTS; i++) {
+        uint64_t start = now_ns();
+        ring_enqueue(ping, obj);
+        while (ring_dequeue(pong, &obj) < 0)
+            bench_ring_wait(&spins);
+        samples[i] = now_ns() - start;
+        total += samples[i];
+    }
+    pthread_join(echo, NULL);
+    qsort(samples, BENCH_RING_RTTS, sizeof(uint32_t), cmp_u32);
+    printf("cross-thread latency (one way, %s): avg %.1f ns  p50 %.1f ns  p99 %.1f ns\n",
+           sysconf(_SC_NPROCESSORS_ONLN) > 1 ? "cpu 0 <-> cpu 1" : "single cpu",
+           (double)total / BENCH_RING_RTTS / 2, samples[BENCH_RING_RTTS / 2] / 2.0,
+           samples[BENCH_RING_RTTS * 99 / 100] / 2.0);
+    free(samples);
+    ring_free(ping);
+    ring_free(pong);
+    return 0;
+}
+
+/**
+ * @brief 在报文里写以太网、IPv4和TCP/UDP首部，负载保持缓冲区里原来的内容
+ * 
+ * @param len: 整个报文的长度
+ */
+static void bench_build_l4(struct pktbuf *pkt, uint8_t proto, uint16_t len)
+{
+    char *data = pktbuf_data(pkt);
+    struct eth_hdr *eth = (struct eth_hdr *)data;
+    struct ipv4_hdr *ip = (struct ipv4_hdr *)(eth + 1);
+    uint16_t l4_hdr_len = proto == IP_PROTO_TCP ? sizeof(struct tcp_hdr) : sizeof(struct udp_hdr);
+
+    memset(eth->dst, 0xff, 6);
+    memset(eth->src, 0x02, 6);
+    eth->type = htons(ETH_TYPE_IP);
+    memset(ip, 0, sizeof(*ip) + l4_hdr_len);
+    ip->ver_ihl = 0x45;
+    ip->total_len = htons(len - sizeof(*eth));
+    ip->ttl = 64;
+    ip->proto = proto;
+    ip->src = htonl(0x0a000001);
+    ip->dst = htonl(0x0a000002);
+    if (proto == IP_PROTO_TCP) {
+        struct tcp_hdr *tcp = (struct tcp_hdr *)(ip + 1);
+        tcp->src_port = htons(1234);
+        tcp->dst_port = htons(80);
+        tcp->data_off = (sizeof(*tcp) / 4) << 4;
+        tcp->window = htons(65535);
+    } else {
+        struct udp_hdr *udp = (struct udp_hdr *)(ip + 1);
+        udp->src_port = htons(1234);
+        udp->dst_port = htons(9);
+        udp->len = htons(len - sizeof(*eth) - sizeof(*ip));
+    }
+    pkt->data_len = len;
+    pkt->l2_len = sizeof(*eth);
+    pkt->l3_len = sizeof(*ip);
+}
+
+/**
+ * @brief 软件计算IPv4和TCP/UDP校验和
+ */
+static void bench_sw_cksum(struct pktbuf *pkt)
+{
+    struct ipv4_hdr *ip = (struct ipv4_hdr *)(pktbuf_data(pkt) + pkt->l2_len);
+    uint16_t l4_len = pkt->data_len - pkt->l2_len - pkt->l3_len;
+    char *l4 = (char *)ip + pkt->l3_len;
+    size_t off = ip->proto == IP_PROTO_TCP ? offsetof(struct tcp_hdr, cksum)
+                                           : offsetof(struct udp_hdr, cksum);
+    uint16_t cksum = 0;
+    ip->cksum = 0;
+    ip->cksum = ip_cksum(ip, pkt->l3_len);
+    memcpy(l4 + off, &cksum, 2);
+    cksum = ipv4_udptcp_cksum(ip, l4, l4_len);
+    memcpy(l4 + off, &cksum, 2);
+}
+
+/**
+ * @brief 检查"线上"报文的校验和，正确时IP首部和伪首部+L4的累加和都是0xffff
+ */
+static int bench_cksum_check(const uint8_t *frame, uint32_t len)
+{
+    const struct ipv4_hdr *ip = (const struct ipv4_hdr *)(frame + sizeof(struct eth_hdr));
+    uint16_t l4_len = len - sizeof(struct eth_hdr) - IPV4_HDR_LEN(ip);
+    if (ip_cksum(ip, IPV4_HDR_LEN(ip)) != 0)
+        return -1;
+    uint32_t sum = ipv4_phdr_cksum(ip, l4_len);
+    if ((uint16_t)~ip_cksum_fold(ip_cksum_add(sum, (const uint8_t *)ip + IPV4_HDR_LEN(ip), l4_len)) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief 检查接收元数据：校验和结果、VLAN标签，以及坏帧被丢弃而不是交给上层
+ */
+static int bench_rx_meta_check(struct e1000_device *dev)
+{
+    static const struct {
+        uint8_t status;
+        uint8_t error;
+        uint16_t special;
+        uint64_t flags; // 期望的ol_flags，坏帧不检查
+    } descs[] = {
+        {RS_IPCS | RS_L4CS, 0, 0, PKTBUF_RX_IP_CKSUM_GOOD | PKTBUF_RX_L4_CKSUM_GOOD},
+        {RS_IPCS | RS_L4CS | RS_UDPCS, RE_TCPE, 0,
+         PKTBUF_RX_IP_CKSUM_GOOD | PKTBUF_RX_L4_CKSUM_BAD | PKTBUF_RX_UDP},
+        {RS_IPCS, RE_CE, 0, 0},
+        {RS_VP | RS_IXSM | RS_IPCS, RE_IPE, 100, PKTBUF_RX_VLAN},
+        {RS_IPCS, RE_IPE, 0, PKTBUF_RX_IP_CKSUM_BAD},
+    };
+    const int nr = sizeof(descs) / sizeof(descs[0]);
+    struct pktbuf *pkts[BENCH_BURST];
+    struct e1000_stats before, after;
+
+    e1000_stats_get(dev, &before);
+    for (int i = 0; i < nr; i++) {
+        struct rx_desc_t *desc = &dev->rx_desc[(dev->rx_cur + i) & dev->rx_mask];
+        desc->length = BENCH_PKT_LEN;
+        desc->error = descs[i].error;
+        desc->special = descs[i].special;
+        desc->status = RS_DD | RS_EOP | descs[i].status;
+    }
+    int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+    e1000_stats_get(dev, &after);
+
+    int bad = n != nr - 1 || after.rx.drops - before.rx.drops != 1
+           || after.rx.cksum_errors - before.rx.cksum_errors != 2;
+    for (int i = 0, k = 0; i < nr && k < n; i++) {
+        if (descs[i].error & RE_FRAME_MASK)
+            continue;
+        if (pkts[k]->ol_flags != descs[i].flags
+            || ((descs[i].flags & PKTBUF_RX_VLAN) && pkts[k]->vlan_tci != descs[i].special))
+            bad = 1;
+        k++;
+    }
+    bench_pkts_free(pkts, n);
+    // 把用过的描述符交还给模拟的网卡
+    E1000_WRITE_REG(dev->hw_addr, E1000_RDH, dev->rx_cur);
+    printf("rx metadata: %s\n", bad ? "BAD" : "ok");
+    return bad ? -1 : 0;
+}
+
+/**
+ * @brief 发送校验和卸载
+ * 
+ * 先在软件模拟网卡上确认插入的校验和正确，
+ * 再比较软件计算校验和与卸载给网卡时，驱动每个报文的开销。
+ */
+static int bench_cksum(void)
+{
+    static const uint16_t lens[] = {64, 512, 1514};
+    static const uint8_t protos[] = {IP_PROTO_UDP, IP_PROTO_TCP};
+    struct pktbuf *pkts[BENCH_BURST];
+
+    struct e1000_device *emu = e1000_device_get(E1000_EMU_PREFIX);
+    if (!emu || e1000_init(emu, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    E1000_WRITE_REG(emu->hw_addr, E1000_RCTL, 0); // 只测发送
+    for (size_t p = 0; p < sizeof(protos) / sizeof(protos[0]); p++) {
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            struct pktbuf *pkt = pktbuf_alloc(emu->pool);
+            bench_build_l4(pkt, protos[p], lens[l]);
+            pkt->ol_flags = PKTBUF_TX_IP_CKSUM
+                          | (protos[p] == IP_PROTO_TCP ? PKTBUF_TX_TCP_CKSUM : PKTBUF_TX_UDP_CKSUM);
+            pktbuf_tx_cksum_prepare(pkt);
+            if (e1000_tx_burst(emu, &pkt, 1) != 1) {
+                pktbuf_free(pkt);
+                return -1;
+            }
+            while (E1000_READ_REG(emu->hw_addr, E1000_TDH) != emu->tx_cur)
+                sched_yield();
+            int ok = bench_cksum_check(emu->emu->tx_last, emu->emu->tx_last_len) == 0;
+            printf("offload %s %4u bytes: %s\n", protos[p] == IP_PROTO_TCP ? "tcp" : "udp",
+                   lens[l], ok ? "ok" : "BAD CHECKSUM");
+            if (!ok)
+                return -1;
+        }
+    }
+    e1000_emu_stop(emu);
+
+    struct e1000_device *dev = bench_dev_create();
+    if (!dev) {
+        printf("bench_dev_create failed\n");
+        return -1;
+    }
+    if (bench_rx_meta_check(dev) < 0)
+        return -1;
+    uint16_t head = 0;
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        for (int offload = 0; offload <= 1; offload++) {
+            uint64_t total = 0, start = now_ns();
+            int n = 0;
+            while (total < BENCH_CKSUM_PKTS) {
+                for (int i = n; i < BENCH_BURST; i++) {
+                    if (bench_pkts_alloc(dev, &pkts[i], 1) != 1)
+                        break;
+                    bench_build_l4(pkts[i], IP_PROTO_UDP, lens[l]);
+                    if (offload) {
+                        pkts[i]->ol_flags = PKTBUF_TX_IP_CKSUM | PKTBUF_TX_UDP_CKSUM;
+                        pktbuf_tx_cksum_prepare(pkts[i]);
+                    } else {
+                        bench_sw_cksum(pkts[i]);
+                    }
+                    n++;
+                }
+                int sent = e1000_tx_burst(dev, pkts, n);
+                memmove(pkts, pkts + sent, (n - sent) * sizeof(pkts[0]));
+                n -= sent;
+                total += sent;
+                if (n > 0)
+                    head = bench_nic_tx(dev, head);
+            }
+            bench_pkts_free(pkts, n);
+            uint64_t ns = now_ns() - start;
+            printf("udp %4u bytes %-8s %7.2f ns/pkt  %7.2f Mpps\n", lens[l],
+                   offload ? "offload" : "software", (double)ns / total, total * 1000.0 / ns);
+        }
+    }
+    return 0;
+}
+
+struct bench_tso_check {
+    uint32_t hdr_len;
+    uint32_t next_seq; // 下一个分段应有的序号
+    uint16_t next_id;
+    uint64_t segs;
+    uint64_t bytes;
+    uint64_t errors;
+};
+
+/**
+ * @brief 检查模拟网卡切出来的每个分段：长度、序号、IP ID、负载内容和校验和
+ */
+static void bench_tso_hook(void *arg, const uint8_t *frame, uint32_t len)
+{
+    struct bench_tso_check *c = arg;
+    const struct ipv4_hdr *ip = (const struct ipv4_hdr *)(frame + sizeof(struct eth_hdr));
+    const struct tcp_hdr *tcp = (const struct tcp_hdr *)(ip + 1);
+    uint32_t chunk = len - c->hdr_len;
+    uint32_t seq = ntohl(tcp->seq);
+
+    if (len <= c->hdr_len || chunk > BENCH_TSO_MSS || seq != c->next_seq
+        || ntohs(ip->id) != c->next_id || ntohs(ip->total_len) != len - sizeof(struct eth_hdr)
+        || bench_cksum_check(frame, len) < 0)
+        c->errors++;
+    // 负载是按序号填的字节
+    for (uint32_t i = 0; i < chunk; i++) {
+        if (frame[c->hdr_len + i] != (uint8_t)(seq + i)) {
+            c->errors++;
+            break;
+        }
+    }
+    c->next_seq = seq + chunk;
+    c->next_id = ntohs(ip->id) + 1;
+    c->segs++;
+    c->bytes += chunk;
+}
+
+static int bench_tso_send(struct e1000_device *dev, struct mempool *big, uint32_t seq)
+{
+    struct pktbuf *hdr = pktbuf_alloc(dev->pool);
+    struct pktbuf *payload = pktbuf_alloc(big);
+    if (!hdr || !payload)
+        goto error;
+    uint16_t hdr_len = sizeof(struct eth_hdr) + sizeof(struct ipv4_hdr) + sizeof(struct tcp_hdr);
+    bench_build_l4(hdr, IP_PROTO_TCP, hdr_len);
+    ((struct tcp_hdr *)(pktbuf_data(hdr) + hdr_len - sizeof(struct tcp_hdr)))->seq = htonl(seq);
+    payload->data_len = BENCH_TSO_PAYLOAD;
+    if (e1000_send_tso(dev, hdr, payload, BENCH_TSO_MSS) < 0)
+        goto error;
+    return 0;
+
+error:
+    if (hdr)
+        pktbuf_free(hdr);
+    if (payload)
+        pktbuf_free(payload);
+    return -1;
+}
+
+/**
+ * @brief 负载是BENCH_TSO_CHAIN段的链，每段的内容接着上一段的序号填
+ */
+static int bench_tso_send_chain(struct e1000_device *dev)
+{
+    struct pktbuf *hdr = pktbuf_alloc(dev->pool);
+    struct pktbuf *payload = NULL;
+    if (!hdr)
+        return -1;
+    uint16_t hdr_len = sizeof(struct eth_hdr) + sizeof(struct ipv4_hdr) + sizeof(struct tcp_hdr);
+    bench_build_l4(hdr, IP_PROTO_TCP, hdr_len);
+    ((struct tcp_hdr *)(pktbuf_data(hdr) + hdr_len - sizeof(struct tcp_hdr)))->seq = 0;
+    for (uint32_t i = 0, off = 0; i < BENCH_TSO_CHAIN; i++) {
+        struct pktbuf *seg = pktbuf_alloc(dev->pool);
+        if (!seg)
+            goto error;
+        // 段长不是mss的整数倍，分段会跨越缓冲区
+        seg->data_len = BENCH_TSO_CHAIN_SEG - i * 100;
+        for (uint32_t j = 0; j < seg->data_len; j++)
+            pktbuf_data(seg)[j] = (uint8_t)(off + j);
+        off += seg->data_len;
+        if (!payload)
+            payload = seg;
+        else
+            pktbuf_chain(payload, seg);
+    }
+    if (e1000_send_tso(dev, hdr, payload, BENCH_TSO_MSS) < 0)
+        goto error;
+    return 0;
+
+error:
+    pktbuf_free(hdr);
+    if (payload)
+        pktbuf_free(payload);
+    return -1;
+}
+
+/**
+ * @brief TCP分段卸载
+ * 
+ * 先在软件模拟网卡上检查切出来的分段，再比较驱动做一次64K发送的开销：
+ * TSO只需要挂几个描述符，软件分段要逐段分配缓冲区、拷贝负载、改写首部。
+ * 两种方式都用发送校验和卸载，负载都来自应用已经写好的内存。
+ */
+static int bench_tso(void)
+{
+    const uint16_t hdr_len = sizeof(struct eth_hdr) + sizeof(struct ipv4_hdr) + sizeof(struct tcp_hdr);
+    const uint32_t nr_segs = (BENCH_TSO_PAYLOAD + BENCH_TSO_MSS - 1) / BENCH_TSO_MSS;
+
+    struct e1000_device *emu = e1000_device_get(E1000_EMU_PREFIX);
+    if (!emu || e1000_init(emu, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    E1000_WRITE_REG(emu->hw_addr, E1000_RCTL, 0);
+    struct mempool *big = pktbuf_pool_create_size(128, BENCH_TSO_PAYLOAD);
+    if (!big) {
+        printf("pktbuf_pool_create_size failed\n");
+        return -1;
+    }
+    // 负载缓冲区按序号填充，方便检查分段内容
+    struct pktbuf *bufs[128];
+    for (int i = 0; i < 128; i++) {
+        bufs[i] = pktbuf_alloc(big);
+        for (uint32_t j = 0; j < BENCH_TSO_PAYLOAD; j++)
+            pktbuf_data(bufs[i])[j] = (uint8_t)j;
+    }
+    for (int i = 0; i < 128; i++)
+        pktbuf_free(bufs[i]);
+
+    struct bench_tso_check check = {.hdr_len = hdr_len};
+    e1000_emu_set_tx_hook(emu, bench_tso_hook, &check);
+    for (int i = 0; i < 8; i++) {
+        // 每次从0开始，负载内容才和序号对得上
+        check.next_seq = 0;
+        check.next_id = 0;
+        if (bench_tso_send(emu, big, 0) < 0)
+            return -1;
+        while (E1000_READ_REG(emu->hw_addr, E1000_TDH) != emu->tx_cur)
+            sched_yield();
+    }
+    int ok = check.errors == 0 && check.segs == 8 * nr_segs && check.bytes == 8ULL * BENCH_TSO_PAYLOAD;
+    printf("tso %u bytes mss %u: %lu segments, %lu errors: %s\n", BENCH_TSO_PAYLOAD, BENCH_TSO_MSS,
+           check.segs, check.errors, ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 负载是多段的链，每一段都要发出去
+    uint32_t chain_len = 0;
+    for (uint32_t i = 0; i < BENCH_TSO_CHAIN; i++)
+        chain_len += BENCH_TSO_CHAIN_SEG - i * 100;
+    memset(&check, 0, sizeof(check));
+    check.hdr_len = hdr_len;
+    if (bench_tso_send_chain(emu) < 0)
+        return -1;
+    while (E1000_READ_REG(emu->hw_addr, E1000_TDH) != emu->tx_cur)
+        sched_yield();
+    // 首部是链的时候拒绝发送
+    struct pktbuf *hdr = pktbuf_alloc(emu->pool), *extra = pktbuf_alloc(emu->pool);
+    struct pktbuf *payload = pktbuf_alloc(big);
+    bench_build_l4(hdr, IP_PROTO_TCP, hdr_len);
+    extra->data_len = 0;
+    pktbuf_chain(hdr, extra);
+    payload->data_len = BENCH_TSO_PAYLOAD;
+    int rejected = e1000_send_tso(emu, hdr, payload, BENCH_TSO_MSS) < 0;
+    pktbuf_free(hdr);
+    pktbuf_free(payload);
+    e1000_tx_reclaim(emu);
+    e1000_emu_stop(emu);
+    ok = check.errors == 0 && check.segs == (chain_len + BENCH_TSO_MSS - 1) / BENCH_TSO_MSS
+         && check.bytes == chain_len && rejected && emu->tx_free == emu->tx_nr - 1;
+    printf("tso %u bytes in %d buffers: %lu segments, %lu errors, chained header %s: %s\n",
+           chain_len, BENCH_TSO_CHAIN, check.segs, check.errors,
+           rejected ? "rejected" : "sent", ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    struct e1000_device *dev = bench_dev_create();
+    if (!dev) {
+        printf("bench_dev_create failed\n");
+        return -1;
+    }
+    char *app = malloc(BENCH_TSO_PAYLOAD);
+    memset(app, 0x5a, BENCH_TSO_PAYLOAD);
+    uint16_t head = 0;
+
+    // 软件分段：每段一个缓冲区，拷贝首部和负载
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t start = now_ns();
+    for (int i = 0; i < BENCH_TSO_SENDS; i++) {
+        uint32_t off = 0;
+        int n = 0;
+        while (off < BENCH_TSO_PAYLOAD || n > 0) {
+            while (off < BENCH_TSO_PAYLOAD && n < BENCH_BURST) {
+                uint32_t chunk = BENCH_TSO_PAYLOAD - off < BENCH_TSO_MSS ? BENCH_TSO_PAYLOAD - off : BENCH_TSO_MSS;
+                struct pktbuf *p = pktbuf_alloc(dev->pool);
+                if (!p)
+                    break;
+                bench_build_l4(p, IP_PROTO_TCP, hdr_len + chunk);
+                struct tcp_hdr *tcp = (struct tcp_hdr *)(pktbuf_data(p) + hdr_len - sizeof(struct tcp_hdr));
+                tcp->seq = htonl(off);
+                memcpy(pktbuf_data(p) + hdr_len, app + off, chunk);
+                p->ol_flags = PKTBUF_TX_IP_CKSUM | PKTBUF_TX_TCP_CKSUM;
+                pktbuf_tx_cksum_prepare(p);
+                pkts[n++] = p;
+                off += chunk;
+            }
+            int sent = e1000_tx_burst(dev, pkts, n);
+            memmove(pkts, pkts + sent, (n - sent) * sizeof(pkts[0]));
+            n -= sent;
+            if (n > 0 || off < BENCH_TSO_PAYLOAD)
+                head = bench_nic_tx(dev, head);
+        }
+    }
+    uint64_t ns = now_ns() - start;
+    printf("software segmentation  %8.1f ns/64K  %6.2f Gbit/s payload\n",
+           (double)ns / BENCH_TSO_SENDS, BENCH_TSO_SENDS * (double)BENCH_TSO_PAYLOAD * 8 / ns);
+
+    // TSO：一个首部缓冲区加一个负载缓冲区
+    start = now_ns();
+    for (int i = 0; i < BENCH_TSO_SENDS; i++) {
+        while (bench_tso_send(dev, big, 0) < 0)
+            head = bench_nic_tx(dev, head);
+    }
+    ns = now_ns() - start;
+    printf("tso                    %8.1f ns/64K  %6.2f Gbit/s payload\n",
+           (double)ns / BENCH_TSO_SENDS, BENCH_TSO_SENDS * (double)BENCH_TSO_PAYLOAD * 8 / ns);
+    free(app);
+    return 0;
+}
+
+/**
+ * @brief 检查收到的合成帧：总长度、段数，以及负载是否是递增的字节
+ */
+static int bench_jumbo_rx_check(const struct pktbuf *pkt, uint32_t len)
+{
+    uint32_t off = 0;
+    int nb_segs = 0;
+    if (pkt->pkt_len != len || pkt->nb_segs != (len + PKTBUF_DATA_SIZE - 1) / PKTBUF_DATA_SIZE)
+        return -1;
+    for (const struct pktbuf *seg = pkt; seg; seg = seg->next, nb_segs++) {
+        const uint8_t *data = (const uint8_t *)pktbuf_data(seg);
+        for (uint32_t i = 0; i < seg->data_len; i++, off++) {
+            if (off >= sizeof(struct eth_hdr) && data[i] != (uint8_t)off)
+                return -1;
+        }
+    }
+    return off == len && nb_segs == pkt->nb_segs ? 0 : -1;
+}
+
+/**
+ * @brief 接收len字节的合成帧，先逐字节检查一批，再测吞吐
+ */
+static int bench_jumbo_rx(struct e1000_device *dev, uint16_t len)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t checked = 0, errors = 0;
+
+    e1000_emu_set_frame_len(dev, len);
+    // 跳过改长度之前已经放进接收环的帧
+    while (checked < BENCH_JUMBO_CHECKS) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        for (int i = 0; i < n; i++) {
+            if (checked > 0 || pkts[i]->pkt_len == len) {
+                errors += bench_jumbo_rx_check(pkts[i], len) < 0;
+                checked++;
+            }
+        }
+        bench_pkts_free(pkts, n);
+        if (n == 0)
+            sched_yield();
+    }
+
+    uint64_t total = 0, bytes = 0, start = now_ns();
+    while (now_ns() - start < BENCH_JUMBO_NS) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        for (int i = 0; i < n; i++)
+            bytes += pkts[i]->pkt_len;
+        bench_pkts_free(pkts, n);
+        total += n;
+        if (n == 0)
+            sched_yield();
+    }
+    uint64_t ns = now_ns() - start;
+    printf("rx %5u bytes  %2u segs/pkt  %8lu pkts  %6.3f Mpps  %6.2f Gbit/s  %lu/%lu errors\n",
+           len, (len + PKTBUF_DATA_SIZE - 1) / PKTBUF_DATA_SIZE, total, total * 1000.0 / ns,
+           bytes * 8.0 / ns, errors, checked);
+    return errors == 0 ? 0 : -1;
+}
+
+/**
+ * @brief 接收len字节的合成帧一段时间，返回交给上层的报文个数
+ */
+static uint64_t bench_jumbo_rx_count(struct e1000_device *dev, uint16_t len, uint64_t ns)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t total = 0, start = now_ns();
+    while (now_ns() - start < ns) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        for (int i = 0; i < n; i++)
+            total += pkts[i]->pkt_len == len;
+        bench_pkts_free(pkts, n);
+        if (n == 0)
+            sched_yield();
+    }
+    return total;
+}
+
+struct bench_jumbo_check {
+    uint64_t frames;
+    uint64_t errors;
+};
+
+/**
+ * @brief 检查"发出"的巨帧：长度、校验和，以及首部之后递增的负载
+ */
+static void bench_jumbo_hook(void *arg, const uint8_t *frame, uint32_t len)
+{
+    struct bench_jumbo_check *c = arg;
+    uint32_t hdr_len = sizeof(struct eth_hdr) + sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr);
+    if (len != BENCH_JUMBO_LEN || bench_cksum_check(frame, len) < 0)
+        c->errors++;
+    for (uint32_t i = hdr_len; i < len; i++) {
+        if (frame[i] != (uint8_t)i) {
+            c->errors++;
+            break;
+        }
+    }
+    c->frames++;
+}
+
+/**
+ * @brief 首部单独一个缓冲区，负载按2K切成几段串在后面，由网卡插入校验和
+ */
+static struct pktbuf *bench_jumbo_tx_pkt(struct e1000_device *dev)
+{
+    uint16_t hdr_len = sizeof(struct eth_hdr) + sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr);
+    struct pktbuf *hdr = pktbuf_alloc(dev->pool);
+    if (!hdr)
+        return NULL;
+    bench_build_l4(hdr, IP_PROTO_UDP, BENCH_JUMBO_LEN);
+    hdr->data_len = hdr_len;
+
+    for (uint32_t off = hdr_len; off < BENCH_JUMBO_LEN; ) {
+        struct pktbuf *seg = pktbuf_alloc(dev->pool);
+        if (!seg) {
+            pktbuf_free(hdr);
+            return NULL;
+        }
+        seg->data_len = BENCH_JUMBO_LEN - off < PKTBUF_DATA_SIZE ? BENCH_JUMBO_LEN - off : PKTBUF_DATA_SIZE;
+        for (uint32_t i = 0; i < seg->data_len; i++)
+            pktbuf_data(seg)[i] = (uint8_t)(off + i);
+        off += seg->data_len;
+        pktbuf_chain(hdr, seg);
+    }
+    hdr->ol_flags = PKTBUF_TX_IP_CKSUM | PKTBUF_TX_UDP_CKSUM;
+    pktbuf_tx_cksum_prepare(hdr);
+    return hdr;
+}
+
+/**
+ * @brief 巨帧和多段报文
+ * 
+ * 接收：模拟网卡把9K的帧拆到多个2K的描述符里，检查驱动组装出来的报文，
+ * 和1514字节的帧比较吞吐；再检查没有打开长帧接收或者超过MTU时帧被丢弃。
+ * 发送：首部和负载放在不同的缓冲区里串起来发送，加上e1000_send()拷贝发送，
+ * 在模拟网卡上检查组装出来的帧。
+ */
+static int bench_jumbo(void)
+{
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_set_mtu(dev, E1000_MTU_MAX) < 0 || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    if (bench_jumbo_rx(dev, 1514) < 0 || bench_jumbo_rx(dev, BENCH_JUMBO_LEN) < 0)
+        return -1;
+
+    // 关掉长帧接收，网卡丢弃超过1518字节的帧
+    uint64_t oversize = dev->emu->rx_oversize;
+    e1000_set_mtu(dev, E1000_MTU_DEFAULT);
+    bench_jumbo_rx_count(dev, BENCH_JUMBO_LEN, BENCH_JUMBO_NS / 10);
+    uint64_t n = bench_jumbo_rx_count(dev, BENCH_JUMBO_LEN, BENCH_JUMBO_NS / 10);
+    int ok = n == 0 && dev->emu->rx_oversize > oversize;
+    printf("mtu %d: %lu jumbo frames received, %lu dropped by nic: %s\n", E1000_MTU_DEFAULT,
+           n, dev->emu->rx_oversize - oversize, ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 网卡接收长帧，超过MTU的由驱动丢弃
+    struct e1000_stats before, after;
+    e1000_set_mtu(dev, 4000);
+    bench_jumbo_rx_count(dev, BENCH_JUMBO_LEN, BENCH_JUMBO_NS / 10);
+    e1000_stats_get(dev, &before);
+    n = bench_jumbo_rx_count(dev, BENCH_JUMBO_LEN, BENCH_JUMBO_NS / 10);
+    e1000_stats_get(dev, &after);
+    ok = n == 0 && after.rx.drops > before.rx.drops;
+    printf("mtu 4000: %lu jumbo frames received, %lu dropped by driver: %s\n",
+           n, after.rx.drops - before.rx.drops, ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+    E1000_WRITE_REG(dev->hw_addr, E1000_RCTL, 0);
+
+    struct bench_jumbo_check check = {0};
+    e1000_emu_set_tx_hook(dev, bench_jumbo_hook, &check);
+    int sent = 0;
+    while (sent < BENCH_JUMBO_CHECKS) {
+        struct pktbuf *pkt = bench_jumbo_tx_pkt(dev);
+        if (pkt && e1000_tx_burst(dev, &pkt, 1) == 1) {
+            sent++;
+            continue;
+        }
+        if (pkt)
+            pktbuf_free(pkt);
+        sched_yield();
+    }
+    // e1000_send()拷贝到多个缓冲区，校验和由软件计算
+    struct pktbuf *pkt = bench_jumbo_tx_pkt(dev);
+    char *frame = malloc(BENCH_JUMBO_LEN);
+    uint32_t off = 0;
+    for (struct pktbuf *seg = pkt; seg; seg = seg->next) {
+        memcpy(frame + off, pktbuf_data(seg), seg->data_len);
+        off += seg->data_len;
+    }
+    pktbuf_free(pkt);
+    struct ipv4_hdr *ip = (struct ipv4_hdr *)(frame + sizeof(struct eth_hdr));
+    struct udp_hdr *udp = (struct udp_hdr *)(ip + 1);
+    uint16_t cksum = 0;
+    memcpy(&udp->cksum, &cksum, 2);
+    ip->cksum = ip_cksum(ip, sizeof(*ip));
+    cksum = ipv4_udptcp_cksum(ip, udp, BENCH_JUMBO_LEN - sizeof(struct eth_hdr) - sizeof(*ip));
+    memcpy(&udp->cksum, &cksum, 2);
+    while (e1000_send(dev, frame, BENCH_JUMBO_LEN) == E1000_TX_RING_FULL)
+        sched_yield();
+    sent++;
+    free(frame);
+
+    while (E1000_READ_REG(dev->hw_addr, E1000_TDH) != dev->tx_cur)
+        sched_yield();
+    e1000_emu_stop(dev);
+    ok = check.errors == 0 && check.frames == (uint64_t)sent;
+    printf("tx %d bytes chained: %lu frames, %lu errors: %s\n", BENCH_JUMBO_LEN,
+           check.frames, check.errors, ok ? "ok" : "BAD");
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief 在模拟网卡上接收带标签的合成帧，检查标签和报文内容
+ * 
+ * 改配置之前已经放进接收环的帧不检查，从第一个符合新配置的帧开始。
+ * 
+ * @param strip: 期望标签已经剥离
+ * @param vids: 每个VLAN ID收到的报文个数
+ * @return 检查失败的报文个数
+ */
+static uint64_t bench_vlan_rx(struct e1000_device *dev, int strip, uint64_t *vids)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t checked = 0, errors = 0;
+    uint32_t len = E1000_EMU_FRAME_LEN + (strip ? 0 : 4);
+
+    while (checked < BENCH_VLAN_CHECKS) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        for (int i = 0; i < n; i++) {
+            struct pktbuf *p = pkts[i];
+            const uint8_t *data = (const uint8_t *)pktbuf_data(p);
+            int stripped = (p->ol_flags & PKTBUF_RX_VLAN_STRIPPED) != 0;
+            if (checked == 0 && ((p->ol_flags & PKTBUF_RX_VLAN) == 0 || stripped != strip))
+                continue;
+            uint16_t type = data[strip ? 12 : 16] << 8 | data[strip ? 13 : 17];
+            uint16_t vid = p->vlan_tci & 0xfff;
+            if ((p->ol_flags & PKTBUF_RX_VLAN) == 0 || stripped != strip || p->pkt_len != len
+                || type != 0x88b5 || (p->vlan_tci >> 13) != (BENCH_VLAN_TCI >> 13)
+                || vid < (BENCH_VLAN_TCI & 0xfff) || vid >= (BENCH_VLAN_TCI & 0xfff) + BENCH_VLAN_NR
+                || (!strip && (data[12] != 0x81 || data[13] != 0x00 || (data[14] << 8 | data[15]) != p->vlan_tci)))
+                errors++;
+            else
+                vids[vid - (BENCH_VLAN_TCI & 0xfff)]++;
+            checked++;
+        }
+        bench_pkts_free(pkts, n);
+        if (n == 0)
+            sched_yield();
+    }
+    return errors;
+}
+
+struct bench_vlan_check {
+    uint64_t frames;
+    uint64_t errors;
+};
+
+/**
+ * @brief 检查"发出"的帧：源MAC后面是插入的标签，去掉标签后校验和正确
+ */
+static void bench_vlan_hook(void *arg, const uint8_t *frame, uint32_t len)
+{
+    struct bench_vlan_check *c = arg;
+    uint8_t buf[2048];
+    if (len < 18 || len - 4 > sizeof(buf) || frame[12] != 0x81 || frame[13] != 0x00
+        || (frame[14] << 8 | frame[15]) != BENCH_VLAN_TCI) {
+        c->errors++;
+        c->frames++;
+        return;
+    }
+    memcpy(buf, frame, 12);
+    memcpy(buf + 12, frame + 16, len - 16);
+    if (bench_cksum_check(buf, len - 4) < 0)
+        c->errors++;
+    c->frames++;
+}
+
+/**
+ * @brief 模拟网卡接收带标签的帧，标签放在special里，报文里仍然保留标签
+ * 
+ * @return 新的RDH
+ */
+static uint16_t bench_nic_rx_vlan(struct e1000_device *dev, uint16_t head, int *filled)
+{
+    uint16_t tail = E1000_READ_REG(dev->hw_addr, E1000_RDT);
+    *filled = 0;
+    while (head != tail) {
+        struct rx_desc_t *desc = &dev->rx_desc[head];
+        desc->length = BENCH_PKT_LEN;
+        desc->error = 0;
+        desc->special = BENCH_VLAN_TCI;
+        desc->status = RS_DD | RS_EOP | RS_VP;
+        head = (head + 1) & dev->rx_mask;
+        (*filled)++;
+    }
+    E1000_WRITE_REG(dev->hw_addr, E1000_RDH, head);
+    return head;
+}
+
+/**
+ * @brief 软件在以太网首部后插入VLAN标签：首部前移4个字节
+ */
+static void bench_sw_vlan_insert(struct pktbuf *p, uint16_t tci)
+{
+    p->data_off -= 4;
+    char *data = pktbuf_data(p);
+    memmove(data, data + 4, 12);
+    data[12] = 0x81;
+    data[13] = 0x00;
+    data[14] = tci >> 8;
+    data[15] = tci & 0xff;
+    p->data_len += 4;
+}
+
+/**
+ * @brief 软件剥离VLAN标签：取出标签，首部后移4个字节
+ */
+static uint16_t bench_sw_vlan_strip(struct pktbuf *p)
+{
+    char *data = pktbuf_data(p);
+    uint16_t tci = (uint8_t)data[14] << 8 | (uint8_t)data[15];
+    memmove(data + 4, data, 12);
+    p->data_off += 4;
+    p->data_len -= 4;
+    return tci;
+}
+
+/**
+ * @brief VLAN标签剥离、插入和过滤
+ * 
+ * 先在软件模拟网卡上检查：过滤表之外的VLAN被丢弃，剥离的标签在vlan_tci里，
+ * 关闭剥离时标签留在报文里，发送时网卡按vlan_tci插入标签。
+ * 再比较软件插入/剥离标签与卸载给网卡时，驱动每个报文的开销。
+ */
+static int bench_vlan(void)
+{
+    const uint16_t base = BENCH_VLAN_TCI & 0xfff;
+    struct e1000_device *emu = e1000_device_get(E1000_EMU_PREFIX);
+    if (!emu || e1000_init(emu, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+
+    // 只接收偶数的VLAN，标签剥离到vlan_tci
+    uint64_t vids[BENCH_VLAN_NR] = {0};
+    for (int i = 0; i < BENCH_VLAN_NR; i += 2)
+        e1000_vlan_filter_set(emu, base + i, 1);
+    e1000_vlan_strip(emu, 1);
+    e1000_vlan_filter(emu, 1);
+    e1000_emu_set_frame_vlan(emu, BENCH_VLAN_TCI, BENCH_VLAN_NR);
+    uint64_t errors = bench_vlan_rx(emu, 1, vids);
+    int ok = errors == 0 && emu->emu->rx_vlan_filtered > 0;
+    for (int i = 0; i < BENCH_VLAN_NR; i++)
+        ok = ok && (i % 2 == 0 ? vids[i] > 0 : vids[i] == 0);
+    printf("rx strip + filter: %d errors, %lu filtered by nic, vlan %u-%u: %lu %lu %lu %lu %lu %lu %lu %lu: %s\n",
+           (int)errors, emu->emu->rx_vlan_filtered, base, base + BENCH_VLAN_NR - 1,
+           vids[0], vids[1], vids[2], vids[3], vids[4], vids[5], vids[6], vids[7], ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 关闭剥离和过滤，所有VLAN都收到，标签留在报文里
+    memset(vids, 0, sizeof(vids));
+    e1000_vlan_filter(emu, 0);
+    e1000_vlan_strip(emu, 0);
+    errors = bench_vlan_rx(emu, 0, vids);
+    ok = errors == 0;
+    for (int i = 0; i < BENCH_VLAN_NR; i++)
+        ok = ok && vids[i] > 0;
+    printf("rx no strip:       %d errors, vlan %u-%u: %lu %lu %lu %lu %lu %lu %lu %lu: %s\n",
+           (int)errors, base, base + BENCH_VLAN_NR - 1,
+           vids[0], vids[1], vids[2], vids[3], vids[4], vids[5], vids[6], vids[7], ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 发送时由网卡插入标签，校验和按不带标签的首部计算
+    E1000_WRITE_REG(emu->hw_addr, E1000_RCTL, 0);
+    e1000_vlan_strip(emu, 1);
+    struct bench_vlan_check check = {0};
+    e1000_emu_set_tx_hook(emu, bench_vlan_hook, &check);
+    int sent = 0;
+    while (sent < BENCH_VLAN_CHECKS) {
+        struct pktbuf *p = pktbuf_alloc(emu->pool);
+        if (!p) {
+            sched_yield();
+            continue;
+        }
+        bench_build_l4(p, IP_PROTO_UDP, 128);
+        p->ol_flags = PKTBUF_TX_IP_CKSUM | PKTBUF_TX_UDP_CKSUM | PKTBUF_TX_VLAN;
+        p->vlan_tci = BENCH_VLAN_TCI;
+        pktbuf_tx_cksum_prepare(p);
+        if (e1000_tx_burst(emu, &p, 1) == 1) {
+            sent++;
+        } else {
+            pktbuf_free(p);
+            sched_yield();
+        }
+    }
+    while (E1000_READ_REG(emu->hw_addr, E1000_TDH) != emu->tx_cur)
+        sched_yield();
+    e1000_emu_stop(emu);
+    ok = check.errors == 0 && check.frames == (uint64_t)sent;
+    printf("tx insert: %lu frames, %lu errors: %s\n", check.frames, check.errors, ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    struct e1000_device *dev = bench_dev_create();
+    if (!dev) {
+        printf("bench_dev_create failed\n");
+        return -1;
+    }
+    struct pktbuf *pkts[BENCH_BURST];
+    uint16_t head = 0;
+    for (int offload = 0; offload <= 1; offload++) {
+        uint64_t total = 0, start = now_ns();
+        int n = 0;
+        while (total < BENCH_VLAN_PKTS) {
+            for (int i = n; i < BENCH_BURST; i++) {
+                if (bench_pkts_alloc(dev, &pkts[i], 1) != 1)
+                    break;
+                if (offload) {
+                    pkts[i]->ol_flags = PKTBUF_TX_VLAN;
+                    pkts[i]->vlan_tci = BENCH_VLAN_TCI;
+                } else {
+                    bench_sw_vlan_insert(pkts[i], BENCH_VLAN_TCI);
+                }
+                n++;
+            }
+            int nb_tx = e1000_tx_burst(dev, pkts, n);
+            memmove(pkts, pkts + nb_tx, (n - nb_tx) * sizeof(pkts[0]));
+            n -= nb_tx;
+            total += nb_tx;
+            if (n > 0)
+                head = bench_nic_tx(dev, head);
+        }
+        bench_pkts_free(pkts, n);
+        uint64_t ns = now_ns() - start;
+        printf("tx %-8s %7.2f ns/pkt  %7.2f Mpps\n", offload ? "offload" : "software",
+               (double)ns / total, total * 1000.0 / ns);
+    }
+
+    head = 0;
+    for (int offload = 0; offload <= 1; offload++) {
+        uint64_t total = 0, start = now_ns();
+        volatile uint16_t sink = 0; // 应用要读到标签
+        uint64_t bad = 0;
+        int filled;
+        while (total < BENCH_VLAN_PKTS) {
+            head = bench_nic_rx_vlan(dev, head, &filled);
+            int got = 0;
+            while (got < filled) {
+                int nb_rx = e1000_rx_burst(dev, pkts, BENCH_BURST);
+                for (int i = 0; i < nb_rx; i++) {
+                    uint16_t tci = offload ? pkts[i]->vlan_tci : bench_sw_vlan_strip(pkts[i]);
+                    // 软件剥离时报文内容是随意的，只检查网卡剥离的标签
+                    bad += offload && tci != BENCH_VLAN_TCI;
+                    sink += tci;
+                }
+                bench_pkts_free(pkts, nb_rx);
+                got += nb_rx;
+            }
+            total += filled;
+        }
+        uint64_t ns = now_ns() - start;
+        printf("rx %-8s %7.2f ns/pkt  %7.2f Mpps\n", offload ? "offload" : "software",
+               (double)ns / total, total * 1000.0 / ns);
+        if (bad) {
+            printf("BAD: %lu packets with wrong vlan_tci\n", bad);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 接收一段时间，按目的地址统计收到的报文个数
+ * 
+ * 先丢掉改配置之前已经放进接收环的帧，再统计ns纳秒。
+ */
+static void bench_filter_rx(struct e1000_device *dev, uint8_t (*dsts)[6], uint64_t *counts, uint64_t ns)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t start = now_ns();
+    while (now_ns() - start < ns / 4) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        bench_pkts_free(pkts, n);
+        if (n == 0)
+            sched_yield();
+    }
+
+    memset(counts, 0, BENCH_FILTER_DSTS * sizeof(counts[0]));
+    start = now_ns();
+    while (now_ns() - start < ns) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < BENCH_FILTER_DSTS; j++) {
+                if (memcmp(pktbuf_data(pkts[i]), dsts[j], 6) == 0) {
+                    counts[j]++;
+                    break;
+                }
+            }
+        }
+        bench_pkts_free(pkts, n);
+        if (n == 0)
+            sched_yield();
+    }
+}
+
+/**
+ * @brief 检查收到的目的地址是否正好是expect里的那些，expect按位对应dsts
+ */
+static int bench_filter_check(const char *name, const uint64_t *counts, unsigned expect)
+{
+    int ok = 1;
+    printf("%-22s", name);
+    for (int i = 0; i < BENCH_FILTER_DSTS; i++) {
+        printf(" %8lu", counts[i]);
+        if ((counts[i] > 0) != ((expect >> i) & 1))
+            ok = 0;
+    }
+    printf("  %s\n", ok ? "ok" : "BAD");
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief 单播和组播地址过滤
+ * 
+ * 模拟网卡的合成帧轮流发往本网卡地址、另一个添加到RAR的单播地址、未知单播地址、
+ * 加入MTA的组播地址、没有加入的组播地址和广播地址，检查各种配置下网卡收下了哪些。
+ * 再比较过滤和混杂模式下应用每秒拿到的有用报文：混杂模式下无关的报文也要占用描述符，
+ * 由软件检查后丢弃。
+ */
+static int bench_filter(void)
+{
+    uint8_t dsts[BENCH_FILTER_DSTS][6] = {
+        {0},                                  // 本网卡
+        {0x02, 0x00, 0x00, 0x00, 0x00, 0x01}, // 添加到RAR的单播地址
+        {0x02, 0x00, 0x00, 0x00, 0x00, 0x02}, // 未知单播地址
+        {0x01, 0x00, 0x5e, 0x00, 0x00, 0x01}, // 加入MTA的组播地址
+        {0x01, 0x00, 0x5e, 0x7f, 0xff, 0xfa}, // 没有加入的组播地址，哈希不同
+        {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, // 广播
+    };
+    const unsigned useful = 1 << 0 | 1 << 1 | 1 << 3 | 1 << 5;
+    uint64_t counts[BENCH_FILTER_DSTS];
+
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    memcpy(dsts[0], dev->mac_addr, 6);
+    if (e1000_mac_addr_add(dev, dsts[1]) < 0 || e1000_set_mc_addr_list(dev, &dsts[3], 1) < 0)
+        return -1;
+    e1000_emu_set_frame_dst(dev, dsts, BENCH_FILTER_DSTS);
+
+    printf("%-22s %8s %8s %8s %8s %8s %8s\n", "", "own", "added", "unknown", "mc in", "mc out", "bcast");
+    bench_filter_rx(dev, dsts, counts, BENCH_FILTER_NS);
+    if (bench_filter_check("filter", counts, useful) < 0)
+        return -1;
+    e1000_allmulti(dev, 1);
+    bench_filter_rx(dev, dsts, counts, BENCH_FILTER_NS);
+    if (bench_filter_check("allmulti", counts, useful | 1 << 4) < 0)
+        return -1;
+    e1000_allmulti(dev, 0);
+    e1000_promisc(dev, 1);
+    bench_filter_rx(dev, dsts, counts, BENCH_FILTER_NS);
+    if (bench_filter_check("promisc", counts, (1 << BENCH_FILTER_DSTS) - 1) < 0)
+        return -1;
+    e1000_promisc(dev, 0);
+    e1000_mac_addr_remove(dev, dsts[1]);
+    bench_filter_rx(dev, dsts, counts, BENCH_FILTER_NS);
+    if (bench_filter_check("filter, removed added", counts, useful & ~(1 << 1)) < 0)
+        return -1;
+    e1000_mac_addr_add(dev, dsts[1]);
+
+    for (int promisc = 0; promisc <= 1; promisc++) {
+        e1000_promisc(dev, promisc);
+        bench_filter_rx(dev, dsts, counts, BENCH_FILTER_NS * 5);
+        uint64_t total = 0, good = 0;
+        for (int i = 0; i < BENCH_FILTER_DSTS; i++) {
+            total += counts[i];
+            if ((useful >> i) & 1)
+                good += counts[i];
+        }
+        printf("%-8s delivered %6.2f Mpps, useful %6.2f Mpps, dropped in software %4.1f%%\n",
+               promisc ? "promisc" : "filter", total * 1000.0 / (BENCH_FILTER_NS * 5),
+               good * 1000.0 / (BENCH_FILTER_NS * 5), total ? (total - good) * 100.0 / total : 0.0);
+    }
+    e1000_emu_stop(dev);
+    return 0;
+}
+
+/**
+ * @brief 在合成的描述符环上随机设置DD/EOP/错误位和长度，完成的描述符都在前面
+ * 
+ * @param ready: 前ready个描述符设置DD，-1表示随机
+ */
+static void bench_scan_fill(struct rx_desc_t *ring, int nr, int ready, uint64_t *seed)
+{
+    if (ready < 0)
+        ready = xorshift64(seed) % (nr + 1);
+    for (int i = 0; i < nr; i++) {
+        uint64_t r = xorshift64(seed);
+        ring[i].addr = r;
+        ring[i].length = 60 + r % 1455;
+        ring[i].checksum = r >> 16;
+        // 随机的状态位，DD按ready设置，EOP大多数设置，少数帧错误
+        ring[i].status = (r >> 24) & ~RS_DD;
+        if (i < ready)
+            ring[i].status |= RS_DD;
+        if ((r >> 32) % 8)
+            ring[i].status |= RS_EOP;
+        ring[i].error = (r >> 40) % 16 == 0 ? (r >> 48) : (r >> 48) & ~RE_FRAME_MASK;
+        ring[i].special = r >> 56;
+    }
+}
+
+/**
+ * @brief 描述符扫描各个实现的正确性和开销
+ * 
+ * 先在随机生成的描述符上和标量实现逐项对比，再分别测量扫描一段全部完成的描述符环
+ * 每个描述符的开销，以及用各个实现时e1000_rx_burst()每个报文的开销。
+ */
+static int bench_rxscan(void)
+{
+    static const char *impls[] = {"scalar", "sse4", "avx2"};
+    struct rx_desc_t *ring = aligned_alloc(E1000_DESC_ALIGN, BENCH_SCAN_DESCS * sizeof(struct rx_desc_t));
+    struct e1000_rx_meta expect[E1000_RX_SCAN_MAX], meta[E1000_RX_SCAN_MAX];
+    uint64_t seed = 0x2545f4914f6cdd1dULL;
+    const char *def = e1000_rx_scan_name();
+    int ret = 0;
+
+    if (!ring) {
+        printf("aligned_alloc failed\n");
+        return -1;
+    }
+    printf("cpu default: %s\n", def);
+
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+        if (e1000_rx_scan_select(impls[k]) < 0)
+            continue;
+        uint64_t errors = 0;
+        for (int c = 0; c < BENCH_SCAN_CHECKS; c++) {
+            int max = 1 + xorshift64(&seed) % E1000_RX_SCAN_MAX;
+            int off = xorshift64(&seed) % (BENCH_SCAN_DESCS - E1000_RX_SCAN_MAX);
+            uint32_t eop, err, eop2, err2;
+            bench_scan_fill(ring + off, max, -1, &seed);
+            e1000_rx_scan_select("scalar");
+            int n = e1000_rx_scan(ring + off, max, expect, &eop, &err);
+            e1000_rx_scan_select(impls[k]);
+            int n2 = e1000_rx_scan(ring + off, max, meta, &eop2, &err2);
+            if (n != n2 || eop != eop2 || err != err2 || memcmp(expect, meta, n * sizeof(meta[0])) != 0)
+                errors++;
+        }
+
+        // 全部完成的描述符环，每次最多扫描E1000_RX_SCAN_MAX个
+        bench_scan_fill(ring, BENCH_SCAN_DESCS, BENCH_SCAN_DESCS, &seed);
+        uint64_t total = 0, cycles = bench_cycles();
+        for (int r = 0; r < BENCH_SCAN_ROUNDS; r++) {
+            for (int i = 0; i < BENCH_SCAN_DESCS; i += E1000_RX_SCAN_MAX) {
+                uint32_t eop, err;
+                total += e1000_rx_scan(ring + i, E1000_RX_SCAN_MAX, meta, &eop, &err);
+            }
+        }
+        cycles = bench_cycles() - cycles;
+        printf("scan %-6s  %6.2f cycles/desc  %lu errors: %s\n", impls[k],
+               (double)cycles / total, errors, errors ? "BAD" : "ok");
+        if (errors)
+            ret = -1;
+    }
+    free(ring);
+
+    // 整个接收路径
+    struct e1000_device *dev = bench_dev_create();
+    if (!dev) {
+        printf("bench_dev_create failed\n");
+        return -1;
+    }
+    struct pktbuf *pkts[BENCH_BURST];
+    uint16_t head = 0;
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+        if (e1000_rx_scan_select(impls[k]) < 0)
+            continue;
+        uint64_t total = 0, nic_cycles = 0, cycles = bench_cycles();
+        while (total < BENCH_RX_PKTS) {
+            int filled;
+            uint64_t c = bench_cycles();
+            head = bench_nic_rx(dev, head, &filled, 0);
+            nic_cycles += bench_cycles() - c;
+            for (int got = 0; got < filled;) {
+                int nb_rx = e1000_rx_burst(dev, pkts, BENCH_BURST);
+                bench_pkts_free(pkts, nb_rx);
+                got += nb_rx;
+            }
+            total += filled;
+        }
+        cycles = bench_cycles() - cycles - nic_cycles;
+        printf("rx burst %-6s  %6.2f cycles/pkt\n", impls[k], (double)cycles / total);
+    }
+    e1000_rx_scan_select(NULL);
+    return ret;
+}
+
+/**
+ * @brief 在软件模拟网卡上测量e1000_rx_burst()/e1000_tx_burst()的吞吐
+ * 
+ * 模拟网卡线程和收发线程并发运行，接收时回放合成帧，发送时只消费描述符。
+ */
+static int bench_emu(void)
+{
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t total = 0, start = now_ns();
+    while (now_ns() - start < BENCH_EMU_NS) {
+        int n = e1000_rx_poll(dev, pkts, BENCH_BURST);
+        bench_pkts_free(pkts, n);
+        total += n;
+    }
+    uint64_t ns = now_ns() - start;
+    printf("emu rx  %10lu pkts  %7.2f Mpps\n", total, total * 1000.0 / ns);
+
+    int n = 0;
+    total = 0;
+    start = now_ns();
+    while (now_ns() - start < BENCH_EMU_NS) {
+        n += bench_pkts_alloc(dev, pkts + n, BENCH_BURST - n);
+        int sent = e1000_tx_burst(dev, pkts, n);
+        memmove(pkts, pkts + sent, (n - sent) * sizeof(pkts[0]));
+        n -= sent;
+        total += sent;
+        // 单核上要让出CPU给模拟网卡线程
+        if (sent == 0)
+            sched_yield();
+    }
+    ns = now_ns() - start;
+    bench_pkts_free(pkts, n);
+    printf("emu tx  %10lu pkts  %7.2f Mpps\n", total, total * 1000.0 / ns);
+
+    e1000_emu_stop(dev);
+    return 0;
+}
+
+// 按序号生成长度和内容都可以校验的帧
+static uint32_t bench_capture_frame(uint8_t *buf, uint64_t seq)
+{
+    uint32_t len = 60 + seq * 7 % (1514 - 60 + 1);
+    for (uint32_t i = 0; i < len; i++)
+        buf[i] = (uint8_t)(seq + i);
+    return len;
+}
+
+static int bench_capture_check(const char *path, unsigned nr, uint32_t snaplen)
+{
+    uint8_t frame[1514];
+    struct pcap_trace trace;
+    if (pcap_load(path, &trace) < 0)
+        return -1;
+    int ret = 0;
+    if (trace.nr != nr) {
+        printf("BAD: %s has %u packets, expected %u\n", path, trace.nr, nr);
+        ret = -1;
+    }
+    for (unsigned i = 0; i < trace.nr && ret == 0; i++) {
+        uint32_t len = bench_capture_frame(frame, i);
+        uint32_t caplen = len < snaplen ? len : snaplen;
+        if (trace.pkts[i].len != caplen || memcmp(trace.pkts[i].data, frame, caplen) != 0 ||
+            trace.pkts[i].ts_ns != 1000000000ULL + i) {
+            printf("BAD: %s packet %u mismatch\n", path, i);
+            ret = -1;
+        }
+    }
+    pcap_trace_free(&trace);
+    return ret;
+}
+
+/**
+ * @brief 写满时间后返回每秒写入的报文数，rotate_size限制测试占用的磁盘空间
+ */
+static double bench_capture_rate(const char *path, uint32_t len, struct pcap_writer_stats *stats)
+{
+    uint8_t frame[1514];
+    memset(frame, 0x5a, len);
+    struct pcap_writer *w = pcap_writer_open(path, 0, 64 << 20, 2);
+    if (!w)
+        return -1;
+    uint64_t n = 0, start = now_ns(), ns;
+    while ((ns = now_ns() - start) < BENCH_CAPTURE_NS) {
+        for (int i = 0; i < BENCH_BURST; i++)
+            pcap_write(w, start + n + i, frame, len);
+        n += BENCH_BURST;
+    }
+    pcap_writer_close(w, stats);
+    return n * 1e9 / ns;
+}
+
+// 对照：每个报文一次write()
+static double bench_capture_write_rate(const char *path, uint32_t len)
+{
+    uint8_t rec[sizeof(struct pcap_pkt_hdr) + 1514];
+    memset(rec, 0x5a, sizeof(rec));
+    char name[320];
+    int fd = -1, seq = 0;
+    uint64_t n = 0, written = 0, start = now_ns(), ns;
+    while ((ns = now_ns() - start) < BENCH_CAPTURE_NS) {
+        // 和mmap写一样每64MB换一个文件，两个文件轮流用
+        if (fd < 0 || written >= 64 << 20) {
+            if (fd >= 0)
+                close(fd);
+            snprintf(name, sizeof(name), "%s.%d", path, seq++ % 2);
+            fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return -1;
+            written = 0;
+        }
+        if (write(fd, rec, sizeof(struct pcap_pkt_hdr) + len) < 0)
+            break;
+        written += sizeof(struct pcap_pkt_hdr) + len;
+        n++;
+    }
+    close(fd);
+    return n * 1e9 / ns;
+}
+
+// 模拟网卡上收包，capture为真时同时写pcap
+static double bench_capture_emu(struct e1000_device *dev, const char *path, struct pcap_writer_stats *stats)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    struct pcap_writer *w = NULL;
+    if (path && !(w = pcap_writer_open(path, 0, 64 << 20, 2)))
+        return -1;
+    uint64_t total = 0, start = now_ns(), ns;
+    while ((ns = now_ns() - start) < BENCH_CAPTURE_NS) {
+        int n = e1000_rx_poll(dev, pkts, BENCH_BURST);
+        uint64_t ts = now_ns();
+        for (int i = 0; i < n; i++) {
+            if (w)
+                pcap_write(w, ts, pktbuf_data(pkts[i]), pkts[i]->data_len);
+            pktbuf_free(pkts[i]);
+        }
+        total += n;
+    }
+    if (w)
+        pcap_writer_close(w, stats);
+    return total * 1e9 / ns;
+}
+
+/**
+ * @brief 在模拟网卡上收带标签的帧写进pcap，不管是否剥离，文件里的帧都只带一个标签
+ * 
+ * 接收标志按驱动当前的配置填写，改配置之前已经放进接收环的帧标志不对，
+ * 先丢掉两圈接收环的帧再开始写。
+ */
+static int bench_capture_vlan(struct e1000_device *dev, const char *path, int strip)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    struct pcap_writer *w = pcap_writer_open(path, 0, 0, 0);
+    if (!w)
+        return -1;
+    e1000_vlan_strip(dev, strip);
+    unsigned skip = dev->rx_nr * 2, written = 0;
+    while (written < BENCH_VLAN_CHECKS) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        for (int i = 0; i < n; i++) {
+            if (skip > 0)
+                skip--;
+            else if (written < BENCH_VLAN_CHECKS)
+                pcap_write_pkt(w, 1000000000ULL + written++, pkts[i]);
+        }
+        bench_pkts_free(pkts, n);
+        if (n == 0)
+            sched_yield();
+    }
+    pcap_writer_close(w, NULL);
+
+    struct pcap_trace trace;
+    if (pcap_load(path, &trace) < 0)
+        return -1;
+    unsigned bad = trace.nr != written;
+    for (unsigned i = 0; i < trace.nr; i++) {
+        const uint8_t *data = trace.pkts[i].data;
+        uint16_t tci = data[14] << 8 | data[15];
+        if (trace.pkts[i].len != E1000_EMU_FRAME_LEN + 4 || data[12] != 0x81 || data[13] != 0x00
+            || (tci & ~0xfff) != (BENCH_VLAN_TCI & ~0xfff) || (tci & 0xfff) < (BENCH_VLAN_TCI & 0xfff)
+            || (tci & 0xfff) >= (BENCH_VLAN_TCI & 0xfff) + BENCH_VLAN_NR
+            || data[16] != 0x88 || data[17] != 0xb5)
+            bad++;
+    }
+    pcap_trace_free(&trace);
+    unlink(path);
+    printf("vlan %-8s %u packets, %u with wrong tag: %s\n",
+           strip ? "strip" : "no strip", written, bad, bad ? "BAD" : "ok");
+    return bad ? -1 : 0;
+}
+
+/**
+ * @brief pcap写入：内容、截断、轮转、VLAN标签的正确性，mmap写入与逐包write()的吞吐对比，
+ *        以及在模拟网卡上边收边写能否跟上收包速率
+ */
+static int bench_capture(void)
+{
+    char dir[] = "/tmp/e1000-capture-XXXXXX", path[300], name[320];
+    uint8_t frame[1514];
+    struct pcap_writer_stats stats;
+    int ret = -1;
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/cap.pcap", dir);
+
+    // 报文会跨越映射块的边界
+    for (int s = 0; s < 2; s++) {
+        uint32_t snaplen = s ? BENCH_CAPTURE_SNAPLEN : PCAP_SNAPLEN_MAX;
+        struct pcap_writer *w = pcap_writer_open(path, snaplen, 0, 0);
+        if (!w)
+            goto out;
+        for (unsigned i = 0; i < BENCH_CAPTURE_CHECKS; i++) {
+            uint32_t len = bench_capture_frame(frame, i);
+            pcap_write(w, 1000000000ULL + i, frame, len);
+        }
+        pcap_writer_close(w, &stats);
+        if (bench_capture_check(path, BENCH_CAPTURE_CHECKS, snaplen) < 0)
+            goto out;
+        printf("snaplen %-5u %u packets, %lu bytes, %lu stalls: ok\n",
+               snaplen, BENCH_CAPTURE_CHECKS, stats.bytes, stats.stalls);
+    }
+    unlink(path);
+
+    // 每个文件一块，写满BENCH_CAPTURE_FILES个后覆盖最早的文件
+    struct pcap_writer *w = pcap_writer_open(path, 0, 1, BENCH_CAPTURE_FILES);
+    if (!w)
+        goto out;
+    uint64_t total = (uint64_t)PCAP_CHUNK_SIZE * (BENCH_CAPTURE_FILES * 2 + 1) / 1000;
+    for (uint64_t i = 0; i < total; i++)
+        pcap_write(w, 1000000000ULL + i, frame, 1000 - sizeof(struct pcap_pkt_hdr));
+    pcap_writer_close(w, &stats);
+    uint64_t kept = 0;
+    for (int i = 0; i <= BENCH_CAPTURE_FILES; i++) {
+        struct pcap_trace trace;
+        snprintf(name, sizeof(name), "%s.%d", path, i);
+        if (i == BENCH_CAPTURE_FILES) {
+            if (access(name, F_OK) == 0) {
+                printf("BAD: rotate created %s\n", name);
+                goto out;
+            }
+            break;
+        }
+        if (pcap_load(name, &trace) < 0)
+            goto out;
+        kept += trace.nr;
+        pcap_trace_free(&trace);
+        unlink(name);
+    }
+    if (stats.files != (total * 1000 + PCAP_CHUNK_SIZE - 1) / (PCAP_CHUNK_SIZE - sizeof(struct pcap_file_hdr)) ||
+        kept == 0 || kept >= total) {
+        printf("BAD: rotate wrote %lu files, kept %lu of %lu packets\n", stats.files, kept, total);
+        goto out;
+    }
+    printf("rotate      %lu packets, %lu files, kept %lu packets in last %d files: ok\n",
+           total, stats.files, kept, BENCH_CAPTURE_FILES);
+
+    uint32_t lens[] = {64, 1514};
+    for (int i = 0; i < 2; i++) {
+        double pps = bench_capture_write_rate(path, lens[i]);
+        for (int j = 0; j < 2; j++) {
+            snprintf(name, sizeof(name), "%s.%d", path, j);
+            unlink(name);
+        }
+        printf("write()     %4u bytes  %7.2f Mpps  %6.2f Gbit/s\n",
+               lens[i], pps / 1e6, pps * lens[i] * 8 / 1e9);
+        pps = bench_capture_rate(path, lens[i], &stats);
+        for (int j = 0; j < 2; j++) {
+            snprintf(name, sizeof(name), "%s.%d", path, j);
+            unlink(name);
+        }
+        printf("mmap        %4u bytes  %7.2f Mpps  %6.2f Gbit/s  %lu stalls\n",
+               lens[i], pps / 1e6, pps * lens[i] * 8 / 1e9, stats.stalls);
+    }
+
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        goto out;
+    }
+    // 剥离的标签放回报文，没剥离的原样写
+    e1000_emu_set_frame_vlan(dev, BENCH_VLAN_TCI, BENCH_VLAN_NR);
+    if (bench_capture_vlan(dev, path, 1) < 0 || bench_capture_vlan(dev, path, 0) < 0) {
+        e1000_emu_stop(dev);
+        goto out;
+    }
+    e1000_emu_set_frame_vlan(dev, 0, 0);
+    e1000_vlan_strip(dev, 0);
+
+    double rx = bench_capture_emu(dev, NULL, NULL);
+    double cap = bench_capture_emu(dev, path, &stats);
+    for (int j = 0; j < 2; j++) {
+        snprintf(name, sizeof(name), "%s.%d", path, j);
+        unlink(name);
+    }
+    e1000_emu_stop(dev);
+    printf("emu rx      %7.2f Mpps, rx + capture %7.2f Mpps, %lu stalls\n", rx / 1e6, cap / 1e6, stats.stalls);
+    ret = 0;
+
+out:
+    unlink(path);
+    rmdir(dir);
+    return ret;
+}
+
+struct bench_pktgen_check {
+    const struct pcap_trace *trace; // 回放时对照的报文，NULL表示检查合成报文
+    volatile uint64_t frames;
+    uint64_t errors;
+};
+
+/**
+ * @brief 检查模拟网卡发出去的帧：回放的帧按顺序和pcap一致，合成的帧流轮换、校验和正确
+ */
+static void bench_pktgen_hook(void *arg, const uint8_t *frame, uint32_t len)
+{
+    struct bench_pktgen_check *c = arg;
+    uint64_t i = c->frames;
+    if (c->trace) {
+        const struct pcap_pkt *pkt = &c->trace->pkts[i % c->trace->nr];
+        if (len != pkt->len || memcmp(frame, pkt->data, len) != 0)
+            c->errors++;
+    } else {
+        const struct ipv4_hdr *ip = (const struct ipv4_hdr *)(frame + sizeof(struct eth_hdr));
+        const struct udp_hdr *udp = (const struct udp_hdr *)(ip + 1);
+        if (len != BENCH_PKTGEN_LEN || ip->proto != IP_PROTO_UDP ||
+            ntohs(udp->src_port) != 1024 + i % BENCH_PKTGEN_FLOWS || bench_cksum_check(frame, len) < 0)
+            c->errors++;
+    }
+    c->frames = i + 1;
+}
+
+// 发count个报文，返回实际速率，pps
+static double bench_pktgen_run(struct e1000_device *dev, const struct pktgen_cfg *cfg,
+                               struct bench_pktgen_check *check, struct pktgen_stats *stats)
+{
+    struct pktgen gen;
+    volatile int running = 1;
+    if (pktgen_init(&gen, dev, cfg) < 0)
+        return -1;
+    if (check) {
+        check->trace = cfg->pcap ? &gen.trace : NULL;
+        check->frames = 0;
+        check->errors = 0;
+        e1000_emu_set_tx_hook(dev, bench_pktgen_hook, check);
+    }
+    uint64_t start = now_ns();
+    pktgen_run(&gen, &running);
+    uint64_t ns = now_ns() - start;
+    // 等模拟网卡把发送环里剩下的帧发完
+    while (check && check->frames < cfg->count && now_ns() - start < ns + 1000000000ULL)
+        sched_yield();
+    e1000_emu_set_tx_hook(dev, NULL, NULL);
+    pktgen_stats_get(&gen, stats);
+    pktgen_free(&gen);
+    return stats->tx_packets * 1e9 / ns;
+}
+
+/**
+ * @brief 报文生成器：回放和合成报文的正确性，TSC限速的准确度，以及不限速时的最高速率
+ */
+static int bench_pktgen(void)
+{
+    char dir[] = "/tmp/e1000-pktgen-XXXXXX", path[300];
+    uint8_t frame[1514];
+    struct bench_pktgen_check check;
+    struct pktgen_stats stats;
+    int ret = -1;
+
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    printf("tsc %.3f GHz\n", pktgen_tsc_hz() / 1e9);
+
+    // 回放一个长度各不相同的pcap，循环发几遍
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        goto stop;
+    }
+    snprintf(path, sizeof(path), "%s/replay.pcap", dir);
+    struct pcap_writer *w = pcap_writer_open(path, 0, 0, 0);
+    if (!w)
+        goto out;
+    for (unsigned i = 0; i < 1000; i++) {
+        uint32_t len = bench_capture_frame(frame, i);
+        pcap_write(w, 1000000000ULL + i, frame, len);
+    }
+    pcap_writer_close(w, NULL);
+
+    struct pktgen_cfg cfg = { .pcap = path, .count = BENCH_PKTGEN_CHECKS };
+    memset(cfg.dst_mac, 0xff, 6);
+    bench_pktgen_run(dev, &cfg, &check, &stats);
+    if (check.frames != cfg.count || check.errors) {
+        printf("BAD: replay sent %lu frames, %lu errors\n", check.frames, check.errors);
+        goto out;
+    }
+    printf("replay      %lu frames: ok\n", check.frames);
+
+    cfg.pcap = NULL;
+    cfg.pkt_len = BENCH_PKTGEN_LEN;
+    cfg.nr_flows = BENCH_PKTGEN_FLOWS;
+    bench_pktgen_run(dev, &cfg, &check, &stats);
+    if (check.frames != cfg.count || check.errors) {
+        printf("BAD: udp flows sent %lu frames, %lu errors\n", check.frames, check.errors);
+        goto out;
+    }
+    printf("udp flows   %lu frames: ok\n", check.frames);
+
+    // 限速的准确度，按目标速率发BENCH_PKTGEN_NS的量
+    uint64_t rates[] = {10000, 100000, 1000000};
+    cfg.pkt_len = PKTGEN_PKT_LEN_MIN;
+    for (int i = 0; i < 3; i++) {
+        cfg.rate_pps = rates[i];
+        cfg.count = rates[i] * BENCH_PKTGEN_NS / 1000000000ULL;
+        double pps = bench_pktgen_run(dev, &cfg, NULL, &stats);
+        printf("rate %8lu pps  achieved %10.0f pps  error %+6.2f%%  late %lu\n",
+               rates[i], pps, (pps - rates[i]) * 100.0 / rates[i], stats.late);
+    }
+    cfg.rate_pps = 0;
+    cfg.rate_bps = 100 * 1000000ULL;
+    cfg.pkt_len = 1514;
+    cfg.count = cfg.rate_bps / ((1514 + PKTGEN_WIRE_OVERHEAD) * 8) * BENCH_PKTGEN_NS / 1000000000ULL;
+    double pps = bench_pktgen_run(dev, &cfg, NULL, &stats);
+    double bps = pps * (1514 + PKTGEN_WIRE_OVERHEAD) * 8;
+    printf("rate %8.0f Mbit/s  achieved %6.1f Mbit/s  error %+6.2f%%  late %lu\n",
+           cfg.rate_bps / 1e6, bps / 1e6, (bps - cfg.rate_bps) * 100.0 / cfg.rate_bps, stats.late);
+
+    cfg.rate_bps = 0;
+    uint16_t lens[] = {PKTGEN_PKT_LEN_MIN, 1514};
+    for (int i = 0; i < 2; i++) {
+        cfg.pkt_len = lens[i];
+        cfg.count = 5 * 1000 * 1000;
+        pps = bench_pktgen_run(dev, &cfg, NULL, &stats);
+        printf("unlimited %4u bytes  %7.2f Mpps  ring full %lu\n", lens[i], pps / 1e6, stats.ring_full);
+    }
+    ret = 0;
+
+out:
+    unlink(path);
+    rmdir(dir);
+stop:
+    e1000_emu_stop(dev);
+    return ret;
+}
+
+// 让模拟网卡的合成帧发往别的地址，全部被地址过滤丢掉，接收队列就空闲了
+static const uint8_t bench_foreign_mac[1][6] = {{0x02, 0x00, 0x00, 0x00, 0x00, 0xee}};
+
+/**
+ * @brief 停掉流量，并收掉接收环里已经有的帧
+ */
+static void bench_rx_idle(struct e1000_device *dev)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    e1000_emu_set_frame_dst(dev, bench_foreign_mac, 1);
+    for (int empty = 0; empty < 3;) {
+        int n = e1000_rx_burst(dev, pkts, BENCH_BURST);
+        bench_pkts_free(pkts, n);
+        empty = n == 0 ? empty + 1 : 0;
+        sched_yield();
+    }
+}
+
+struct bench_poll_wake {
+    struct e1000_device *dev;
+    uint32_t delay_us;
+};
+
+static void *bench_poll_wake_thread(void *arg)
+{
+    struct bench_poll_wake *w = arg;
+    usleep(w->delay_us);
+    e1000_emu_set_frame_dst(w->dev, NULL, 0);
+    return NULL;
+}
+
+/**
+ * @brief 调用e1000_rx_poll()直到过了ns纳秒，返回收到的报文数和调用次数，stats是这段时间的增量
+ */
+static uint64_t bench_poll_run(struct e1000_device *dev, uint64_t ns, uint64_t *calls,
+                               struct e1000_poll_stats *stats, uint64_t *elapsed)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    struct e1000_poll_stats before;
+    uint64_t total = 0;
+    *calls = 0;
+    e1000_poll_stats_get(dev, &before);
+    uint64_t start = now_ns();
+    while (now_ns() - start < ns) {
+        int n = e1000_rx_poll(dev, pkts, BENCH_BURST);
+        bench_pkts_free(pkts, n);
+        total += n;
+        (*calls)++;
+    }
+    *elapsed = now_ns() - start;
+    e1000_poll_stats_get(dev, stats);
+    stats->busy_ns -= before.busy_ns;
+    stats->sleep_ns -= before.sleep_ns;
+    stats->sleeps -= before.sleeps;
+    stats->wakeups -= before.wakeups;
+    stats->timeouts -= before.timeouts;
+    return total;
+}
+
+static void bench_poll_report(const char *name, uint64_t pkts, uint64_t calls, uint64_t elapsed,
+                              const struct e1000_poll_stats *st, int ok)
+{
+    printf("%-8s %9lu pkts %8lu calls  busy %6.1f ms  sleep %6.1f ms of %6.1f ms  "
+           "sleeps %lu wakeups %lu timeouts %lu: %s\n",
+           name, pkts, calls, st->busy_ns / 1e6, st->sleep_ns / 1e6, elapsed / 1e6,
+           st->sleeps, st->wakeups, st->timeouts, ok ? "ok" : "BAD");
+}
+
+/**
+ * @brief 自适应接收的状态切换和耗时统计
+ * 
+ * 在模拟网卡上依次检查：有流量时忙轮询和睡眠的时间加起来等于经过的时间；
+ * 没有流量时每次调用都睡眠一次，等到超时后返回0；睡眠中来了报文会被中断唤醒；
+ * 预算为0时一直忙轮询，空闲时立即返回。
+ */
+static int bench_poll(void)
+{
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    struct e1000_poll_stats st;
+    uint64_t calls, elapsed, pkts;
+
+    // 两次调用之间的时间也算忙轮询，所以忙轮询和睡眠应该覆盖整段时间
+    pkts = bench_poll_run(dev, BENCH_POLL_NS, &calls, &st, &elapsed);
+    uint64_t accounted = st.busy_ns + st.sleep_ns;
+    int ok = pkts > 0 && accounted > elapsed * 9 / 10 && accounted < elapsed * 11 / 10
+             && st.wakeups + st.timeouts <= st.sleeps;
+    bench_poll_report("traffic", pkts, calls, elapsed, &st, ok);
+    if (!ok)
+        return -1;
+
+    // 空闲：每次调用空转预算后睡眠一次，超时后返回0。之前打开的中断可能留下一次唤醒
+    bench_rx_idle(dev);
+    pkts = bench_poll_run(dev, BENCH_POLL_NS, &calls, &st, &elapsed);
+    uint64_t min_timeouts = BENCH_POLL_NS / (E1000_SLEEP_TIMEOUT_MS * 1000000ULL) / 2;
+    ok = pkts == 0 && st.sleeps == calls && st.wakeups + st.timeouts == st.sleeps
+         && st.wakeups <= 1 && st.timeouts >= min_timeouts && st.sleep_ns > elapsed * 8 / 10;
+    bench_poll_report("idle", pkts, calls, elapsed, &st, ok);
+    if (!ok)
+        return -1;
+
+    // 睡眠中恢复流量，模拟网卡通过socketpair产生中断
+    struct bench_poll_wake wake = {dev, BENCH_POLL_WAKE_US};
+    struct e1000_poll_stats before;
+    struct pktbuf *rx[BENCH_BURST];
+    pthread_t tid;
+    e1000_poll_stats_get(dev, &before);
+    uint64_t start = now_ns();
+    if (pthread_create(&tid, NULL, bench_poll_wake_thread, &wake) != 0)
+        return -1;
+    int n = 0;
+    for (calls = 0; n == 0 && now_ns() - start < BENCH_POLL_NS; calls++)
+        n = e1000_rx_poll(dev, rx, BENCH_BURST);
+    elapsed = now_ns() - start;
+    pthread_join(tid, NULL);
+    bench_pkts_free(rx, n);
+    e1000_poll_stats_get(dev, &st);
+    st.busy_ns -= before.busy_ns;
+    st.sleep_ns -= before.sleep_ns;
+    st.sleeps -= before.sleeps;
+    st.wakeups -= before.wakeups;
+    st.timeouts -= before.timeouts;
+    ok = n > 0 && st.wakeups >= 1 && st.sleeps >= 1;
+    bench_poll_report("wakeup", n, calls, elapsed, &st, ok);
+    if (!ok)
+        return -1;
+
+    // 预算为0：空闲时不睡眠，每次调用空转一轮就返回
+    bench_rx_idle(dev);
+    e1000_rx_set_idle_budget(dev, 0);
+    pkts = bench_poll_run(dev, BENCH_POLL_NS, &calls, &st, &elapsed);
+    accounted = st.busy_ns + st.sleep_ns;
+    ok = pkts == 0 && st.sleeps == 0 && st.sleep_ns == 0 && calls > BENCH_POLL_NS / 1000000
+         && accounted > elapsed * 9 / 10 && accounted < elapsed * 11 / 10;
+    bench_poll_report("budget 0", pkts, calls, elapsed, &st, ok);
+    e1000_emu_stop(dev);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief 检查网卡里的中断调节寄存器和驱动记录的参数一致
+ */
+static int bench_intr_regs_check(struct e1000_device *dev, const struct e1000_intr_mod *mod)
+{
+    void *hw = dev->hw_addr;
+    return E1000_READ_REG(hw, E1000_ITR) == mod->itr_ns / 256
+        && E1000_READ_REG(hw, E1000_RDTR) == mod->rdtr_us * 1000 / 1024
+        && E1000_READ_REG(hw, E1000_RADV) == mod->radv_us * 1000 / 1024
+        && E1000_READ_REG(hw, E1000_TIDV) == mod->tidv_us * 1000 / 1024
+        && E1000_READ_REG(hw, E1000_TADV) == mod->tadv_us * 1000 / 1024 ? 0 : -1;
+}
+
+/**
+ * @brief 按pps的速率从接收队列取报文，0表示有多少取多少，过了ns纳秒后返回自动调节选中的档位
+ */
+static int bench_intr_auto_run(struct e1000_device *dev, uint64_t pps, uint64_t ns, uint64_t *total)
+{
+    struct pktbuf *pkts[BENCH_BURST];
+    uint64_t start = now_ns(), next = start;
+    *total = 0;
+    while (now_ns() - start < ns) {
+        int n = e1000_rx_poll(dev, pkts, pps ? 1 : BENCH_BURST);
+        bench_pkts_free(pkts, n);
+        *total += n;
+        if (pps) {
+            next += 1000000000ULL / pps;
+            while (now_ns() < next)
+                sched_yield();
+        }
+    }
+    return dev->itr_level;
+}
+
+/**
+ * @brief 中断调节：参数换算成寄存器的值，自动调节按接收速率选择档位
+ * 
+ * 模拟网卡不模拟中断延迟，这里只检查驱动写进寄存器的值和档位的选择。
+ */
+static int bench_intr(void)
+{
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    struct e1000_intr_mod mod = {50000, 8, 32, 16, 64}, got;
+    e1000_intr_mod_set(dev, &mod);
+    e1000_intr_mod_get(dev, &got);
+    int ok = memcmp(&mod, &got, sizeof(mod)) == 0 && bench_intr_regs_check(dev, &mod) == 0
+             && E1000_READ_REG(dev->hw_addr, E1000_ITR) == 195 && E1000_READ_REG(dev->hw_addr, E1000_RADV) == 31;
+    printf("manual: itr %u rdtr %u radv %u tidv %u tadv %u: %s\n",
+           E1000_READ_REG(dev->hw_addr, E1000_ITR), E1000_READ_REG(dev->hw_addr, E1000_RDTR),
+           E1000_READ_REG(dev->hw_addr, E1000_RADV), E1000_READ_REG(dev->hw_addr, E1000_TIDV),
+           E1000_READ_REG(dev->hw_addr, E1000_TADV), ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 统计周期是E1000_ITR_UPDATE_NS，每种速率跑三个周期，第一个周期可能跨越速率变化
+    static const struct {
+        const char *name;
+        uint64_t pps; // 0: 有多少收多少，UINT64_MAX: 没有流量
+        int level;
+    } steps[] = {
+        {"idle", UINT64_MAX, 0},
+        {"full rate", 0, 2},
+        {"40k pps", BENCH_INTR_PPS, 1},
+        {"idle", UINT64_MAX, 0},
+    };
+    e1000_intr_mod_auto(dev, 1);
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        uint64_t total;
+        if (steps[i].pps == UINT64_MAX)
+            bench_rx_idle(dev);
+        else
+            e1000_emu_set_frame_dst(dev, NULL, 0);
+        int level = bench_intr_auto_run(dev, steps[i].pps == UINT64_MAX ? 0 : steps[i].pps,
+                                        3 * E1000_ITR_UPDATE_NS, &total);
+        e1000_intr_mod_get(dev, &got);
+        ok = level == steps[i].level && bench_intr_regs_check(dev, &got) == 0
+             && (level == 0 ? got.rdtr_us == 0 : got.rdtr_us > 0);
+        printf("auto %-10s %8.0f pps  level %d  itr %6u ns  rdtr %3u us  radv %3u us: %s\n",
+               steps[i].name, total * 1e9 / (3 * E1000_ITR_UPDATE_NS), level, got.itr_ns,
+               got.rdtr_us, got.radv_us, ok ? "ok" : "BAD");
+        if (!ok)
+            return -1;
+    }
+    e1000_emu_stop(dev);
+    return 0;
+}
+
+/**
+ * @brief 统计：队列计数和模拟网卡自己的计数一致，硬件统计寄存器按读后清零累加
+ * 
+ * 模拟网卡不维护统计寄存器，这里直接写寄存器，每次采样之后写进去的值
+ * 相当于网卡清零后又统计到的数。
+ */
+static int bench_stats(void)
+{
+    struct e1000_device *dev = e1000_device_get(E1000_EMU_PREFIX);
+    if (!dev || e1000_init(dev, RX_DESC_NR, TX_DESC_NR) < 0) {
+        printf("emu device init failed\n");
+        return -1;
+    }
+    struct e1000_emu *emu = dev->emu;
+    struct e1000_stats st;
+    struct pktbuf *pkts[BENCH_BURST];
+
+    // 收一段时间后停掉流量并收完接收环，驱动收到的就是模拟网卡放进去的全部报文
+    uint64_t start = now_ns();
+    while (now_ns() - start < BENCH_STATS_NS) {
+        int n = e1000_rx_poll(dev, pkts, BENCH_BURST);
+        bench_pkts_free(pkts, n);
+    }
+    bench_rx_idle(dev);
+    e1000_stats_get(dev, &st);
+    int ok = st.rx.packets > 0 && st.rx.packets == emu->rx_packets && st.rx.bytes == emu->rx_bytes
+             && st.rx.drops == 0 && st.rx.ring_full == 0;
+    printf("rx queue: %lu packets %lu bytes, nic %lu packets %lu bytes: %s\n",
+           st.rx.packets, st.rx.bytes, emu->rx_packets, emu->rx_bytes, ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    int n = 0;
+    start = now_ns();
+    while (now_ns() - start < BENCH_STATS_NS) {
+        n += bench_pkts_alloc(dev, pkts + n, BENCH_BURST - n);
+        int sent = e1000_tx_burst(dev, pkts, n);
+        memmove(pkts, pkts + sent, (n - sent) * sizeof(pkts[0]));
+        n -= sent;
+        if (sent == 0)
+            sched_yield();
+    }
+    bench_pkts_free(pkts, n);
+    while (E1000_READ_REG(dev->hw_addr, E1000_TDH) != dev->tx_cur)
+        sched_yield();
+    e1000_stats_get(dev, &st);
+    ok = st.tx.packets > 0 && st.tx.packets == emu->tx_packets && st.tx.bytes == emu->tx_bytes;
+    printf("tx queue: %lu packets %lu bytes, nic %lu packets %lu bytes, %lu ring full: %s\n",
+           st.tx.packets, st.tx.bytes, emu->tx_packets, emu->tx_bytes, st.tx.ring_full, ok ? "ok" : "BAD");
+    e1000_emu_stop(dev);
+    if (!ok)
+        return -1;
+
+    // 64位计数器的低32位进位到高32位
+    void *hw = dev->hw_addr;
+    E1000_WRITE_REG(hw, E1000_GPRC, 100);
+    E1000_WRITE_REG(hw, E1000_GORCL, 0xfffffff0);
+    E1000_WRITE_REG(hw, E1000_GORCL + 4, 1);
+    e1000_stats_get(dev, &st);
+    ok = st.hw.gprc == 100 && st.hw.gorc == 0x1fffffff0ULL;
+    E1000_WRITE_REG(hw, E1000_GPRC, 50);
+    E1000_WRITE_REG(hw, E1000_GORCL, 0x20);
+    E1000_WRITE_REG(hw, E1000_GORCL + 4, 0);
+    e1000_stats_get(dev, &st);
+    ok = ok && st.hw.gprc == 150 && st.hw.gorc == 0x200000010ULL;
+    printf("hw sample: gprc %lu gorc %#lx: %s\n", st.hw.gprc, st.hw.gorc, ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 采样线程每个周期累加一次，寄存器一直是1，累加的次数就是采样次数
+    E1000_WRITE_REG(hw, E1000_GPRC, 0);
+    E1000_WRITE_REG(hw, E1000_GORCL, 0);
+    E1000_WRITE_REG(hw, E1000_GPTC, 1);
+    uint64_t gptc = st.hw.gptc;
+    if (e1000_stats_start(dev, BENCH_STATS_INTERVAL_MS) < 0)
+        return -1;
+    usleep(BENCH_STATS_NS / 1000);
+    e1000_stats_stop(dev);
+    uint64_t samples = dev->hw_stats.gptc - gptc;
+    uint64_t expected = BENCH_STATS_NS / 1000000 / BENCH_STATS_INTERVAL_MS;
+    ok = samples >= expected / 2 && samples <= expected + 2 && dev->hw_stats.gprc == 150;
+    printf("hw sampler: %lu samples in %lu ms at %d ms interval: %s\n",
+           samples, BENCH_STATS_NS / 1000000, BENCH_STATS_INTERVAL_MS, ok ? "ok" : "BAD");
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief 设备表：多个模拟网卡按打开顺序编号，各自的MAC和接收环互不影响，重复打开和表满时拒绝
+ */
+static int bench_ports(void)
+{
+    struct e1000_device *devs[E1000_MAX_DEVICES];
+    struct pktbuf *pkts[BENCH_BURST];
+    char name[16];
+
+    for (int i = 0; i < BENCH_PORTS; i++) {
+        snprintf(name, sizeof(name), "%s%d", E1000_EMU_PREFIX, i);
+        devs[i] = e1000_device_get(name);
+        if (!devs[i] || e1000_init(devs[i], RX_DESC_NR, TX_DESC_NR) < 0) {
+            printf("emu device init failed\n");
+            return -1;
+        }
+    }
+    int ok = e1000_device_count() == BENCH_PORTS && !e1000_device_at(-1) && !e1000_device_at(BENCH_PORTS);
+    for (int i = 0; i < BENCH_PORTS; i++)
+        ok = ok && devs[i]->port_id == i && e1000_device_at(i) == devs[i] && devs[i]->mac_addr[5] == i;
+    // 重复打开、混用真实网卡都不会占用表项
+    ok = ok && !e1000_device_get("emu1") && !e1000_device_get("0000:00:00.0")
+         && e1000_device_count() == BENCH_PORTS;
+    printf("table: %d ports, port ids and macs: %s\n", e1000_device_count(), ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 每个端口收到的合成帧源地址都是自己的MAC
+    for (int i = 0; i < BENCH_PORTS; i++) {
+        uint64_t total = 0, wrong = 0;
+        while (total < BENCH_PORTS_CHECKS) {
+            int n = e1000_rx_burst(devs[i], pkts, BENCH_BURST);
+            for (int k = 0; k < n; k++) {
+                if (memcmp(pktbuf_data(pkts[k]) + 6, devs[i]->mac_addr, 6) != 0)
+                    wrong++;
+            }
+            bench_pkts_free(pkts, n);
+            total += n;
+            if (n == 0)
+                sched_yield();
+        }
+        ok = ok && wrong == 0;
+        printf("port %d %s: %lu frames, %lu from another port: %s\n",
+               i, devs[i]->name, total, wrong, wrong ? "BAD" : "ok");
+    }
+    if (!ok)
+        return -1;
+
+    // 表满之后再打开失败
+    int nr = BENCH_PORTS;
+    while (nr < E1000_MAX_DEVICES) {
+        snprintf(name, sizeof(name), "%s%d", E1000_EMU_PREFIX, nr);
+        if (!(devs[nr] = e1000_device_get(name)))
+            break;
+        nr++;
+    }
+    snprintf(name, sizeof(name), "%s%d", E1000_EMU_PREFIX, nr);
+    ok = nr == E1000_MAX_DEVICES && !e1000_device_get(name) && e1000_device_count() == E1000_MAX_DEVICES;
+    printf("table full at %d ports: %s\n", nr, ok ? "ok" : "BAD");
+    for (int i = 0; i < nr; i++)
+        e1000_emu_stop(devs[i]);
+    return ok ? 0 : -1;
+}
+
+struct bench_engine_check {
+    const uint8_t *from; // 应该是从这个端口收到、转发出来的帧，源地址是它的MAC
+    uint64_t frames;
+    uint64_t errors;
+};
+
+static void bench_engine_hook(void *arg, const uint8_t *frame, uint32_t len)
+{
+    struct bench_engine_check *c = arg;
+    if (len < 14 || memcmp(frame + 6, c->from, 6) != 0)
+        c->errors++;
+    c->frames++;
+}
+
+// 端口2k和2k+1互相转发，不改报文
+static int bench_engine_handler(int port_id, struct pktbuf **pkts, int n, int *tx_port, void *arg)
+{
+    *tx_port = port_id ^ 1;
+    return n;
+}
+
+/**
+ * @brief 运行引擎一段时间，等两个端口都发送完成，返回所有工作线程的计数之和
+ */
+static void bench_engine_run(struct engine *eng, struct e1000_device **devs, struct engine_worker_stats *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    if (engine_start(eng) < 0)
+        return;
+    usleep(BENCH_ENGINE_NS / 1000);
+    engine_stop(eng);
+    for (int i = 0; i < 2; i++) {
+        while (E1000_READ_REG(devs[i]->hw_addr, E1000_TDH) != devs[i]->tx_cur)
+            sched_yield();
+    }
+    for (int i = 0; i < eng->nr_workers; i++) {
+        struct engine_worker_stats stats;
+        engine_stats_get(eng, i, &stats);
+        sum->rx_packets += stats.rx_packets;
+        sum->tx_packets += stats.tx_packets;
+        sum->tx_drops += stats.tx_drops;
+        sum->loops += stats.loops;
+        sum->idle_loops += stats.idle_loops;
+    }
+}
+
+/**
+ * @brief 引擎在两个模拟网卡之间转发
+ * 
+ * 一个工作线程负责两个端口时，从一个端口收到的报文原样从另一个端口发出，
+ * 收发计数和网卡实际发出的帧数一致；两个端口分给不同的线程时，
+ * 发往别的线程的端口的报文全部丢弃并计入tx_drops。
+ */
+static int bench_engine(void)
+{
+    struct e1000_device *devs[2];
+    struct bench_engine_check checks[2];
+    char name[16];
+    for (int i = 0; i < 2; i++) {
+        snprintf(name, sizeof(name), "%s%d", E1000_EMU_PREFIX, i);
+        devs[i] = e1000_device_get(name);
+        if (!devs[i] || e1000_init(devs[i], RX_DESC_NR, TX_DESC_NR) < 0) {
+            printf("emu device init failed\n");
+            return -1;
+        }
+    }
+    // 端口i发出的帧来自另一个端口
+    for (int i = 0; i < 2; i++) {
+        checks[i] = (struct bench_engine_check){.from = devs[i ^ 1]->mac_addr};
+        e1000_emu_set_tx_hook(devs[i], bench_engine_hook, &checks[i]);
+    }
+
+    struct engine eng;
+    struct engine_worker_stats sum;
+    engine_init(&eng, bench_engine_handler, NULL);
+    int w = engine_add_worker(&eng, -1);
+    if (engine_assign(&eng, w, 0) < 0 || engine_assign(&eng, w, 1) < 0)
+        return -1;
+    bench_engine_run(&eng, devs, &sum);
+    uint64_t out = checks[0].frames + checks[1].frames;
+    int ok = sum.rx_packets > 0 && sum.rx_packets == sum.tx_packets + sum.tx_drops
+             && out == sum.tx_packets && checks[0].frames > 0 && checks[1].frames > 0
+             && checks[0].errors == 0 && checks[1].errors == 0;
+    printf("1 worker  0<->1: rx %lu, tx %lu, drops %lu, nic sent %lu + %lu, %lu wrong source: %s\n",
+           sum.rx_packets, sum.tx_packets, sum.tx_drops, checks[0].frames, checks[1].frames,
+           checks[0].errors + checks[1].errors, ok ? "ok" : "BAD");
+    if (!ok)
+        return -1;
+
+    // 端口分给两个线程，转发目标不属于本线程
+    engine_init(&eng, bench_engine_handler, NULL);
+    for (int i = 0; i < 2; i++) {
+        if (engine_assign(&eng, engine_add_worker(&eng, -1), i) < 0)
+            return -1;
+    }
+    bench_engine_run(&eng, devs, &sum);
+    ok = sum.rx_packets > 0 && sum.tx_packets == 0 && sum.tx_drops == sum.rx_packets
+         && checks[0].frames + checks[1].frames == out;
+    printf("2 workers 0, 1: rx %lu, tx %lu, drops %lu, nic sent %lu: %s\n",
+           sum.rx_packets, sum.tx_packets, sum.tx_drops, checks[0].frames + checks[1].frames - out,
+           ok ? "ok" : "BAD");
+    for (int i = 0; i < 2; i++)
+        e1000_emu_stop(devs[i]);
+    return ok ? 0 : -1;
+}
+
+static struct bench benches[] = {
+    {"rx", "e1000_rx_burst()与e1000_recv()对比，软件模拟接收描述符环", bench_rx},
+    {"tx", "e1000_tx_burst()与逐包发送对比，软件模拟发送描述符环", bench_tx},
+    {"xlate", "virt_to_phys()/phys_to_virt()查找耗时随登记页数的变化", bench_xlate},
+    {"mempool", "缓冲池多线程压力测试和分配释放吞吐", bench_mempool},
+    {"emu", "软件模拟网卡上的收发吞吐", bench_emu},
+    {"poll", "自适应接收的忙轮询/睡眠切换、中断唤醒和耗时统计", bench_poll},
+    {"intr", "中断调节参数的寄存器换算，以及自动调节按接收速率选择的档位", bench_intr},
+    {"stats", "队列计数和硬件统计寄存器的采样累加", bench_stats},
+    {"ports", "多个模拟网卡的设备表、端口编号和互不影响的接收环", bench_ports},
+    {"engine", "工作线程在两个模拟网卡之间转发的正确性和计数，以及跨线程端口的丢弃", bench_engine},
+    {"cksum", "收发校验和卸载的正确性，以及与软件计算校验和的开销对比", bench_cksum},
+    {"tso", "TCP分段卸载的正确性，以及与软件分段的开销对比", bench_tso},
+    {"jumbo", "巨帧多描述符接收和多段报文发送的正确性，以及与1514字节帧的吞吐对比", bench_jumbo},
+    {"vlan", "VLAN标签剥离、插入和过滤的正确性，以及与软件处理标签的开销对比", bench_vlan},
+    {"filter", "单播/组播地址过滤和混杂模式的正确性，以及过滤对有用报文吞吐的影响", bench_filter},
+    {"ring", "无锁环形队列的入队出队开销、跨线程吞吐和延迟", bench_ring},
+    {"rxscan", "接收描述符扫描的标量/SSE4/AVX2实现的正确性和开销", bench_rxscan},
+    {"capture", "pcap写入的正确性和轮转，mmap写入与逐包write()的吞吐对比", bench_capture},
+    {"pktgen", "报文生成器回放和合成报文的正确性，限速准确度和最高速率", bench_pktgen},
+};
+
+void bench_list(void)
+{
+    printf("benchmarks:\n");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+        printf("  %-10s %s\n", benches[i].name, benches[i].desc);
+}
+
+int bench_run(const char *name)
+{
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (strcmp(benches[i].name, name) == 0)
+            return benches[i].run();
+    }
+    printf("unknown benchmark: %s\n", name);
+    bench_list();
+    return -1;
+}
@@ -1,5 +1,8 @@
 #include "e1000.h"
 #include "mem_alloc.h"
+#include "pktbuf.h"
+#include "e1000_emu.h"
+#include "ip.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,6 +12,8 @@
 #include <pthread.h>
 #include <assert.h>
 #include <unistd.h>
+#include <time.h>
+#include <dirent.h>
 
 #define INTEL_82545EM_CLASS  "0x020000"
 #define INTEL_82545EM_VENDOR "0x8086"
@@ -47,22 +52,52 @@ static int is_intel_82545EM(const char *pci_id)
     return 1;
 }
 
+static struct e1000_device *e1000_devices[E1000_MAX_DEVICES];
+static int e1000_nr_devices = 0;
+
 /**
- * @brief 通过pci_id获取e1000设备
+ * @brief 查找绑定到igb_uio的设备对应的uio编号
+ * 
+ * /sys/bus/pci/devices/<pci_id>/uio/ 下面有一个 uioN 目录
  * 
- * @param pci_id: 0000:02:02.0 
+ * @return uio编号，没有绑定时返回-1
  */
-struct e1000_device *e1000_device_get(const char *pci_id)
+static int e1000_uio_index(const char *pci_id)
+{
+    char path[1024] = {0};
+    int index = -1;
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/uio", pci_id);
+    DIR *dir = opendir(path);
+    if (!dir)
+        return -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "uio%d", &index) == 1)
+            break;
+        index = -1;
+    }
+    closedir(dir);
+    return index;
+}
+
+static struct e1000_device *e1000_pci_device_get(const char *pci_id)
 {
     char path[1024] = {0};
     int resource_fd = -1;
     int uio_fd = -1;
     int config_fd = -1;
     struct e1000_device *dev = NULL;
+
     if (!is_intel_82545EM(pci_id)) // 只支持intel 82545EM 也就是VMware的默认网卡
         goto error;
 
-    dev = (struct e1000_device *)malloc(sizeof(struct e1000_device));
+    int uio_index = e1000_uio_index(pci_id);
+    if (uio_index < 0) {
+        printf("%s is not bound to igb_uio\n", pci_id);
+        goto error;
+    }
+
+    dev = (struct e1000_device *)calloc(1, sizeof(struct e1000_device));
     if (!dev)
         goto error;
 
@@ -72,16 +107,18 @@ struct e1000_device *e1000_device_get(const char *pci_id)
     if (resource_fd < 0)
         goto error;
 
-    dev->hw_addr = mmap(NULL, 0x1ffff, PROT_READ | PROT_WRITE, MAP_SHARED, resource_fd, 0);
+    dev->hw_addr = mmap(NULL, E1000_BAR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, resource_fd, 0);
     if (dev->hw_addr == MAP_FAILED)
         goto error;
+    close(resource_fd); // 映射建立后就不再需要了
+    resource_fd = -1;
 
-    snprintf(path, sizeof(path), "/dev/uio0");
+    snprintf(path, sizeof(path), "/dev/uio%d", uio_index);
     uio_fd = open(path, O_RDWR);
     if (uio_fd < 0)
         goto error;
 
-    snprintf(path, sizeof(path), "/sys/class/uio/uio0/device/config");
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/config", pci_id);
     config_fd = open(path, O_RDWR);
     if (config_fd < 0)
         goto error;
@@ -97,11 +134,75 @@ error:
         close(uio_fd);
     if (config_fd >= 0)
         close(config_fd);
+    if (dev && dev->hw_addr && dev->hw_addr != MAP_FAILED)
+        munmap(dev->hw_addr, E1000_BAR_SIZE);
     if (dev)
         free(dev);
     return NULL;
 }
 
+/**
+ * @brief 通过pci_id获取e1000设备，并加入设备表
+ * 
+ * @param pci_id: 0000:02:02.0，或者 emu[N][:<pcap文件>] 表示软件模拟的设备
+ */
+struct e1000_device *e1000_device_get(const char *pci_id)
+{
+    struct e1000_device *dev;
+
+    if (e1000_nr_devices >= E1000_MAX_DEVICES) {
+        printf("too many devices, max %d\n", E1000_MAX_DEVICES);
+        return NULL;
+    }
+    for (int i = 0; i < e1000_nr_devices; i++) {
+        if (strncmp(e1000_devices[i]->name, pci_id, PCI_PRI_STR_SIZE - 1) == 0) {
+            printf("%s is already opened\n", pci_id);
+            return NULL;
+        }
+    }
+
+    // 模拟设备使用IOVA-as-VA，不能和真实网卡混用
+    if (e1000_nr_devices > 0 && e1000_is_emu(pci_id) != e1000_is_emu(e1000_devices[0]->name)) {
+        printf("can not mix emulated and pci devices\n");
+        return NULL;
+    }
+
+    if (e1000_is_emu(pci_id))
+        dev = e1000_emu_device_get(pci_id);
+    else
+        dev = e1000_pci_device_get(pci_id);
+    if (!dev)
+        return NULL;
+
+    dev->port_id = e1000_nr_devices;
+    e1000_devices[e1000_nr_devices++] = dev;
+    return dev;
+}
+
+int e1000_device_count(void)
+{
+    return e1000_nr_devices;
+}
+
+struct e1000_device *e1000_device_at(int port_id)
+{
+    if (port_id < 0 || port_id >= e1000_nr_devices)
+        return NULL;
+    return e1000_devices[port_id];
+}
+
+/**
+ * @brief 估算一个设备需要的DMA内存：两个描述符环和缓冲池
+ * 
+ * 按最坏情况每个报文缓冲区占一个4K页估算，用于dma_mem_init()。
+ */
+size_t e1000_dma_mem_size(uint16_t rx_nr, uint16_t tx_nr)
+{
+    size_t rings = (rx_nr + tx_nr) * sizeof(struct rx_desc_t) + 2 * E1000_DESC_ALIGN;
+    size_t bufs = (size_t)(rx_nr + tx_nr + E1000_POOL_EXTRA) * 4096;
+    return rings + bufs;
+}
+
 static void e1000_eeprome_detect(struct e1000_device *dev)
 {
     uint32_t *hw = (uint32_t *)dev->hw_addr;
@@ -145,7 +246,7 @@ static void e1000_read_mac(struct e1000_device *dev)
     uint16_t val = 0;
 
     if (dev->eeprom == 0) {
-        char *mac = (char *)hw + 0x5400;
+        char *mac = (char *)hw + E1000_RAL0;
         for (int i = 0; i < 6; i++)
             dev->mac_addr[i] = mac[i];
     } else {
@@ -158,17 +259,51 @@ static void e1000_read_mac(struct e1000_device *dev)
     return;
 }
 
-static void e1000_init_multicast(struct e1000_device *dev)
+static void e1000_rar_set(struct e1000_device *dev, int index, const uint8_t *addr, int valid)
 {
-    uint32_t *hw = (uint32_t *)dev->hw_addr;
-    for (int i = E1000_MAT0; i < E1000_MAT1; i += 4)
-        E1000_WRITE_REG(hw, i, 0);
+    uint32_t ral = addr[0] | addr[1] << 8 | addr[2] << 16 | (uint32_t)addr[3] << 24;
+    uint32_t rah = addr[4] | addr[5] << 8;
+    // 先清掉AV，网卡不会用到写了一半的地址
+    E1000_WRITE_REG(dev->hw_addr, E1000_RAH0 + index * 8, 0);
+    E1000_WRITE_REG(dev->hw_addr, E1000_RAL0 + index * 8, ral);
+    E1000_WRITE_REG(dev->hw_addr, E1000_RAH0 + index * 8, valid ? rah | E1000_RAH_AV : rah);
+}
+
+/**
+ * @brief 把接收地址过滤写回网卡：RAR0是本网卡的地址，RAR1~15和MTA来自副本
+ */
+static void e1000_rx_filter_init(struct e1000_device *dev)
+{
+    static const uint8_t zero[6];
+    e1000_rar_set(dev, 0, dev->mac_addr, 1);
+    for (int i = 1; i < E1000_RAR_ENTRIES; i++) {
+        int valid = memcmp(dev->uc_addrs[i], zero, 6) != 0;
+        e1000_rar_set(dev, i, dev->uc_addrs[i], valid);
+    }
+    for (int i = 0; i < E1000_MTA_SIZE; i++)
+        E1000_WRITE_REG(dev->hw_addr, E1000_MTA + i * 4, dev->mta[i]);
+}
+
+/**
+ * @brief 把VLAN设置写回网卡：VET、过滤表和CTRL.VME，RCTL.VFE在设置RCTL时写
+ */
+static void e1000_vlan_init(struct e1000_device *dev)
+{
+    E1000_WRITE_REG(dev->hw_addr, E1000_VET, E1000_VLAN_ETHERTYPE);
+    for (int i = 0; i < E1000_VFTA_SIZE; i++)
+        E1000_WRITE_REG(dev->hw_addr, E1000_VFTA + i * 4, dev->vfta[i]);
+    uint32_t ctrl = E1000_READ_REG(dev->hw_addr, E1000_CTRL);
+    if (dev->vlan_strip)
+        ctrl |= CTRL_VME;
+    else
+        ctrl &= ~CTRL_VME;
+    E1000_WRITE_REG(dev->hw_addr, E1000_CTRL, ctrl);
 }
 
 static void e1000_intr_disable(struct e1000_device *dev)
 {
     uint32_t *hw = (uint32_t *)dev->hw_addr;
-    E1000_WRITE_REG(hw, E1000_IMC, 0);
+    E1000_WRITE_REG(hw, E1000_IMC, 0xFFFFFFFF);
 }
 
 void e1000_intr_handler(struct e1000_device *dev)
@@ -214,8 +349,103 @@ static void *e1000_intr_listen(void *arg)
     }
 }
 
+static uint64_t e1000_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 定时器寄存器的单位是1.024us
+#define E1000_DELAY_UNITS(us) ((uint32_t)((uint64_t)(us) * 1000 / 1024))
+
+/**
+ * 自动中断调节的档位，和Linux e1000驱动的lowest/low/bulk latency类似：
+ * 报文速率低时每个报文都尽快产生中断，速率越高中断间隔越大。
+ */
+static const struct {
+    uint64_t max_pps;
+    struct e1000_intr_mod mod;
+} itr_levels[] = {
+    {10000,      {14000,  0,  0,   0, 0}},   // 最多约70000次中断每秒
+    {100000,     {50000,  8,  32,  8, 32}},  // 最多20000次中断每秒
+    {UINT64_MAX, {250000, 32, 128, 32, 128}}, // 最多4000次中断每秒
+};
+
+/**
+ * @brief 设置中断调节参数
+ */
+void e1000_intr_mod_set(struct e1000_device *dev, const struct e1000_intr_mod *mod)
+{
+    dev->intr_mod = *mod;
+    E1000_WRITE_REG(dev->hw_addr, E1000_ITR, mod->itr_ns / 256);
+    E1000_WRITE_REG(dev->hw_addr, E1000_RDTR, E1000_DELAY_UNITS(mod->rdtr_us));
+    E1000_WRITE_REG(dev->hw_addr, E1000_RADV, E1000_DELAY_UNITS(mod->radv_us));
+    E1000_WRITE_REG(dev->hw_addr, E1000_TIDV, E1000_DELAY_UNITS(mod->tidv_us));
+    E1000_WRITE_REG(dev->hw_addr, E1000_TADV, E1000_DELAY_UNITS(mod->tadv_us));
+}
+
+void e1000_intr_mod_get(struct e1000_device *dev, struct e1000_intr_mod *mod)
+{
+    *mod = dev->intr_mod;
+}
+
+/**
+ * @brief 打开或关闭自动中断调节
+ * 
+ * 打开后e1000_rx_poll()每E1000_ITR_UPDATE_NS统计一次接收速率，按itr_levels选择参数。
+ */
+void e1000_intr_mod_auto(struct e1000_device *dev, int enable)
+{
+    dev->intr_mod_auto = enable;
+    dev->itr_level = 0;
+    dev->itr_pkts = 0;
+    dev->itr_start_ns = 0;
+    if (enable)
+        e1000_intr_mod_set(dev, &itr_levels[0].mod);
+}
+
+/**
+ * @param now: 当前时间，e1000_rx_poll()每次调用都会取
+ */
+static void e1000_intr_mod_update(struct e1000_device *dev, int nb_rx, uint64_t now)
+{
+    dev->itr_pkts += nb_rx;
+    if (dev->itr_start_ns == 0)
+        dev->itr_start_ns = now;
+    if (now - dev->itr_start_ns < E1000_ITR_UPDATE_NS)
+        return;
+
+    uint64_t pps = dev->itr_pkts * 1000000000ULL / (now - dev->itr_start_ns);
+    int level = 0;
+    while (pps > itr_levels[level].max_pps)
+        level++;
+    if (level != dev->itr_level) {
+        dev->itr_level = level;
+        e1000_intr_mod_set(dev, &itr_levels[level].mod);
+    }
+    dev->itr_pkts = 0;
+    dev->itr_start_ns = now;
+}
+
 static void e1000_intr_init(struct e1000_device *dev)
 {
+    struct e1000_intr_mod mod = {0};
+    e1000_intr_mod_set(dev, &mod);
+    dev->intr_mod_auto = 0;
+
+    dev->epoll_fd = -1;
+    dev->idle_budget_us = E1000_IDLE_BUDGET_US;
+    memset(&dev->poll_stats, 0, sizeof(dev->poll_stats));
+    dev->poll_last_ns = 0;
+    if (dev->uio_fd >= 0) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = dev->uio_fd;
+        dev->epoll_fd = epoll_create(1);
+        epoll_ctl(dev->epoll_fd, EPOLL_CTL_ADD, dev->uio_fd, &event);
+    }
+
     uint32_t flags = 0;
     // flags |= IM_RXT0 | IM_RXO | IM_RXDMT0 | IM_RXSEQ | IM_LSC;
     flags |= IM_LSC;
@@ -232,14 +462,16 @@ static int e1000_rx_desc_init(struct e1000_device *dev)
 {
     void *addr = NULL;
     dev->rx_cur = 0;
+    dev->rx_seg_head = NULL;
+    dev->rx_seg_tail = NULL;
 
-    addr = alloc_page();
+    addr = dma_alloc(dev->rx_nr * sizeof(struct rx_desc_t), E1000_DESC_ALIGN);
     if (!addr) {
-        printf("alloc_page failed\n");
+        printf("dma_alloc failed\n");
         return -1;
     }
     dev->rx_desc = addr;
-    memset(addr, 0, RX_DESC_NR * sizeof(struct rx_desc_t));
+    memset(addr, 0, dev->rx_nr * sizeof(struct rx_desc_t));
 
     // 接收描述符地址
     struct rx_desc_t *rx_desc_phys_addr = (struct rx_desc_t *)virt_to_phys(addr);
@@ -247,29 +479,41 @@ static int e1000_rx_desc_init(struct e1000_device *dev)
     E1000_WRITE_REG(dev->hw_addr, E1000_RDBAH, (uint32_t)((uint64_t)rx_desc_phys_addr >> 32));
 
     // 接收描述符长度
-    E1000_WRITE_REG(dev->hw_addr, E1000_RDLEN, RX_DESC_NR * sizeof(struct rx_desc_t));
+    E1000_WRITE_REG(dev->hw_addr, E1000_RDLEN, dev->rx_nr * sizeof(struct rx_desc_t));
 
     // 接收描述符头尾索引
     E1000_WRITE_REG(dev->hw_addr, E1000_RDH, 0);
-    E1000_WRITE_REG(dev->hw_addr, E1000_RDT, RX_DESC_NR - 1);
+    E1000_WRITE_REG(dev->hw_addr, E1000_RDT, dev->rx_nr - 1);
 
-    for (int i = 0; i < RX_DESC_NR; i++) {
-        addr = alloc_page();
-        if (!addr) {
-            printf("alloc_page failed\n");
+    // 每个接收描述符挂一个报文缓冲区
+    for (int i = 0; i < dev->rx_nr; i++) {
+        struct pktbuf *pkt = pktbuf_alloc(dev->pool);
+        if (!pkt) {
+            printf("pktbuf_alloc failed\n");
             return -1;
         }
-        struct rx_desc_t *virt = phys_to_virt(rx_desc_phys_addr);
-        virt[i].addr = (uint64_t)virt_to_phys(addr);
-        virt[i].length = 2048;
-        virt[i].status = 0;
+        dev->rx_bufs[i] = pkt;
+        dev->rx_desc[i].addr = pktbuf_data_phys(pkt);
+        dev->rx_desc[i].length = 0;
+        dev->rx_desc[i].status = 0;
     }
 
-    // 寄存器设置
+    // 硬件检查IPv4和TCP/UDP校验和，结果写在描述符的status/error里
+    E1000_WRITE_REG(dev->hw_addr, E1000_RXCSUM, RXCSUM_IPOFLD | RXCSUM_TUOFLD | (14 << RXCSUM_PCSS));
+
+    // 寄存器设置，目的地址不匹配和有错误的帧由网卡丢弃，不占用描述符
     uint32_t flags = 0;
-    flags |= RCTL_EN | RCTL_SBP | RCTL_UPE;
-    flags |= RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF;
+    flags |= RCTL_EN | RCTL_LBM_NONE | RTCL_RDMTS_HALF;
     flags |= RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_2048;
+    if (dev->promisc)
+        flags |= RCTL_UPE | RCTL_MPE;
+    else if (dev->allmulti)
+        flags |= RCTL_MPE;
+    // 缓冲区固定2K，长帧由网卡拆到多个描述符里
+    if (dev->max_frame > E1000_MTU_DEFAULT + E1000_FRAME_OVERHEAD)
+        flags |= RCTL_LPE;
+    if (dev->vlan_filter)
+        flags |= RCTL_VFE;
 
     E1000_WRITE_REG(dev->hw_addr, E1000_RCTL, flags);
     return 0;
@@ -278,15 +522,17 @@ static int e1000_rx_desc_init(struct e1000_device *dev)
 static int e1000_tx_desc_init(struct e1000_device *dev)
 {
     void *addr = NULL;
-    dev->rx_cur = 0;
+    dev->tx_cur = 0;
+    dev->tx_clean = 0;
+    dev->tx_free = dev->tx_nr - 1; // TDT追上TDH会被当成空队列，所以要留一个
 
-    addr = alloc_page();
+    addr = dma_alloc(dev->tx_nr * sizeof(struct tx_desc_t), E1000_DESC_ALIGN);
     if (!addr) {
-        printf("alloc_page failed\n");
+        printf("dma_alloc failed\n");
         return -1;
     }
     dev->tx_desc = addr;
-    memset(addr, 0, TX_DESC_NR * sizeof(struct tx_desc_t));
+    memset(addr, 0, dev->tx_nr * sizeof(struct tx_desc_t));
 
     // 发送描述符地址
     struct tx_desc_t *tx_desc_phys_addr = (struct tx_desc_t *)virt_to_phys(addr);
@@ -294,22 +540,18 @@ static int e1000_tx_desc_init(struct e1000_device *dev)
     E1000_WRITE_REG(dev->hw_addr, E1000_TDBAH, (uint32_t)((uint64_t)tx_desc_phys_addr >> 32));
 
     // 发送描述符长度
-    E1000_WRITE_REG(dev->hw_addr, E1000_TDLEN, TX_DESC_NR * sizeof(struct tx_desc_t));
+    E1000_WRITE_REG(dev->hw_addr, E1000_TDLEN, dev->tx_nr * sizeof(struct tx_desc_t));
 
     // 发送描述符头尾索引
     E1000_WRITE_REG(dev->hw_addr, E1000_TDH, 0);
     E1000_WRITE_REG(dev->hw_addr, E1000_TDT, 0);
 
-    for (int i = 0; i < TX_DESC_NR; i++) {
-        addr = alloc_page();
-        if (!addr) {
-            printf("alloc_page failed\n");
-            return -1;
-        }
-        struct tx_desc_t *virt = phys_to_virt(tx_desc_phys_addr);
-        virt[i].addr = (uint64_t)virt_to_phys(addr);
-        virt[i].cmd = 0;
-        virt[i].status = TS_DD;
+    // 发送描述符在发送时才挂上报文缓冲区
+    for (int i = 0; i < dev->tx_nr; i++) {
+        dev->tx_bufs[i] = NULL;
+        dev->tx_desc[i].addr = 0;
+        dev->tx_desc[i].cmd = 0;
+        dev->tx_desc[i].status = TS_DD;
     }
 
     // 寄存器设置
@@ -322,81 +564,1050 @@ static int e1000_tx_desc_init(struct e1000_device *dev)
     return 0;
 }
 
-static void e1000_reset(struct e1000_device *dev)
+static int e1000_reset(struct e1000_device *dev)
 {
     e1000_eeprome_detect(dev);
 
     e1000_read_mac(dev);
 
-    e1000_init_multicast(dev);
+    e1000_rx_filter_init(dev);
+
+    e1000_vlan_init(dev);
 
     e1000_intr_disable(dev);
 
-    e1000_rx_desc_init(dev);
+    if (e1000_rx_desc_init(dev) < 0)
+        return -1;
 
-    e1000_tx_desc_init(dev);
+    if (e1000_tx_desc_init(dev) < 0)
+        return -1;
 
     e1000_intr_init(dev);
+    return 0;
+}
+
+#define STAT32(reg, field) {reg, offsetof(struct e1000_hw_stats, field), 0}
+#define STAT64(reg, field) {reg, offsetof(struct e1000_hw_stats, field), 1}
+
+static const struct {
+    uint32_t reg;
+    size_t offset; // 在struct e1000_hw_stats中的偏移
+    int is64;
+} hw_stats_regs[] = {
+    STAT32(E1000_CRCERRS, crcerrs),   STAT32(E1000_ALGNERRC, algnerrc),
+    STAT32(E1000_SYMERRS, symerrs),   STAT32(E1000_RXERRC, rxerrc),
+    STAT32(E1000_MPC, mpc),           STAT32(E1000_SCC, scc),
+    STAT32(E1000_ECOL, ecol),         STAT32(E1000_MCC, mcc),
+    STAT32(E1000_LATECOL, latecol),   STAT32(E1000_COLC, colc),
+    STAT32(E1000_DC, dc),             STAT32(E1000_TNCRS, tncrs),
+    STAT32(E1000_SEC, sec),           STAT32(E1000_CEXTERR, cexterr),
+    STAT32(E1000_RLEC, rlec),         STAT32(E1000_XONRXC, xonrxc),
+    STAT32(E1000_XONTXC, xontxc),     STAT32(E1000_XOFFRXC, xoffrxc),
+    STAT32(E1000_XOFFTXC, xofftxc),   STAT32(E1000_FCRUC, fcruc),
+    STAT32(E1000_GPRC, gprc),         STAT32(E1000_BPRC, bprc),
+    STAT32(E1000_MPRC, mprc),         STAT32(E1000_GPTC, gptc),
+    STAT64(E1000_GORCL, gorc),        STAT64(E1000_GOTCL, gotc),
+    STAT32(E1000_RNBC, rnbc),         STAT32(E1000_RUC, ruc),
+    STAT32(E1000_RFC, rfc),           STAT32(E1000_ROC, roc),
+    STAT32(E1000_RJC, rjc),           STAT64(E1000_TORL, tor),
+    STAT64(E1000_TOTL, tot),          STAT32(E1000_TPR, tpr),
+    STAT32(E1000_TPT, tpt),           STAT32(E1000_MPTC, mptc),
+    STAT32(E1000_BPTC, bptc),
+};
+
+/**
+ * @brief 读一遍统计寄存器累加到hw_stats，调用者需要持有stats_lock
+ */
+static void e1000_stats_sample(struct e1000_device *dev)
+{
+    for (size_t i = 0; i < sizeof(hw_stats_regs) / sizeof(hw_stats_regs[0]); i++) {
+        uint64_t val = E1000_READ_REG(dev->hw_addr, hw_stats_regs[i].reg);
+        if (hw_stats_regs[i].is64)
+            val |= (uint64_t)E1000_READ_REG(dev->hw_addr, hw_stats_regs[i].reg + 4) << 32;
+        *(uint64_t *)((char *)&dev->hw_stats + hw_stats_regs[i].offset) += val;
+    }
 }
 
-int e1000_init(struct e1000_device *dev)
+static void *e1000_stats_thread(void *arg)
 {
-    e1000_reset(dev);
+    struct e1000_device *dev = (struct e1000_device *)arg;
+    while (dev->stats_running) {
+        pthread_mutex_lock(&dev->stats_lock);
+        e1000_stats_sample(dev);
+        pthread_mutex_unlock(&dev->stats_lock);
+        // 分段睡眠，停止时不用等一个完整的周期
+        for (uint32_t ms = 0; ms < dev->stats_interval_ms && dev->stats_running; ms += 10)
+            usleep(10000);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 启动统计采样线程
+ * 
+ * 32位的统计寄存器在千兆线速下大约45分钟就会溢出，采样间隔要远小于这个时间。
+ * 
+ * @param interval_ms: 采样间隔
+ */
+int e1000_stats_start(struct e1000_device *dev, uint32_t interval_ms)
+{
+    if (dev->stats_running)
+        return 0;
+    dev->stats_interval_ms = interval_ms;
+    dev->stats_running = 1;
+    if (pthread_create(&dev->stats_tid, NULL, e1000_stats_thread, dev) != 0) {
+        dev->stats_running = 0;
+        printf("pthread_create failed\n");
+        return -1;
+    }
     return 0;
 }
 
-int e1000_recv(struct e1000_device *dev, char *buf, size_t len)
+void e1000_stats_stop(struct e1000_device *dev)
 {
-    struct rx_desc_t *desc;
-    int count = 0;
-    while (1) {
-        desc = &dev->rx_desc[dev->rx_cur];
-        if ((desc->status & RS_DD) == 0) {
-            usleep(10);
+    if (!dev->stats_running)
+        return;
+    dev->stats_running = 0;
+    pthread_join(dev->stats_tid, NULL);
+}
+
+/**
+ * @brief 获取统计
+ * 
+ * 会先采样一次硬件寄存器，保证读到的是最新值。
+ */
+void e1000_stats_get(struct e1000_device *dev, struct e1000_stats *stats)
+{
+    pthread_mutex_lock(&dev->stats_lock);
+    e1000_stats_sample(dev);
+    stats->hw = dev->hw_stats;
+    pthread_mutex_unlock(&dev->stats_lock);
+    stats->rx = dev->rx_stats;
+    stats->tx = dev->tx_stats;
+}
+
+static int e1000_ring_size_valid(uint16_t nr)
+{
+    return nr >= E1000_DESC_MIN && nr <= E1000_DESC_MAX && (nr & (nr - 1)) == 0;
+}
+
+/**
+ * @brief 初始化设备
+ * 
+ * @param rx_nr: 接收描述符个数，2的幂，E1000_DESC_MIN~E1000_DESC_MAX
+ * @param tx_nr: 发送描述符个数，2的幂，E1000_DESC_MIN~E1000_DESC_MAX
+ */
+int e1000_init(struct e1000_device *dev, uint16_t rx_nr, uint16_t tx_nr)
+{
+    if (!e1000_ring_size_valid(rx_nr) || !e1000_ring_size_valid(tx_nr)) {
+        printf("invalid ring size %u/%u, must be a power of 2 in [%d, %d]\n",
+               rx_nr, tx_nr, E1000_DESC_MIN, E1000_DESC_MAX);
+        return -1;
+    }
+    dev->rx_nr = rx_nr;
+    dev->rx_mask = rx_nr - 1;
+    dev->tx_nr = tx_nr;
+    dev->tx_mask = tx_nr - 1;
+    e1000_tx_set_free_thresh(dev, dev->tx_free_thresh);
+    if (dev->max_frame == 0)
+        dev->max_frame = E1000_MTU_DEFAULT + E1000_FRAME_OVERHEAD;
+
+    memset(&dev->rx_stats, 0, sizeof(dev->rx_stats));
+    memset(&dev->tx_stats, 0, sizeof(dev->tx_stats));
+    memset(&dev->hw_stats, 0, sizeof(dev->hw_stats));
+    pthread_mutex_init(&dev->stats_lock, NULL);
+    dev->stats_running = 0;
+
+    dev->rx_bufs = calloc(rx_nr, sizeof(struct pktbuf *));
+    dev->tx_bufs = calloc(tx_nr, sizeof(struct pktbuf *));
+    if (!dev->rx_bufs || !dev->tx_bufs) {
+        printf("calloc failed\n");
+        return -1;
+    }
+
+    // 除了挂在两个环上的缓冲区，还要留一些给应用和各线程的缓存
+    dev->pool = pktbuf_pool_create(rx_nr + tx_nr + E1000_POOL_EXTRA);
+    if (!dev->pool) {
+        printf("pktbuf_pool_create failed\n");
+        return -1;
+    }
+    if (e1000_reset(dev) < 0)
+        return -1;
+
+    // 清掉复位前累计的统计寄存器
+    e1000_stats_sample(dev);
+    memset(&dev->hw_stats, 0, sizeof(dev->hw_stats));
+    return 0;
+}
+
+/**
+ * @brief 设置MTU，超过1500时打开长帧接收
+ * 
+ * 可以在e1000_init()之前或之后调用。接收缓冲区仍然是2K，
+ * 长帧由网卡拆到多个描述符里，驱动把各段串成一个报文。
+ */
+int e1000_set_mtu(struct e1000_device *dev, uint16_t mtu)
+{
+    if (mtu < 68 || mtu > E1000_MTU_MAX) {
+        printf("invalid mtu %u, must be in [68, %d]\n", mtu, E1000_MTU_MAX);
+        return -1;
+    }
+    dev->max_frame = mtu + E1000_FRAME_OVERHEAD;
+    if (dev->rx_desc) {
+        uint32_t rctl = E1000_READ_REG(dev->hw_addr, E1000_RCTL);
+        if (mtu > E1000_MTU_DEFAULT)
+            rctl |= RCTL_LPE;
+        else
+            rctl &= ~RCTL_LPE;
+        E1000_WRITE_REG(dev->hw_addr, E1000_RCTL, rctl);
+    }
+    return 0;
+}
+
+/**
+ * @brief 按promisc/allmulti更新RCTL的UPE和MPE
+ */
+static void e1000_rctl_update_promisc(struct e1000_device *dev)
+{
+    if (!dev->rx_desc)
+        return;
+    uint32_t rctl = E1000_READ_REG(dev->hw_addr, E1000_RCTL);
+    rctl &= ~(RCTL_UPE | RCTL_MPE);
+    if (dev->promisc)
+        rctl |= RCTL_UPE | RCTL_MPE;
+    else if (dev->allmulti)
+        rctl |= RCTL_MPE;
+    E1000_WRITE_REG(dev->hw_addr, E1000_RCTL, rctl);
+}
+
+/**
+ * @brief 打开或关闭混杂模式，打开后接收所有单播和组播帧
+ * 
+ * 默认关闭：网卡只接收目的地址是RAR里的单播地址、MTA里的组播地址或者广播的帧。
+ * 可以在e1000_init()之前或之后调用。
+ */
+void e1000_promisc(struct e1000_device *dev, int enable)
+{
+    dev->promisc = !!enable;
+    e1000_rctl_update_promisc(dev);
+}
+
+/**
+ * @brief 打开或关闭接收所有组播帧，不影响单播过滤
+ */
+void e1000_allmulti(struct e1000_device *dev, int enable)
+{
+    dev->allmulti = !!enable;
+    e1000_rctl_update_promisc(dev);
+}
+
+/**
+ * @brief 添加一个精确匹配的单播地址，占用一个空闲的RAR
+ * 
+ * @return 成功或者地址已经存在返回0，RAR用完返回-1
+ */
+int e1000_mac_addr_add(struct e1000_device *dev, const uint8_t *addr)
+{
+    static const uint8_t zero[6];
+    int index = -1;
+
+    if (addr[0] & 1) {
+        printf("%02x:%02x:%02x:%02x:%02x:%02x is not a unicast address\n",
+               addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+        return -1;
+    }
+    if (memcmp(addr, zero, 6) == 0)
+        return -1;
+    if (memcmp(addr, dev->mac_addr, 6) == 0)
+        return 0;
+    for (int i = 1; i < E1000_RAR_ENTRIES; i++) {
+        if (memcmp(dev->uc_addrs[i], addr, 6) == 0)
+            return 0;
+        if (index < 0 && memcmp(dev->uc_addrs[i], zero, 6) == 0)
+            index = i;
+    }
+    if (index < 0) {
+        printf("no free receive address register, max %d\n", E1000_RAR_ENTRIES - 1);
+        return -1;
+    }
+    memcpy(dev->uc_addrs[index], addr, 6);
+    if (dev->rx_desc)
+        e1000_rar_set(dev, index, addr, 1);
+    return 0;
+}
+
+/**
+ * @brief 删除e1000_mac_addr_add()添加的单播地址
+ */
+int e1000_mac_addr_remove(struct e1000_device *dev, const uint8_t *addr)
+{
+    for (int i = 1; i < E1000_RAR_ENTRIES; i++) {
+        if (memcmp(dev->uc_addrs[i], addr, 6) != 0)
             continue;
+        memset(dev->uc_addrs[i], 0, 6);
+        if (dev->rx_desc)
+            e1000_rar_set(dev, i, dev->uc_addrs[i], 0);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief 用addrs替换要接收的组播地址
+ * 
+ * 组播地址按12位哈希放进MTA，哈希冲突的其它组播地址也会被网卡收下，
+ * 上层需要自己再按地址过滤。n为0时不接收任何组播（allmulti除外）。
+ */
+int e1000_set_mc_addr_list(struct e1000_device *dev, const uint8_t (*addrs)[6], int n)
+{
+    uint32_t mta[E1000_MTA_SIZE] = {0};
+    for (int i = 0; i < n; i++) {
+        if ((addrs[i][0] & 1) == 0) {
+            printf("%02x:%02x:%02x:%02x:%02x:%02x is not a multicast address\n",
+                   addrs[i][0], addrs[i][1], addrs[i][2], addrs[i][3], addrs[i][4], addrs[i][5]);
+            return -1;
+        }
+        uint16_t hash = e1000_mta_hash(addrs[i]);
+        mta[hash >> 5] |= 1U << (hash & 0x1f);
+    }
+    memcpy(dev->mta, mta, sizeof(mta));
+    if (dev->rx_desc) {
+        for (int i = 0; i < E1000_MTA_SIZE; i++)
+            E1000_WRITE_REG(dev->hw_addr, E1000_MTA + i * 4, dev->mta[i]);
+    }
+    return 0;
+}
+
+/**
+ * @brief 打开或关闭VLAN剥离和插入(CTRL.VME)
+ * 
+ * 打开后网卡把接收报文的802.1Q标签剥离到vlan_tci，报文标志里有PKTBUF_RX_VLAN_STRIPPED；
+ * 发送时设置了PKTBUF_TX_VLAN的报文由网卡插入vlan_tci。关闭时网卡也不会插入标签。
+ * 可以在e1000_init()之前或之后调用。
+ */
+void e1000_vlan_strip(struct e1000_device *dev, int enable)
+{
+    dev->vlan_strip = !!enable;
+    if (dev->rx_desc)
+        e1000_vlan_init(dev);
+}
+
+/**
+ * @brief 打开或关闭VLAN过滤(RCTL.VFE)
+ * 
+ * 打开后VLAN ID不在过滤表里的带标签报文由网卡直接丢弃，不带标签的报文不受影响。
+ */
+void e1000_vlan_filter(struct e1000_device *dev, int enable)
+{
+    dev->vlan_filter = !!enable;
+    if (dev->rx_desc) {
+        uint32_t rctl = E1000_READ_REG(dev->hw_addr, E1000_RCTL);
+        if (enable)
+            rctl |= RCTL_VFE;
+        else
+            rctl &= ~RCTL_VFE;
+        E1000_WRITE_REG(dev->hw_addr, E1000_RCTL, rctl);
+    }
+}
+
+/**
+ * @brief 在VLAN过滤表里加入或删除一个VLAN ID
+ * 
+ * 过滤表有4096位，VLAN ID的高7位选择寄存器，低5位选择其中的一位。
+ */
+int e1000_vlan_filter_set(struct e1000_device *dev, uint16_t vid, int on)
+{
+    if (vid >= 4096) {
+        printf("invalid vlan id %u\n", vid);
+        return -1;
+    }
+    uint32_t idx = vid >> 5;
+    uint32_t bit = 1U << (vid & 0x1f);
+    if (on)
+        dev->vfta[idx] |= bit;
+    else
+        dev->vfta[idx] &= ~bit;
+    if (dev->rx_desc)
+        E1000_WRITE_REG(dev->hw_addr, E1000_VFTA + idx * 4, dev->vfta[idx]);
+    return 0;
+}
+
+/**
+ * @brief 把描述符里的校验和结果和VLAN标记转换成pktbuf的接收标志
+ */
+static inline uint64_t e1000_rx_ol_flags(struct e1000_device *dev, uint8_t status, uint8_t error)
+{
+    uint64_t flags = 0;
+    if (status & RS_VP)
+        flags |= dev->vlan_strip ? PKTBUF_RX_VLAN | PKTBUF_RX_VLAN_STRIPPED : PKTBUF_RX_VLAN;
+    if (status & RS_IXSM)
+        return flags;
+    if (status & RS_IPCS)
+        flags |= (error & RE_IPE) ? PKTBUF_RX_IP_CKSUM_BAD : PKTBUF_RX_IP_CKSUM_GOOD;
+    if (status & RS_L4CS)
+        flags |= (error & RE_TCPE) ? PKTBUF_RX_L4_CKSUM_BAD : PKTBUF_RX_L4_CKSUM_GOOD;
+    if (status & RS_UDPCS)
+        flags |= PKTBUF_RX_UDP;
+    return flags;
+}
+
+/**
+ * @brief 处理rx_cur开始的nb_done个描述符之前，预取后面要用到的内存
+ * 
+ * 下一行描述符和挂在上面的pktbuf结构提前一组取，处理时不用等；
+ * 这一组报文的pktbuf在上一组时已经取过，可以直接读出数据地址预取报文首部，
+ * 上层拿到报文时首部已经在缓存里。
+ */
+static inline void e1000_rx_prefetch(struct e1000_device *dev, uint16_t rx_cur, int nb_done)
+{
+    uint16_t next = (rx_cur + nb_done) & dev->rx_mask;
+    E1000_PREFETCH(&dev->rx_desc[next]);
+    for (int i = 0; i < E1000_DESC_PER_LINE; i++)
+        E1000_PREFETCH_W(dev->rx_bufs[(next + i) & dev->rx_mask]);
+    for (int i = 0; i < nb_done; i++)
+        E1000_PREFETCH(pktbuf_data(dev->rx_bufs[(rx_cur + i) & dev->rx_mask]));
+}
+
+/**
+ * @brief 把缓冲区地址填回描述符，状态等字段一起清零
+ * 
+ * 整个描述符一次写回，不逐字节写状态。
+ */
+static inline void e1000_rx_desc_refill(struct rx_desc_t *desc, uint64_t addr)
+{
+    *desc = (struct rx_desc_t){ .addr = addr };
+}
+
+/**
+ * @brief 批量接收报文
+ * 
+ * 一次扫描最多n个已完成的接收描述符，全部处理完后只写一次RDT。
+ * 描述符由e1000_rx_scan()成组检查（SSE4.1/AVX2一次读多个描述符，用movemask取出DD/EOP/错误位），
+ * 长度和状态集中到meta数组里；处理一组之前预取下一行描述符和pktbuf，以及这一组报文的首部。
+ * 描述符上的报文缓冲区直接交给调用者，再从缓冲池取一个新的挂回描述符，
+ * 调用者用完后需要调用pktbuf_free()释放。
+ * 接收队列为空时立即返回0，不会睡眠。
+ * 硬件的校验和检查结果和VLAN标签放在ol_flags/vlan_tci里，
+ * 校验和错误的报文照常返回。CRC等帧错误的报文默认由网卡丢弃（没有打开RCTL_SBP），
+ * 万一交给了驱动也计入drops后丢弃。
+ * 超过2K的长帧占用多个描述符，各段用next串起来，直到EOP才作为一个报文返回；
+ * 还没收到EOP的段留在rx_seg_head里，下次调用继续组装。
+ * 
+ * @return 收到的报文个数
+ */
+int e1000_rx_burst(struct e1000_device *dev, struct pktbuf **pkts, int n)
+{
+    struct e1000_rx_meta meta[E1000_RX_SCAN_MAX];
+    uint16_t rx_cur = dev->rx_cur;
+    uint64_t bytes = 0;
+    int nb_rx = 0;
+
+    while (nb_rx < n) {
+        // 一次扫描不跨过环的末尾
+        int max = MIN(MIN(n - nb_rx, E1000_RX_SCAN_MAX), dev->rx_nr - rx_cur);
+        uint32_t eop, err;
+        int nb_done = e1000_rx_scan(&dev->rx_desc[rx_cur], max, meta, &eop, &err);
+        if (nb_done == 0)
+            break;
+        e1000_rx_prefetch(dev, rx_cur, nb_done);
+
+        for (int i = 0; i < nb_done; i++) {
+            struct rx_desc_t *desc = &dev->rx_desc[rx_cur];
+            const struct e1000_rx_meta *d = &meta[i];
+            int is_eop = eop >> i & 1;
+            // 单个描述符的坏帧直接丢弃，缓冲区留在描述符上重新使用
+            if (is_eop && !dev->rx_seg_head && (err >> i & 1)) {
+                dev->rx_stats.drops++;
+                e1000_rx_desc_refill(desc, desc->addr);
+                rx_cur = (rx_cur + 1) & dev->rx_mask;
+                continue;
+            }
+
+            // 缓冲池用完了，报文先留在接收队列里
+            struct pktbuf *fresh = pktbuf_alloc(dev->pool);
+            if (!fresh) {
+                dev->rx_stats.ring_full++;
+                goto out;
+            }
+
+            struct pktbuf *pkt = dev->rx_bufs[rx_cur];
+            assert(d->length <= PKTBUF_DATA_SIZE);
+            pkt->data_len = d->length;
+            pkt->pkt_len = d->length;
+
+            dev->rx_bufs[rx_cur] = fresh;
+            e1000_rx_desc_refill(desc, pktbuf_data_phys(fresh));
+            rx_cur = (rx_cur + 1) & dev->rx_mask;
+
+            // 长帧的中间段，接到正在组装的报文后面
+            if (dev->rx_seg_head || !is_eop) {
+                if (!dev->rx_seg_head) {
+                    dev->rx_seg_head = pkt;
+                } else {
+                    dev->rx_seg_tail->next = pkt;
+                    dev->rx_seg_head->nb_segs++;
+                    dev->rx_seg_head->pkt_len += pkt->data_len;
+                }
+                dev->rx_seg_tail = pkt;
+                if (!is_eop)
+                    continue;
+                // 状态和错误只在最后一个描述符里有效
+                pkt = dev->rx_seg_head;
+                dev->rx_seg_head = NULL;
+                if ((err >> i & 1) || pkt->pkt_len > dev->max_frame) {
+                    dev->rx_stats.drops++;
+                    pktbuf_free(pkt);
+                    continue;
+                }
+            }
+
+            pkt->ol_flags = e1000_rx_ol_flags(dev, d->status, d->error);
+            pkt->vlan_tci = d->special;
+            if (pkt->ol_flags & (PKTBUF_RX_IP_CKSUM_BAD | PKTBUF_RX_L4_CKSUM_BAD))
+                dev->rx_stats.cksum_errors++;
+            bytes += pkt->pkt_len;
+            pkts[nb_rx++] = pkt;
         }
-        if (desc->error) {
-            printf("receive error\n");
-            abort();
+    }
+
+out:
+    if (rx_cur == dev->rx_cur)
+        return 0;
+
+    dev->rx_stats.packets += nb_rx;
+    dev->rx_stats.bytes += bytes;
+
+    // 把处理完的描述符一次性还给网卡，RDT指向最后一个处理完的描述符
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    E1000_WRITE_REG(dev->hw_addr, E1000_RDT, (rx_cur - 1) & dev->rx_mask);
+    dev->rx_cur = rx_cur;
+    return nb_rx;
+}
+
+/**
+ * @brief 设置接收空闲预算
+ * 
+ * e1000_rx_poll()连续空转超过这个时间后，打开接收中断并阻塞等待。
+ * 
+ * @param us: 0表示一直忙轮询，不进入中断模式
+ */
+void e1000_rx_set_idle_budget(struct e1000_device *dev, uint32_t us)
+{
+    dev->idle_budget_us = us;
+}
+
+void e1000_poll_stats_get(struct e1000_device *dev, struct e1000_poll_stats *stats)
+{
+    *stats = dev->poll_stats;
+}
+
+/**
+ * @brief 打开接收中断，阻塞等待，醒来后再关掉接收中断
+ * 
+ * igb_uio在每次中断后会屏蔽中断，需要写uio设备重新打开。
+ * 打开中断之后要再检查一次接收队列，否则打开之前到达的报文不会再产生中断。
+ * 
+ * @return 醒来后收到的报文个数
+ */
+static int e1000_rx_sleep(struct e1000_device *dev, struct pktbuf **pkts, int n)
+{
+    struct epoll_event event;
+    int nb_rx;
+
+    E1000_WRITE_REG(dev->hw_addr, E1000_IMS, IM_RXT0 | IM_RXDMT0);
+    uio_intr_enable_disable(dev->uio_fd, 1);
+
+    nb_rx = e1000_rx_burst(dev, pkts, n);
+    if (nb_rx == 0) {
+        // 有的虚拟网卡不产生中断，超时后退回忙轮询
+        int ret = epoll_wait(dev->epoll_fd, &event, 1, E1000_SLEEP_TIMEOUT_MS);
+        if (ret > 0) {
+            int value = 0;
+            if (read(dev->uio_fd, &value, sizeof(value)) == sizeof(value))
+                dev->poll_stats.wakeups++;
+        } else {
+            dev->poll_stats.timeouts++;
         }
-        break;
+        nb_rx = e1000_rx_burst(dev, pkts, n);
     }
 
-    assert(desc->length < 2048);
-    char *addr = phys_to_virt((void *)desc->addr);
-    desc->status = 0;
+    E1000_WRITE_REG(dev->hw_addr, E1000_IMC, IM_RXT0 | IM_RXDMT0);
+    E1000_READ_REG(dev->hw_addr, E1000_ICR); // 读ICR清除中断原因
+    return nb_rx;
+}
 
-    int recv_len = MIN(desc->length, len);
-    memcpy(buf, addr, recv_len);
+/**
+ * @brief 自适应接收：有流量时忙轮询，空闲一段时间后切换成中断等待
+ * 
+ * 忙轮询和阻塞的时间分别累计在poll_stats里，可以据此权衡CPU占用和延迟。
+ * 两次调用之间应用处理报文的时间也算忙轮询，线程没有阻塞就一直占着CPU。
+ * 
+ * @return 收到的报文个数；空闲超过预算并且睡眠一次之后仍然没有报文时返回0，
+ *         预算为0时空转一轮就返回0，调用者可以检查退出条件
+ */
+int e1000_rx_poll(struct e1000_device *dev, struct pktbuf **pkts, int n)
+{
+    uint64_t start = e1000_now_ns();
+    uint64_t now = start;
+    uint64_t budget_ns = (uint64_t)dev->idle_budget_us * 1000;
 
-    E1000_WRITE_REG(dev->hw_addr, E1000_RDT, dev->rx_cur);
-    dev->rx_cur = (dev->rx_cur + 1) % RX_DESC_NR;
+    if (dev->poll_last_ns)
+        dev->poll_stats.busy_ns += start - dev->poll_last_ns;
+    int nb_rx = e1000_rx_burst(dev, pkts, n);
+    if (nb_rx == 0 && budget_ns != 0) {
+        while (1) {
+            nb_rx = e1000_rx_burst(dev, pkts, n);
+            if (nb_rx > 0)
+                break;
+            now = e1000_now_ns();
+            if (now - start >= budget_ns)
+                break;
+        }
+        now = e1000_now_ns();
+        dev->poll_stats.busy_ns += now - start;
+        if (nb_rx == 0 && dev->epoll_fd >= 0) {
+            nb_rx = e1000_rx_sleep(dev, pkts, n);
+            start = now;
+            now = e1000_now_ns();
+            dev->poll_stats.sleep_ns += now - start;
+            dev->poll_stats.sleeps++;
+        }
+    }
+    dev->poll_last_ns = now;
+
+    if (dev->intr_mod_auto)
+        e1000_intr_mod_update(dev, nb_rx, now);
+    return nb_rx;
+}
+
+int e1000_recv(struct e1000_device *dev, char *buf, size_t len)
+{
+    struct pktbuf *pkt;
+    while (e1000_rx_poll(dev, &pkt, 1) == 0)
+        ;
+
+    // 长帧逐段拷贝
+    size_t recv_len = 0;
+    for (struct pktbuf *seg = pkt; seg && recv_len < len; seg = seg->next) {
+        size_t n = MIN(seg->data_len, len - recv_len);
+        memcpy(buf + recv_len, pktbuf_data(seg), n);
+        recv_len += n;
+    }
+    pktbuf_free(pkt);
     return recv_len;
 }
 
+/**
+ * @brief 回收已经发送完成的描述符
+ * 
+ * 每TX_RS_THRESH个描述符中的最后一个，以及每次发送停在一组中间时的最后一个描述符
+ * 设置了RS，网卡只会回写它们的DD位。所以从tx_clean开始找下一个设置了RS的描述符，
+ * 它完成了就回收到它为止的所有描述符，并释放挂在上面的报文缓冲区。
+ * 多段报文的每一段挂在各自的描述符上，逐段释放。
+ * 
+ * @return 回收的描述符个数
+ */
+static uint16_t e1000_tx_clean(struct e1000_device *dev)
+{
+    uint16_t freed = 0;
+    uint16_t busy = dev->tx_nr - 1 - dev->tx_free;
+    while (busy > 0) {
+        uint16_t nr = 1, last = dev->tx_clean;
+        // 发送出去的描述符最后一个总是设置了RS，最多找一组
+        while (!(dev->tx_desc[last].cmd & TCMD_RS) && nr < MIN(busy, TX_RS_THRESH)) {
+            last = (last + 1) & dev->tx_mask;
+            nr++;
+        }
+        if ((dev->tx_desc[last].cmd & TCMD_RS) == 0 || (dev->tx_desc[last].status & TS_DD) == 0)
+            break;
+        for (int i = 0; i < nr; i++) {
+            uint16_t idx = (dev->tx_clean + i) & dev->tx_mask;
+            // 上下文描述符上没有挂报文
+            if (dev->tx_bufs[idx]) {
+                pktbuf_free_seg(dev->tx_bufs[idx]);
+                dev->tx_bufs[idx] = NULL;
+            }
+        }
+        dev->tx_clean = (last + 1) & dev->tx_mask;
+        dev->tx_free += nr;
+        freed += nr;
+        busy -= nr;
+    }
+    return freed;
+}
+
+/**
+ * @brief 立即回收所有已经发送完成的描述符，不管空闲描述符是否低于阈值
+ * 
+ * 发送路径只在空闲描述符不够时才回收，发送停下来后报文缓冲区会一直挂在描述符上，
+ * 需要马上归还缓冲池时调用。
+ * 
+ * @return 回收的描述符个数
+ */
+int e1000_tx_reclaim(struct e1000_device *dev)
+{
+    return e1000_tx_clean(dev);
+}
+
+/**
+ * @brief 设置发送描述符的回收阈值
+ * 
+ * e1000_tx_burst()在空闲描述符少于thresh时才从tx_clean开始批量回收，
+ * 平时不读描述符状态。阈值越大回收越频繁、每次回收得越少，
+ * 等于发送环长度减1时每次发送都回收。可以在e1000_init()之前或之后调用。
+ * 
+ * @param thresh: 0表示默认值TX_FREE_THRESH，不超过发送环的一半
+ */
+void e1000_tx_set_free_thresh(struct e1000_device *dev, uint16_t thresh)
+{
+    dev->tx_free_thresh = thresh;
+    // 还不知道发送环长度，e1000_init()里再调整
+    if (dev->tx_nr == 0)
+        return;
+    if (thresh == 0)
+        thresh = MIN(TX_FREE_THRESH, dev->tx_nr / 2);
+    dev->tx_free_thresh = MIN(thresh, dev->tx_nr - 1);
+}
+
+/**
+ * @brief 描述符写在tx_cur时需要附加的命令位
+ * 
+ * 每TX_RS_THRESH个描述符才要求网卡回写一次状态，
+ * 设置了发送延迟定时器时，完成中断按TIDV/TADV延迟。
+ */
+static inline uint8_t e1000_tx_rs_cmd(struct e1000_device *dev, uint16_t tx_cur)
+{
+    if ((tx_cur + 1) % TX_RS_THRESH != 0)
+        return 0;
+    return dev->intr_mod.tidv_us ? TCMD_RS | TCMD_IDE : TCMD_RS;
+}
+
+/**
+ * @brief 发送停在一组中间时，给最后一个描述符也设置RS
+ * 
+ * 否则这几个描述符要等后面的报文把这一组填满才能回收，发送停下来后
+ * 缓冲区会一直挂在描述符上，发送环比两组还小时甚至永远凑不满一组。
+ */
+static inline void e1000_tx_rs_tail(struct e1000_device *dev, uint16_t tx_cur)
+{
+    if (tx_cur % TX_RS_THRESH == 0)
+        return;
+    uint16_t last = (tx_cur - 1) & dev->tx_mask;
+    dev->tx_desc[last].cmd |= dev->intr_mod.tidv_us ? TCMD_RS | TCMD_IDE : TCMD_RS;
+}
+
+/**
+ * @brief 报文的校验和上下文，首部布局相同的报文可以共用一个上下文描述符
+ */
+static inline uint32_t e1000_tx_ctx_key(const struct pktbuf *pkt)
+{
+    return 1U << 31 | (pkt->ol_flags & PKTBUF_TX_CKSUM_MASK) << 24
+         | (uint32_t)pkt->l3_len << 8 | pkt->l2_len;
+}
+
+/**
+ * @brief 在tx_cur写一个TCP/IP上下文描述符
+ */
+static void e1000_tx_ctx_setup(struct e1000_device *dev, uint16_t tx_cur, const struct pktbuf *pkt)
+{
+    tx_ctx_desc_t *ctx = (tx_ctx_desc_t *)&dev->tx_desc[tx_cur];
+    uint8_t l4_off = pkt->l2_len + pkt->l3_len;
+
+    ctx->ipcss = pkt->l2_len;
+    ctx->ipcso = pkt->l2_len + offsetof(struct ipv4_hdr, cksum);
+    ctx->ipcse = l4_off - 1;
+    ctx->tucss = l4_off;
+    if (pkt->ol_flags & PKTBUF_TX_TCP_CKSUM)
+        ctx->tucso = l4_off + offsetof(struct tcp_hdr, cksum);
+    else
+        ctx->tucso = l4_off + offsetof(struct udp_hdr, cksum);
+    ctx->tucse = 0;
+    ctx->paylen = 0;
+    ctx->dtyp = TDESC_DTYP_CTX;
+    ctx->tucmd = TCMD_DEXT | TUCMD_IP | e1000_tx_rs_cmd(dev, tx_cur);
+    if (pkt->ol_flags & PKTBUF_TX_TCP_CKSUM)
+        ctx->tucmd |= TUCMD_TCP;
+    ctx->status = 0;
+    ctx->hdr_len = 0;
+    ctx->mss = 0;
+    dev->tx_bufs[tx_cur] = NULL;
+}
+
+/**
+ * @brief 批量发送报文
+ * 
+ * 尽可能多地填充空闲描述符，最后只写一次TDT，描述符不够时立即返回，不会等待。
+ * 报文缓冲区直接挂到描述符上，发送完成后由驱动释放：空闲描述符低于tx_free_thresh，
+ * 或者放不下下一个报文时，才批量回收已经完成的描述符。
+ * 设置了PKTBUF_TX_*_CKSUM的报文用扩展数据描述符，由网卡插入校验和，
+ * 首部布局变化时先插入一个上下文描述符，报文要先用pktbuf_tx_cksum_prepare()处理。
+ * 多段报文每段占一个描述符，只有最后一段设置EOP，首部和负载可以放在不同的缓冲区里。
+ * 设置了PKTBUF_TX_VLAN的报文由网卡在以太网首部后插入vlan_tci。
+ * 
+ * @return 放入发送队列的报文个数，剩下的报文仍归调用者所有，需要重发或释放
+ */
+int e1000_tx_burst(struct e1000_device *dev, struct pktbuf **pkts, int n)
+{
+    uint16_t tx_cur = dev->tx_cur;
+    uint16_t free;
+    uint64_t bytes = 0;
+    int nb_tx, cleaned = 0;
+
+    if (dev->tx_free < dev->tx_free_thresh) {
+        e1000_tx_clean(dev);
+        cleaned = 1;
+    }
+    free = dev->tx_free;
+
+    for (nb_tx = 0; nb_tx < n; nb_tx++) {
+        struct pktbuf *pkt = pkts[nb_tx];
+        uint16_t need = pkt->nb_segs;
+        uint32_t key = 0;
+        uint8_t popts = 0;
+
+        if (pkt->ol_flags & PKTBUF_TX_CKSUM_MASK) {
+            key = e1000_tx_ctx_key(pkt);
+            if (pkt->ol_flags & PKTBUF_TX_IP_CKSUM)
+                popts |= TPOPTS_IXSM;
+            if (pkt->ol_flags & PKTBUF_TX_L4_MASK)
+                popts |= TPOPTS_TXSM;
+            if (key != dev->tx_ctx)
+                need++;
+        }
+        if (need > free) {
+            // 还没到阈值但放不下这个报文，每次调用最多再回收一次
+            if (cleaned)
+                break;
+            free += e1000_tx_clean(dev);
+            cleaned = 1;
+            if (need > free)
+                break;
+        }
+        if (key && key != dev->tx_ctx) {
+            e1000_tx_ctx_setup(dev, tx_cur, pkt);
+            dev->tx_ctx = key;
+            tx_cur = (tx_cur + 1) & dev->tx_mask;
+            free--;
+        }
+
+        // 一个报文的所有描述符要么都是扩展描述符，要么都是传统描述符，POPTS只在第一个里有效
+        for (struct pktbuf *seg = pkt; seg; seg = seg->next) {
+            tx_desc_t *desc = &dev->tx_desc[tx_cur];
+            dev->tx_bufs[tx_cur] = seg;
+            desc->addr = pktbuf_data_phys(seg);
+            desc->length = seg->data_len;
+            bytes += seg->data_len;
+            desc->cmd = TCMD_IFCS | e1000_tx_rs_cmd(dev, tx_cur);
+            desc->special = 0;
+            // VLE和VLAN标签只在最后一个描述符里有效
+            if (!seg->next) {
+                desc->cmd |= TCMD_EOP;
+                if (pkt->ol_flags & PKTBUF_TX_VLAN) {
+                    desc->cmd |= TCMD_VLE;
+                    desc->special = pkt->vlan_tci;
+                }
+            }
+            if (popts) {
+                desc->cmd |= TCMD_DEXT;
+                desc->cso = TDESC_DTYP_DATA;
+                desc->css = seg == pkt ? popts : 0;
+            } else {
+                desc->cso = 0;
+                desc->css = 0;
+            }
+            desc->status = 0;
+
+            tx_cur = (tx_cur + 1) & dev->tx_mask;
+            free--;
+        }
+    }
+
+    if (nb_tx < n)
+        dev->tx_stats.ring_full++;
+    if (tx_cur == dev->tx_cur)
+        return 0;
+
+    e1000_tx_rs_tail(dev, tx_cur);
+    dev->tx_free = free;
+    dev->tx_cur = tx_cur;
+    dev->tx_stats.packets += nb_tx;
+    dev->tx_stats.bytes += bytes;
+    // 描述符写完之后再更新TDT
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    E1000_WRITE_REG(dev->hw_addr, E1000_TDT, tx_cur);
+    return nb_tx;
+}
+
+/**
+ * @brief 拷贝发送一帧，超过一个缓冲区的长帧拷贝到多个缓冲区里串起来发送
+ * 
+ * 不会睡眠等待，缓冲池为空或者空闲描述符不够时立即返回，由调用者决定重试还是丢弃。
+ * 
+ * @return 成功返回0，帧超过巨帧长度时返回-1，发送队列满返回E1000_TX_RING_FULL
+ */
 int e1000_send(struct e1000_device *dev, char *buf, size_t len)
 {
-    tx_desc_t *desc = &dev->tx_desc[dev->tx_cur];
+    if (len == 0 || len > E1000_MTU_MAX + E1000_FRAME_OVERHEAD) {
+        printf("e1000_send: invalid length %zu\n", len);
+        return -1;
+    }
 
-    // 等待上一个包发送完成
-    while (desc->status == 0) {
-        usleep(10);
+    struct pktbuf *pkt = NULL;
+    size_t off = 0;
+    while (off < len) {
+        struct pktbuf *seg = pktbuf_alloc(dev->pool);
+        if (!seg) {
+            if (pkt)
+                pktbuf_free(pkt);
+            dev->tx_stats.ring_full++;
+            return E1000_TX_RING_FULL;
+        }
+        seg->data_len = MIN(len - off, PKTBUF_DATA_SIZE);
+        memcpy(pktbuf_data(seg), buf + off, seg->data_len);
+        off += seg->data_len;
+        if (!pkt)
+            pkt = seg;
+        else
+            pktbuf_chain(pkt, seg);
     }
 
-    assert(len < 2048);
-    char *addr = phys_to_virt((void *)desc->addr);
-    // 填充数据
-    memcpy(addr, buf, len);
+    if (e1000_tx_burst(dev, &pkt, 1) == 0) {
+        pktbuf_free(pkt);
+        return E1000_TX_RING_FULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief 负载按4K边界拆分需要的描述符个数
+ */
+static int e1000_tso_nr_desc(uint64_t phys, uint32_t len)
+{
+    int nr = 0;
+    while (len > 0) {
+        uint32_t chunk = E1000_MAX_DATA_PER_TXD - (phys & (E1000_MAX_DATA_PER_TXD - 1));
+        if (chunk > len)
+            chunk = len;
+        phys += chunk;
+        len -= chunk;
+        nr++;
+    }
+    return nr;
+}
 
-    // 设置长度
-    desc->length = len;
+/**
+ * @brief TCP分段卸载：发送一个首部加一大块负载，由网卡切成mss大小的报文
+ * 
+ * hdr里是以太网、IPv4和TCP首部，要设置好l2_len和l3_len，只能有一段；payload是TCP负载，
+ * 可以来自pktbuf_pool_create_size()创建的大缓冲区池，也可以是多段的链。所有缓冲区都直接挂到
+ * 描述符上，不拷贝，发送完成后由驱动逐段释放。
+ * 网卡给每个分段填写IP总长度、递增的IP ID、TCP序号，以及IP和TCP校验和，
+ * 只有最后一个分段保留FIN/PSH。
+ * 
+ * @return 成功返回0；描述符不够时返回-1，两个缓冲区仍归调用者所有
+ */
+int e1000_send_tso(struct e1000_device *dev, struct pktbuf *hdr, struct pktbuf *payload, uint16_t mss)
+{
+    struct ipv4_hdr *ip = (struct ipv4_hdr *)(pktbuf_data(hdr) + hdr->l2_len);
+    struct tcp_hdr *tcp = (struct tcp_hdr *)((char *)ip + hdr->l3_len);
+    uint16_t hdr_len = hdr->l2_len + hdr->l3_len + TCP_HDR_LEN(tcp);
+    uint32_t paylen = 0;
+    int nr = 2; // 上下文描述符 + 首部 + 负载
+    int empty = 0;
+    for (struct pktbuf *seg = payload; seg; seg = seg->next) {
+        paylen += seg->data_len;
+        nr += e1000_tso_nr_desc(pktbuf_data_phys(seg), seg->data_len);
+        empty |= seg->data_len == 0;
+    }
 
-    // 设置cmd
-    desc->cmd |= TCMD_EOP | TCMD_RS | TCMD_RPS | TCMD_IFCS;
+    // 空的段没有描述符，发送完成后没法释放；PAYLEN只有20位
+    if (ip->proto != IP_PROTO_TCP || hdr->nb_segs != 1 || hdr->next || hdr->data_len != hdr_len
+        || mss == 0 || empty || paylen > 0xfffff) {
+        printf("e1000_send_tso: invalid packet\n");
+        return -1;
+    }
+
+    if (dev->tx_free < dev->tx_free_thresh || nr > dev->tx_free)
+        e1000_tx_clean(dev);
+    if (nr > dev->tx_free) {
+        dev->tx_stats.ring_full++;
+        return -1;
+    }
+
+    // 网卡按分段的长度补上IP总长度和伪首部里的TCP长度
+    ip->total_len = 0;
+    ip->cksum = 0;
+    tcp->cksum = ipv4_phdr_cksum(ip, 0);
+
+    uint16_t tx_cur = dev->tx_cur;
+    tx_ctx_desc_t *ctx = (tx_ctx_desc_t *)&dev->tx_desc[tx_cur];
+    ctx->ipcss = hdr->l2_len;
+    ctx->ipcso = hdr->l2_len + offsetof(struct ipv4_hdr, cksum);
+    ctx->ipcse = hdr->l2_len + hdr->l3_len - 1;
+    ctx->tucss = hdr->l2_len + hdr->l3_len;
+    ctx->tucso = ctx->tucss + offsetof(struct tcp_hdr, cksum);
+    ctx->tucse = 0;
+    ctx->paylen = paylen & 0xffff;
+    ctx->dtyp = TDESC_DTYP_CTX | (paylen >> 16);
+    ctx->tucmd = TCMD_DEXT | TUCMD_TSE | TUCMD_IP | TUCMD_TCP | e1000_tx_rs_cmd(dev, tx_cur);
+    ctx->status = 0;
+    ctx->hdr_len = hdr_len;
+    ctx->mss = mss;
+    dev->tx_bufs[tx_cur] = NULL;
+    tx_cur = (tx_cur + 1) & dev->tx_mask;
+
+    // 第一个数据描述符只放首部，POPTS只在第一个描述符里有效
+    tx_desc_t *desc = &dev->tx_desc[tx_cur];
+    desc->addr = pktbuf_data_phys(hdr);
+    desc->length = hdr_len;
+    desc->cso = TDESC_DTYP_DATA;
+    desc->cmd = TCMD_DEXT | TCMD_TSE | TCMD_IFCS | e1000_tx_rs_cmd(dev, tx_cur);
     desc->status = 0;
+    desc->css = TPOPTS_IXSM | TPOPTS_TXSM;
+    desc->special = 0;
+    dev->tx_bufs[tx_cur] = hdr;
+    tx_cur = (tx_cur + 1) & dev->tx_mask;
+
+    for (struct pktbuf *seg = payload; seg; seg = seg->next) {
+        uint64_t phys = pktbuf_data_phys(seg);
+        uint32_t left = seg->data_len;
+        while (left > 0) {
+            uint32_t chunk = E1000_MAX_DATA_PER_TXD - (phys & (E1000_MAX_DATA_PER_TXD - 1));
+            if (chunk > left)
+                chunk = left;
+            left -= chunk;
+
+            desc = &dev->tx_desc[tx_cur];
+            desc->addr = phys;
+            desc->length = chunk;
+            desc->cso = TDESC_DTYP_DATA;
+            desc->cmd = TCMD_DEXT | TCMD_TSE | TCMD_IFCS | e1000_tx_rs_cmd(dev, tx_cur);
+            desc->special = 0;
+            if (left == 0 && !seg->next) {
+                desc->cmd |= TCMD_EOP;
+                // 每个分段都插入同一个VLAN标签
+                if (hdr->ol_flags & PKTBUF_TX_VLAN) {
+                    desc->cmd |= TCMD_VLE;
+                    desc->special = hdr->vlan_tci;
+                }
+            }
+            desc->status = 0;
+            desc->css = 0;
+            // 每段挂在自己的最后一个描述符上，这一段发完才释放
+            dev->tx_bufs[tx_cur] = left == 0 ? seg : NULL;
+            phys += chunk;
+            tx_cur = (tx_cur + 1) & dev->tx_mask;
+        }
+    }
 
-    // 设置发送队列尾索引
-    dev->tx_cur = (dev->tx_cur + 1) % TX_DESC_NR;
-    E1000_WRITE_REG(dev->hw_addr, E1000_TDT, dev->tx_cur);
+    e1000_tx_rs_tail(dev, tx_cur);
+    uint32_t nr_segs = (paylen + mss - 1) / mss;
+    dev->tx_ctx = 0; // TSO上下文覆盖了网卡里的校验和上下文
+    dev->tx_free -= nr;
+    dev->tx_cur = tx_cur;
+    dev->tx_stats.packets += nr_segs;
+    dev->tx_stats.bytes += paylen + (uint64_t)nr_segs * hdr_len;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    E1000_WRITE_REG(dev->hw_addr, E1000_TDT, tx_cur);
     return 0;
 }
@@ -0,0 +1,601 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "e1000.h"
+#include "e1000_emu.h"
+#include "mem_alloc.h"
+#include "ip.h"
+
+int e1000_is_emu(const char *pci_id)
+{
+    return strncmp(pci_id, E1000_EMU_PREFIX, strlen(E1000_EMU_PREFIX)) == 0;
+}
+
+static const uint8_t *emu_next_frame(struct e1000_emu *emu, uint16_t *len)
+{
+    if (emu->trace.nr == 0) {
+        uint16_t nr = __atomic_load_n(&emu->frame_dsts, __ATOMIC_ACQUIRE);
+        if (nr > 1) {
+            memcpy(emu->frame, emu->frame_dst[emu->next_dst % nr], 6);
+            emu->next_dst = (emu->next_dst + 1) % nr;
+        } else if (nr == 1) {
+            memcpy(emu->frame, emu->frame_dst[0], 6);
+        }
+        *len = emu->frame_len;
+        return emu->frame;
+    }
+    struct pcap_pkt *pkt = &emu->trace.pkts[emu->next_pkt];
+    emu->next_pkt = (emu->next_pkt + 1) % emu->trace.nr;
+    *len = pkt->len;
+    return pkt->data;
+}
+
+/**
+ * @brief 按RXCSUM的设置检查IPv4和TCP/UDP校验和，结果写到描述符的status和error
+ */
+static void emu_rx_cksum(uint32_t rxcsum, const uint8_t *frame, uint32_t len,
+                         uint8_t *status, uint8_t *error)
+{
+    if (len < 14 + sizeof(struct ipv4_hdr) || frame[12] != 0x08 || frame[13] != 0x00)
+        return;
+    const struct ipv4_hdr *ip = (const struct ipv4_hdr *)(frame + 14);
+    uint32_t ip_len = IPV4_HDR_LEN(ip);
+    if ((ip->ver_ihl >> 4) != 4 || ip_len < sizeof(*ip) || 14 + ip_len > len)
+        return;
+
+    if (rxcsum & RXCSUM_IPOFLD) {
+        *status |= RS_IPCS;
+        if (ip_cksum(ip, ip_len) != 0)
+            *error |= RE_IPE;
+    }
+    if ((rxcsum & RXCSUM_TUOFLD) == 0 || (ip->proto != IP_PROTO_TCP && ip->proto != IP_PROTO_UDP))
+        return;
+    // 分片报文不检查L4校验和
+    if (ip->frag_off & htons(0x3fff))
+        return;
+    // 短帧后面可能有填充，按IP总长度计算
+    uint32_t total_len = ntohs(ip->total_len);
+    if (total_len < ip_len || 14 + total_len > len)
+        return;
+    uint32_t l4_len = total_len - ip_len;
+    const uint8_t *l4 = (const uint8_t *)ip + ip_len;
+    if (ip->proto == IP_PROTO_UDP) {
+        *status |= RS_UDPCS;
+        // UDP校验和为0表示发送方没有计算
+        if (l4_len < sizeof(struct udp_hdr) || ((const struct udp_hdr *)l4)->cksum == 0)
+            return;
+    }
+    *status |= RS_L4CS;
+    uint32_t sum = ipv4_phdr_cksum(ip, l4_len);
+    if ((uint16_t)~ip_cksum_fold(ip_cksum_add(sum, l4, l4_len)) != 0)
+        *error |= RE_TCPE;
+}
+
+/**
+ * @brief 按RCTL、RAR和MTA检查目的地址，和网卡一样在占用描述符之前过滤
+ * 
+ * @return 1: 收下，0: 丢弃
+ */
+static int emu_rx_addr_match(struct e1000_emu *emu, uint32_t rctl, const uint8_t *dst)
+{
+    static const uint8_t bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    void *hw = emu->hw_addr;
+
+    if (dst[0] & 1) {
+        if (memcmp(dst, bcast, 6) == 0)
+            return (rctl & (RCTL_BAM | RCTL_MPE)) != 0;
+        if (rctl & RCTL_MPE)
+            return 1;
+        uint16_t hash = e1000_mta_hash(dst);
+        return (E1000_READ_REG(hw, E1000_MTA + (hash >> 5) * 4) >> (hash & 0x1f)) & 1;
+    }
+    if (rctl & RCTL_UPE)
+        return 1;
+    uint32_t ral = dst[0] | dst[1] << 8 | dst[2] << 16 | (uint32_t)dst[3] << 24;
+    uint32_t rah = dst[4] | dst[5] << 8;
+    for (int i = 0; i < E1000_RAR_ENTRIES; i++) {
+        uint32_t reg = E1000_READ_REG(hw, E1000_RAH0 + i * 8);
+        if ((reg & E1000_RAH_AV) && (reg & 0xffff) == rah && E1000_READ_REG(hw, E1000_RAL0 + i * 8) == ral)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 处理接收帧的VLAN标签：不在过滤表里的丢弃，打开了CTRL.VME时剥离
+ * 
+ * 合成帧本身不带标签，设置了frame_vlans时当作带标签的帧"收到"。
+ * 需要加上或去掉标签时把帧复制到rx_frame，*frame指向复制后的帧。
+ * 
+ * @return -1: 被过滤掉；1: 标签仍在帧里；0: 不带标签或者已经剥离
+ */
+static int emu_rx_vlan(struct e1000_emu *emu, uint32_t rctl, const uint8_t **frame, uint16_t *len,
+                       uint8_t *status, uint16_t *special)
+{
+    void *hw = emu->hw_addr;
+    uint16_t vet = E1000_READ_REG(hw, E1000_VET);
+    int strip = E1000_READ_REG(hw, E1000_CTRL) & CTRL_VME;
+    int synthetic = *frame == emu->frame;
+    const uint8_t *f = *frame;
+    uint16_t tci;
+
+    if (vet == 0)
+        return 0;
+    if (synthetic) {
+        uint16_t nr = __atomic_load_n(&emu->frame_vlans, __ATOMIC_ACQUIRE);
+        if (nr == 0)
+            return 0;
+        tci = emu->frame_tci + emu->next_vlan % nr;
+        emu->next_vlan = (emu->next_vlan + 1) % nr;
+    } else {
+        if (*len < 18 || (f[12] << 8 | f[13]) != vet)
+            return 0;
+        tci = f[14] << 8 | f[15];
+    }
+
+    uint16_t vid = tci & 0xfff;
+    if ((rctl & RCTL_VFE) && (E1000_READ_REG(hw, E1000_VFTA + (vid >> 5) * 4) & (1U << (vid & 0x1f))) == 0)
+        return -1;
+    *status |= RS_VP;
+    *special = tci;
+
+    if (synthetic && !strip) {
+        memcpy(emu->rx_frame, f, 12);
+        emu->rx_frame[12] = vet >> 8;
+        emu->rx_frame[13] = vet & 0xff;
+        emu->rx_frame[14] = tci >> 8;
+        emu->rx_frame[15] = tci & 0xff;
+        memcpy(emu->rx_frame + 16, f + 12, *len - 12);
+        *frame = emu->rx_frame;
+        *len += 4;
+    } else if (!synthetic && strip) {
+        memcpy(emu->rx_frame, f, 12);
+        memcpy(emu->rx_frame + 12, f + 16, *len - 16);
+        *frame = emu->rx_frame;
+        *len -= 4;
+    }
+    return !strip;
+}
+
+/**
+ * @brief RCTL里BSIZE和BSEX对应的接收缓冲区大小
+ */
+static uint32_t emu_rx_buf_size(uint32_t rctl)
+{
+    uint32_t size = 2048 >> ((rctl >> 16) & 3);
+    if (rctl & (1 << 25))
+        size <<= 4;
+    return size;
+}
+
+/**
+ * @brief 模拟接收：把报文写进RDH到RDT之间的描述符，返回收下的帧数
+ * 
+ * 超过接收缓冲区大小的帧拆到多个描述符里，每个描述符都设置DD，
+ * 最后一个设置EOP并带上校验和结果。空闲描述符不够放下整帧时等驱动补充。
+ * 目的地址不匹配的帧直接丢弃，带VLAN标签的帧按过滤表过滤，剥离出来的标签写在special里。
+ */
+static int emu_rx(struct e1000_emu *emu)
+{
+    void *hw = emu->hw_addr;
+    uint32_t rctl = E1000_READ_REG(hw, E1000_RCTL);
+    if ((rctl & RCTL_EN) == 0)
+        return 0;
+    uint32_t buf_size = emu_rx_buf_size(rctl);
+
+    uint32_t nr = E1000_READ_REG(hw, E1000_RDLEN) / sizeof(struct rx_desc_t);
+    uint64_t base = E1000_READ_REG(hw, E1000_RDBAL) | (uint64_t)E1000_READ_REG(hw, E1000_RDBAH) << 32;
+    uint32_t head = E1000_READ_REG(hw, E1000_RDH);
+    uint32_t tail = E1000_READ_REG(hw, E1000_RDT);
+    struct rx_desc_t *ring = phys_to_virt((void *)base);
+    uint32_t rxcsum = E1000_READ_REG(hw, E1000_RXCSUM);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    int n = 0, received = 0; // n包括被丢弃的帧，只有收下的帧才产生中断
+    while (head != tail && n < E1000_EMU_BURST) {
+        uint16_t len, special = 0;
+        unsigned saved = emu->next_pkt;
+        uint16_t saved_vlan = emu->next_vlan;
+        uint16_t saved_dst = emu->next_dst;
+        uint8_t status = RS_DD | RS_EOP, error = 0;
+        const uint8_t *frame = emu_next_frame(emu, &len);
+        if (len < 14 || !emu_rx_addr_match(emu, rctl, frame)) {
+            emu->rx_addr_filtered++;
+            n++;
+            continue;
+        }
+        int tagged = emu_rx_vlan(emu, rctl, &frame, &len, &status, &special);
+        if (tagged < 0) {
+            emu->rx_vlan_filtered++;
+            n++;
+            continue;
+        }
+        // 没有打开长帧接收时，带标签的帧可以多4个字节
+        uint32_t nr_desc = (len + buf_size - 1) / buf_size;
+        if ((len > E1000_EMU_STD_FRAME + (tagged ? 4 : 0) && (rctl & RCTL_LPE) == 0) || nr_desc > nr - 1) {
+            emu->rx_oversize++;
+            n++;
+            continue;
+        }
+        if (nr_desc > (tail + nr - head) % nr) {
+            emu->next_pkt = saved;
+            emu->next_vlan = saved_vlan;
+            emu->next_dst = saved_dst;
+            break;
+        }
+
+        emu_rx_cksum(rxcsum, frame, len, &status, &error);
+        for (uint32_t off = 0; off < len; off += buf_size) {
+            struct rx_desc_t *desc = &ring[head];
+            uint32_t chunk = len - off < buf_size ? len - off : buf_size;
+            memcpy(phys_to_virt((void *)desc->addr), frame + off, chunk);
+            desc->length = chunk;
+            desc->checksum = 0;
+            desc->special = off + chunk < len ? 0 : special;
+            if (off + chunk < len) {
+                desc->error = 0;
+                __atomic_store_n(&desc->status, RS_DD, __ATOMIC_RELEASE);
+            } else {
+                desc->error = error;
+                __atomic_store_n(&desc->status, status, __ATOMIC_RELEASE);
+            }
+            head = (head + 1) % nr;
+            n++;
+        }
+        emu->rx_packets++;
+        emu->rx_bytes += len;
+        received++;
+    }
+    E1000_WRITE_REG(hw, E1000_RDH, head);
+    return received;
+}
+
+/**
+ * @brief 按网卡的方式插入校验和：从start累加到end（包含），结果写到offset
+ * 
+ * 校验和字段本身也在累加范围内，所以驱动预先填的伪首部累加和会被算进去。
+ */
+static void emu_cksum_insert(uint8_t *frame, uint32_t len, uint32_t start, uint32_t end, uint32_t offset)
+{
+    if (end == 0 || end >= len)
+        end = len - 1;
+    if (start > end || offset + 2 > len)
+        return;
+    uint16_t cksum = ip_cksum(frame + start, end - start + 1);
+    memcpy(frame + offset, &cksum, 2);
+}
+
+/**
+ * @brief 一帧"发"到线上，报文要求插入VLAN标签时插在源MAC地址后面
+ * 
+ * @param cap: frame所在缓冲区的大小
+ */
+static void emu_tx_out(struct e1000_emu *emu, uint8_t *frame, uint32_t len, uint32_t cap)
+{
+    if (emu->tx_vle && len >= 12 && len + 4 <= cap) {
+        uint16_t vet = E1000_READ_REG(emu->hw_addr, E1000_VET);
+        memmove(frame + 16, frame + 12, len - 12);
+        frame[12] = vet >> 8;
+        frame[13] = vet & 0xff;
+        frame[14] = emu->tx_vlan_tci >> 8;
+        frame[15] = emu->tx_vlan_tci & 0xff;
+        len += 4;
+    }
+    emu->tx_packets++;
+    emu->tx_bytes += len;
+    emu->tx_last = frame;
+    emu->tx_last_len = len;
+    if (emu->tx_hook)
+        emu->tx_hook(emu->tx_hook_arg, frame, len);
+}
+
+/**
+ * @brief 按上下文描述符把tx_frame切成mss大小的分段
+ * 
+ * 每个分段复制一份首部，改写IP总长度、IP ID和TCP序号，中间的分段去掉FIN/PSH，
+ * 把分段的TCP长度加进驱动预先填好的伪首部累加和，再插入校验和。
+ */
+static void emu_tx_tso(struct e1000_emu *emu, uint32_t len)
+{
+    tx_ctx_desc_t *ctx = &emu->tx_ctx;
+    uint32_t hdr_len = ctx->hdr_len;
+    uint32_t mss = ctx->mss;
+    if (mss == 0 || hdr_len >= len || ctx->tucss + sizeof(struct tcp_hdr) > hdr_len)
+        return;
+
+    const struct ipv4_hdr *ip0 = (const struct ipv4_hdr *)(emu->tx_frame + ctx->ipcss);
+    const struct tcp_hdr *tcp0 = (const struct tcp_hdr *)(emu->tx_frame + ctx->tucss);
+    uint16_t id = ntohs(ip0->id);
+    uint32_t seq = ntohl(tcp0->seq);
+    uint16_t phdr = tcp0->cksum;
+    uint32_t paylen = len - hdr_len;
+
+    for (uint32_t off = 0; off < paylen; off += mss) {
+        uint32_t chunk = paylen - off < mss ? paylen - off : mss;
+        if (hdr_len + chunk > sizeof(emu->tx_seg))
+            return;
+        uint8_t *seg = emu->tx_seg;
+        memcpy(seg, emu->tx_frame, hdr_len);
+        memcpy(seg + hdr_len, emu->tx_frame + hdr_len + off, chunk);
+
+        struct ipv4_hdr *ip = (struct ipv4_hdr *)(seg + ctx->ipcss);
+        struct tcp_hdr *tcp = (struct tcp_hdr *)(seg + ctx->tucss);
+        ip->total_len = htons(hdr_len - ctx->ipcss + chunk);
+        ip->id = htons(id++);
+        tcp->seq = htonl(seq + off);
+        if (off + chunk < paylen)
+            tcp->flags &= ~0x09; // FIN | PSH
+        uint16_t tcp_len = hdr_len - ctx->tucss + chunk;
+        tcp->cksum = ip_cksum_fold((uint32_t)phdr + htons(tcp_len));
+
+        if (emu->tx_popts & TPOPTS_IXSM)
+            emu_cksum_insert(seg, hdr_len + chunk, ctx->ipcss, ctx->ipcse, ctx->ipcso);
+        if (emu->tx_popts & TPOPTS_TXSM)
+            emu_cksum_insert(seg, hdr_len + chunk, ctx->tucss, ctx->tucse, ctx->tucso);
+        emu_tx_out(emu, seg, hdr_len + chunk, sizeof(emu->tx_seg));
+    }
+    emu->tx_tso++;
+}
+
+/**
+ * @brief 把一个数据描述符的内容追加到当前帧，遇到EOP时把帧"发"出去
+ */
+static void emu_tx_data(struct e1000_emu *emu, struct tx_desc_t *desc)
+{
+    uint32_t len = desc->length;
+    if (desc->cmd & TCMD_DEXT)
+        len |= (uint32_t)(desc->cso & 0x0f) << 16; // 扩展描述符的长度是20位
+    if (emu->tx_len == 0) {
+        // 只有第一个描述符的POPTS有效
+        emu->tx_popts = (desc->cmd & TCMD_DEXT) ? desc->css : 0;
+        emu->tx_tse = (desc->cmd & TCMD_DEXT) && (desc->cmd & TCMD_TSE);
+    }
+    if (emu->tx_len + len <= sizeof(emu->tx_frame))
+        memcpy(emu->tx_frame + emu->tx_len, phys_to_virt((void *)desc->addr), len);
+    emu->tx_len += len;
+    if ((desc->cmd & TCMD_EOP) == 0)
+        return;
+
+    uint32_t frame_len = emu->tx_len < sizeof(emu->tx_frame) ? emu->tx_len : sizeof(emu->tx_frame);
+    emu->tx_len = 0;
+    // VLE和VLAN标签只在最后一个描述符里有效，没有打开CTRL.VME时忽略
+    emu->tx_vle = (desc->cmd & TCMD_VLE) && (E1000_READ_REG(emu->hw_addr, E1000_CTRL) & CTRL_VME);
+    emu->tx_vlan_tci = desc->special;
+    if (emu->tx_popts)
+        emu->tx_cksum++;
+    if (emu->tx_tse) {
+        emu_tx_tso(emu, frame_len);
+        return;
+    }
+
+    tx_ctx_desc_t *ctx = &emu->tx_ctx;
+    if (emu->tx_popts & TPOPTS_IXSM)
+        emu_cksum_insert(emu->tx_frame, frame_len, ctx->ipcss, ctx->ipcse, ctx->ipcso);
+    if (emu->tx_popts & TPOPTS_TXSM)
+        emu_cksum_insert(emu->tx_frame, frame_len, ctx->tucss, ctx->tucse, ctx->tucso);
+    emu_tx_out(emu, emu->tx_frame, frame_len, sizeof(emu->tx_frame));
+}
+
+/**
+ * @brief 模拟发送：消费TDH到TDT之间的描述符，设置了RS的回写DD
+ * 
+ * 数据描述符的内容按帧组装到tx_frame，上下文描述符只记录下来。
+ */
+static int emu_tx(struct e1000_emu *emu)
+{
+    void *hw = emu->hw_addr;
+    if ((E1000_READ_REG(hw, E1000_TCTL) & TCTL_EN) == 0)
+        return 0;
+
+    uint32_t nr = E1000_READ_REG(hw, E1000_TDLEN) / sizeof(struct tx_desc_t);
+    uint64_t base = E1000_READ_REG(hw, E1000_TDBAL) | (uint64_t)E1000_READ_REG(hw, E1000_TDBAH) << 32;
+    uint32_t head = E1000_READ_REG(hw, E1000_TDH);
+    uint32_t tail = E1000_READ_REG(hw, E1000_TDT);
+    struct tx_desc_t *ring = phys_to_virt((void *)base);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    int n = 0;
+    while (head != tail && n < E1000_EMU_BURST) {
+        struct tx_desc_t *desc = &ring[head];
+        if ((desc->cmd & TCMD_DEXT) && (desc->cso & 0xf0) == TDESC_DTYP_CTX)
+            memcpy(&emu->tx_ctx, desc, sizeof(emu->tx_ctx));
+        else
+            emu_tx_data(emu, desc);
+        if (desc->cmd & TCMD_RS)
+            __atomic_store_n(&desc->status, TS_DD, __ATOMIC_RELEASE);
+        head = (head + 1) % nr;
+        n++;
+    }
+    E1000_WRITE_REG(hw, E1000_TDH, head);
+    return n;
+}
+
+/**
+ * @brief 处理驱动写uio设备打开中断的请求，收到报文时产生一次中断
+ */
+static void emu_irq(struct e1000_emu *emu, int rx)
+{
+    int value;
+    while (read(emu->irq_fd, &value, sizeof(value)) == sizeof(value))
+        emu->irq_enabled = value;
+
+    if (rx && emu->irq_enabled) {
+        value = 1;
+        if (write(emu->irq_fd, &value, sizeof(value)) == sizeof(value))
+            emu->irq_enabled = 0;
+    }
+}
+
+static void *emu_thread(void *arg)
+{
+    struct e1000_emu *emu = (struct e1000_emu *)arg;
+    while (emu->running) {
+        int rx = emu_rx(emu);
+        int tx = emu_tx(emu);
+        emu_irq(emu, rx);
+        if (rx == 0 && tx == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+/**
+ * @brief 创建软件模拟的e1000设备
+ * 
+ * @param spec: "emu[N][:<pcap文件>]"，N决定MAC地址的最后一个字节，
+ *              指定pcap文件时循环回放其中的报文，否则发送合成的广播帧
+ */
+struct e1000_device *e1000_emu_device_get(const char *spec)
+{
+    struct e1000_device *dev = NULL;
+    struct e1000_emu *emu = NULL;
+    int sv[2] = {-1, -1};
+
+    const char *p = spec + strlen(E1000_EMU_PREFIX);
+    int index = atoi(p);
+    const char *pcap_path = strchr(p, ':');
+
+    dev = calloc(1, sizeof(struct e1000_device));
+    emu = calloc(1, sizeof(struct e1000_emu));
+    if (!dev || !emu)
+        goto error;
+    if (pcap_path && pcap_load(pcap_path + 1, &emu->trace) < 0)
+        goto error;
+
+    dev->hw_addr = aligned_alloc(4096, E1000_BAR_SIZE);
+    if (!dev->hw_addr)
+        goto error;
+    memset(dev->hw_addr, 0, E1000_BAR_SIZE);
+    emu->hw_addr = dev->hw_addr;
+
+    // MAC地址放在RAL0/RAH0，和没有EEPROM的网卡一样
+    uint8_t mac[6] = {0x52, 0x54, 0x00, 0x12, 0x34, (uint8_t)index};
+    memcpy((char *)dev->hw_addr + E1000_RAL0, mac, 6);
+    E1000_WRITE_REG(dev->hw_addr, E1000_RAH0, E1000_READ_REG(dev->hw_addr, E1000_RAH0) | E1000_RAH_AV);
+
+    // 合成帧：广播，源地址是本网卡，以太类型为本地实验用的0x88b5，负载是递增的字节
+    for (size_t i = 14; i < sizeof(emu->frame); i++)
+        emu->frame[i] = (uint8_t)i;
+    emu->frame_len = E1000_EMU_FRAME_LEN;
+    memset(emu->frame, 0xff, 6);
+    memcpy(emu->frame + 6, mac, 6);
+    emu->frame[12] = 0x88;
+    emu->frame[13] = 0xb5;
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+        perror("socketpair");
+        goto error;
+    }
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    emu->irq_fd = sv[1];
+
+    snprintf(dev->name, PCI_PRI_STR_SIZE, "%s", spec);
+    dev->uio_fd = sv[0];
+    dev->config_fd = -1;
+    dev->emu = emu;
+
+    mem_set_iova_va(1);
+
+    emu->running = 1;
+    if (pthread_create(&emu->tid, NULL, emu_thread, emu) != 0) {
+        printf("pthread_create failed\n");
+        goto error;
+    }
+    return dev;
+
+error:
+    if (sv[0] >= 0)
+        close(sv[0]);
+    if (sv[1] >= 0)
+        close(sv[1]);
+    if (emu)
+        pcap_trace_free(&emu->trace);
+    if (dev)
+        free(dev->hw_addr);
+    free(emu);
+    free(dev);
+    return NULL;
+}
+
+void e1000_emu_stop(struct e1000_device *dev)
+{
+    struct e1000_emu *emu = dev->emu;
+    if (!emu || !emu->running)
+        return;
+    emu->running = 0;
+    pthread_join(emu->tid, NULL);
+}
+
+/**
+ * @brief 设置发送回调，每"发出"一帧调用一次，用来检查或者抓取发出的报文
+ */
+void e1000_emu_set_tx_hook(struct e1000_device *dev, e1000_emu_tx_hook_t hook, void *arg)
+{
+    struct e1000_emu *emu = dev->emu;
+    if (!emu)
+        return;
+    emu->tx_hook_arg = arg;
+    __atomic_store_n(&emu->tx_hook, hook, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 设置合成帧的长度，用来模拟巨帧，回放pcap文件时无效
+ */
+int e1000_emu_set_frame_len(struct e1000_device *dev, uint16_t len)
+{
+    struct e1000_emu *emu = dev->emu;
+    if (!emu)
+        return -1;
+    if (len < E1000_EMU_FRAME_LEN || len > E1000_EMU_FRAME_MAX) {
+        printf("invalid emu frame length %u, must be in [%d, %d]\n",
+               len, E1000_EMU_FRAME_LEN, E1000_EMU_FRAME_MAX);
+        return -1;
+    }
+    __atomic_store_n(&emu->frame_len, len, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief 让合成帧带上VLAN标签，VLAN ID从tci开始依次使用nr个，nr为0时不带标签
+ * 
+ * 用来测试VLAN剥离和过滤，回放pcap文件时无效。
+ */
+void e1000_emu_set_frame_vlan(struct e1000_device *dev, uint16_t tci, uint16_t nr)
+{
+    struct e1000_emu *emu = dev->emu;
+    if (!emu)
+        return;
+    // 先清零，模拟线程看到的frame_vlans和next_vlan始终是一致的
+    __atomic_store_n(&emu->frame_vlans, 0, __ATOMIC_RELEASE);
+    emu->frame_tci = tci;
+    emu->next_vlan = 0;
+    __atomic_store_n(&emu->frame_vlans, nr, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 合成帧的目的地址轮流使用addrs里的n个地址，n为0时恢复成广播
+ * 
+ * 用来测试单播和组播过滤，回放pcap文件时无效。
+ */
+int e1000_emu_set_frame_dst(struct e1000_device *dev, const uint8_t (*addrs)[6], int n)
+{
+    struct e1000_emu *emu = dev->emu;
+    if (!emu || n < 0 || n > E1000_EMU_DST_MAX)
+        return -1;
+    __atomic_store_n(&emu->frame_dsts, 0, __ATOMIC_RELEASE);
+    if (n == 0) {
+        memset(emu->frame_dst[0], 0xff, 6);
+        n = 1;
+    } else {
+        memcpy(emu->frame_dst, addrs, n * 6);
+    }
+    emu->next_dst = 0;
+    __atomic_store_n(&emu->frame_dsts, n, __ATOMIC_RELEASE);
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <string.h>
+#include "e1000.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define E1000_VEC_X86 1
+#endif
+
+// 连续的1的个数，从最低位开始
+#define E1000_SCAN_READY(dd) ((int)__builtin_ctz(~(uint32_t)(dd)))
+
+/**
+ * @brief 逐个检查描述符，也用来处理向量版本剩下的不足一组的描述符
+ */
+static int e1000_rx_scan_scalar(const struct rx_desc_t *desc, int max, struct e1000_rx_meta *meta,
+                                uint32_t *eop, uint32_t *err)
+{
+    uint32_t eop_mask = 0, err_mask = 0;
+    int i;
+
+    for (i = 0; i < max; i++) {
+        uint8_t status = desc[i].status;
+        if ((status & RS_DD) == 0)
+            break;
+        // 看到DD之后再读描述符的其他字段
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        meta[i].length = desc[i].length;
+        meta[i].status = status;
+        meta[i].error = desc[i].error;
+        meta[i].special = desc[i].special;
+        meta[i].rsvd = 0;
+        eop_mask |= (uint32_t)((status & RS_EOP) != 0) << i;
+        err_mask |= (uint32_t)((meta[i].error & RE_FRAME_MASK) != 0) << i;
+    }
+    *eop = eop_mask;
+    *err = err_mask;
+    return i;
+}
+
+#ifdef E1000_VEC_X86
+
+/**
+ * 描述符高8字节是 length(2) checksum(2) status(1) error(1) special(2)，
+ * 每两个描述符的高8字节拼成一个128位，按下面的表重排成两个e1000_rx_meta，
+ * 再把status和error抽到单独的字节里，用movemask一次得到DD/EOP/错误位。
+ */
+#define E1000_META_SHUF \
+    0, 1, 4, 5, 6, 7, -1, -1, 8, 9, 12, 13, 14, 15, -1, -1
+
+// 尾部按标量处理，结果接在向量部分后面
+static inline int e1000_rx_scan_tail(const struct rx_desc_t *desc, int i, int max,
+                                     struct e1000_rx_meta *meta, uint32_t *eop, uint32_t *err)
+{
+    uint32_t eop_tail, err_tail;
+    int nr = e1000_rx_scan_scalar(desc + i, max - i, meta + i, &eop_tail, &err_tail);
+    *eop |= eop_tail << i;
+    *err |= err_tail << i;
+    return i + nr;
+}
+
+/**
+ * @brief 每次检查4个描述符
+ *
+ * 从后往前读描述符：网卡按顺序回写，后面的描述符完成时前面的一定也完成了，
+ * 先读后面的可以保证不会出现前面没完成、后面完成的空洞。每个描述符一次16字节读出。
+ */
+__attribute__((target("ssse3,sse4.1")))
+static int e1000_rx_scan_sse4(const struct rx_desc_t *desc, int max, struct e1000_rx_meta *meta,
+                              uint32_t *eop, uint32_t *err)
+{
+    const __m128i meta_shuf = _mm_setr_epi8(E1000_META_SHUF);
+    // h01的status/error放到第0、1和8、9字节，h23的放到第2、3和10、11字节
+    const __m128i se_shuf01 = _mm_setr_epi8(4, 12, -1, -1, -1, -1, -1, -1, 5, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i se_shuf23 = _mm_setr_epi8(-1, -1, 4, 12, -1, -1, -1, -1, -1, -1, 5, 13, -1, -1, -1, -1);
+    const __m128i frame_err = _mm_set1_epi8(RE_FRAME_MASK);
+    uint32_t eop_mask = 0, err_mask = 0;
+    int i;
+
+    for (i = 0; i + 4 <= max; i += 4) {
+        const __m128i *p = (const __m128i *)&desc[i];
+        __m128i d3 = _mm_load_si128(p + 3);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d2 = _mm_load_si128(p + 2);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d1 = _mm_load_si128(p + 1);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d0 = _mm_load_si128(p);
+
+        __m128i h01 = _mm_unpackhi_epi64(d0, d1);
+        __m128i h23 = _mm_unpackhi_epi64(d2, d3);
+        __m128i se = _mm_or_si128(_mm_shuffle_epi8(h01, se_shuf01), _mm_shuffle_epi8(h23, se_shuf23));
+
+        uint32_t dd = _mm_movemask_epi8(_mm_slli_epi16(se, 7)) & 0xf;
+        uint32_t ep = _mm_movemask_epi8(_mm_slli_epi16(se, 6)) & 0xf;
+        __m128i ok = _mm_cmpeq_epi8(_mm_and_si128(se, frame_err), _mm_setzero_si128());
+        uint32_t er = (~_mm_movemask_epi8(ok) >> 8) & 0xf;
+
+        _mm_storeu_si128((__m128i *)&meta[i], _mm_shuffle_epi8(h01, meta_shuf));
+        _mm_storeu_si128((__m128i *)&meta[i + 2], _mm_shuffle_epi8(h23, meta_shuf));
+        eop_mask |= ep << i;
+        err_mask |= er << i;
+        if (dd != 0xf) {
+            int ready = E1000_SCAN_READY(dd);
+            uint32_t valid = (1U << (i + ready)) - 1;
+            *eop = eop_mask & valid;
+            *err = err_mask & valid;
+            return i + ready;
+        }
+    }
+    *eop = eop_mask;
+    *err = err_mask;
+    return e1000_rx_scan_tail(desc, i, max, meta, eop, err);
+}
+
+/**
+ * @brief 每次检查8个描述符
+ *
+ * 仍然按16字节逐个读描述符（32字节的读不保证原子），两个拼成一个256位寄存器，
+ * 重排和movemask一次处理8个。
+ */
+__attribute__((target("avx2")))
+static int e1000_rx_scan_avx2(const struct rx_desc_t *desc, int max, struct e1000_rx_meta *meta,
+                              uint32_t *eop, uint32_t *err)
+{
+    const __m256i meta_shuf = _mm256_setr_epi8(E1000_META_SHUF, E1000_META_SHUF);
+    /**
+     * 重排后 a = [hi0 hi1 | hi2 hi3]，b = [hi4 hi5 | hi6 hi7]，
+     * 每个128位通道里status放到第0~3字节、error放到第8~11字节对应的位置，
+     * movemask之后低16位是通道0，高16位是通道1。
+     */
+    const __m256i se_shuf_a = _mm256_setr_epi8(
+        4, 12, -1, -1, -1, -1, -1, -1, 5, 13, -1, -1, -1, -1, -1, -1,
+        -1, -1, 4, 12, -1, -1, -1, -1, -1, -1, 5, 13, -1, -1, -1, -1);
+    const __m256i se_shuf_b = _mm256_setr_epi8(
+        -1, -1, -1, -1, 4, 12, -1, -1, -1, -1, -1, -1, 5, 13, -1, -1,
+        -1, -1, -1, -1, -1, -1, 4, 12, -1, -1, -1, -1, -1, -1, 5, 13);
+    const __m256i frame_err = _mm256_set1_epi8(RE_FRAME_MASK);
+    uint32_t eop_mask = 0, err_mask = 0;
+    int i;
+
+    for (i = 0; i + 8 <= max; i += 8) {
+        const __m128i *p = (const __m128i *)&desc[i];
+        __m128i d7 = _mm_load_si128(p + 7);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d6 = _mm_load_si128(p + 6);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d5 = _mm_load_si128(p + 5);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d4 = _mm_load_si128(p + 4);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d3 = _mm_load_si128(p + 3);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d2 = _mm_load_si128(p + 2);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d1 = _mm_load_si128(p + 1);
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        __m128i d0 = _mm_load_si128(p);
+        __m256i d02 = _mm256_inserti128_si256(_mm256_castsi128_si256(d0), d2, 1);
+        __m256i d13 = _mm256_inserti128_si256(_mm256_castsi128_si256(d1), d3, 1);
+        __m256i d46 = _mm256_inserti128_si256(_mm256_castsi128_si256(d4), d6, 1);
+        __m256i d57 = _mm256_inserti128_si256(_mm256_castsi128_si256(d5), d7, 1);
+        __m256i a = _mm256_unpackhi_epi64(d02, d13);
+        __m256i b = _mm256_unpackhi_epi64(d46, d57);
+        __m256i se = _mm256_or_si256(_mm256_shuffle_epi8(a, se_shuf_a), _mm256_shuffle_epi8(b, se_shuf_b));
+
+        uint32_t m = _mm256_movemask_epi8(_mm256_slli_epi16(se, 7));
+        uint32_t dd = (m & 0x33) | (m >> 16 & 0xcc);
+        m = _mm256_movemask_epi8(_mm256_slli_epi16(se, 6));
+        uint32_t ep = (m & 0x33) | (m >> 16 & 0xcc);
+        __m256i ok = _mm256_cmpeq_epi8(_mm256_and_si256(se, frame_err), _mm256_setzero_si256());
+        m = ~_mm256_movemask_epi8(ok);
+        uint32_t er = (m >> 8 & 0x33) | (m >> 24 & 0xcc);
+
+        __m256i ma = _mm256_shuffle_epi8(a, meta_shuf);
+        __m256i mb = _mm256_shuffle_epi8(b, meta_shuf);
+        _mm_storeu_si128((__m128i *)&meta[i], _mm256_castsi256_si128(ma));
+        _mm_storeu_si128((__m128i *)&meta[i + 2], _mm256_extracti128_si256(ma, 1));
+        _mm_storeu_si128((__m128i *)&meta[i + 4], _mm256_castsi256_si128(mb));
+        _mm_storeu_si128((__m128i *)&meta[i + 6], _mm256_extracti128_si256(mb, 1));
+        eop_mask |= ep << i;
+        err_mask |= er << i;
+        if (dd != 0xff) {
+            int ready = E1000_SCAN_READY(dd);
+            uint32_t valid = (1U << (i + ready)) - 1;
+            *eop = eop_mask & valid;
+            *err = err_mask & valid;
+            return i + ready;
+        }
+    }
+    // 剩下的交给标量代码，先清掉ymm的高128位，避免AVX和SSE切换的开销
+    _mm256_zeroupper();
+    *eop = eop_mask;
+    *err = err_mask;
+    return e1000_rx_scan_tail(desc, i, max, meta, eop, err);
+}
+
+#endif
+
+static int e1000_rx_scan_resolve(const struct rx_desc_t *desc, int max, struct e1000_rx_meta *meta,
+                                 uint32_t *eop, uint32_t *err);
+
+static const struct {
+    const char *name;
+    e1000_rx_scan_fn fn;
+} rx_scan_impls[] = {
+#ifdef E1000_VEC_X86
+    {"avx2", e1000_rx_scan_avx2},
+    {"sse4", e1000_rx_scan_sse4},
+#endif
+    {"scalar", e1000_rx_scan_scalar},
+};
+
+#define RX_SCAN_NR_IMPLS (int)(sizeof(rx_scan_impls) / sizeof(rx_scan_impls[0]))
+
+e1000_rx_scan_fn e1000_rx_scan = e1000_rx_scan_resolve;
+static const char *rx_scan_name;
+
+static int e1000_rx_scan_supported(const char *name)
+{
+#ifdef E1000_VEC_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "sse4") == 0)
+        return __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/**
+ * @brief 按CPU支持的指令集选出最快的实现
+ */
+static void e1000_rx_scan_pick(void)
+{
+    for (int i = 0; i < RX_SCAN_NR_IMPLS; i++) {
+        if (e1000_rx_scan_supported(rx_scan_impls[i].name)) {
+            rx_scan_name = rx_scan_impls[i].name;
+            e1000_rx_scan = rx_scan_impls[i].fn;
+            return;
+        }
+    }
+}
+
+// 第一次调用时再选，不需要初始化函数
+static int e1000_rx_scan_resolve(const struct rx_desc_t *desc, int max, struct e1000_rx_meta *meta,
+                                 uint32_t *eop, uint32_t *err)
+{
+    e1000_rx_scan_pick();
+    return e1000_rx_scan(desc, max, meta, eop, err);
+}
+
+/**
+ * @brief 指定描述符扫描的实现，测试和对比性能时使用
+ *
+ * @param name: avx2、sse4或scalar，NULL表示按CPU自动选择
+ * @return 成功返回0，不认识或者CPU不支持返回-1
+ */
+int e1000_rx_scan_select(const char *name)
+{
+    if (!name) {
+        e1000_rx_scan_pick();
+        return 0;
+    }
+    for (int i = 0; i < RX_SCAN_NR_IMPLS; i++) {
+        if (strcmp(rx_scan_impls[i].name, name) != 0)
+            continue;
+        if (!e1000_rx_scan_supported(name))
+            break;
+        rx_scan_name = rx_scan_impls[i].name;
+        e1000_rx_scan = rx_scan_impls[i].fn;
+        return 0;
+    }
+    printf("rx scan %s is not supported\n", name);
+    return -1;
+}
+
+/**
+ * @brief 当前使用的实现的名字
+ */
+const char *e1000_rx_scan_name(void)
+{
+    if (!rx_scan_name)
+        e1000_rx_scan_pick();
+    return rx_scan_name;
+}
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include "engine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+/**
+ * @brief 初始化引擎，之后用engine_add_worker()/engine_assign()或engine_parse()分配端口
+ */
+int engine_init(struct engine *eng, engine_handler_t handler, void *arg)
+{
+    if (!handler)
+        return -1;
+    memset(eng, 0, sizeof(*eng));
+    for (int i = 0; i < E1000_MAX_DEVICES; i++)
+        eng->port_owner[i] = -1;
+    eng->handler = handler;
+    eng->arg = arg;
+    return 0;
+}
+
+/**
+ * @brief 添加一个工作线程
+ *
+ * @param cpu: 绑定的CPU，-1表示不绑定
+ * @return 工作线程编号，失败返回-1
+ */
+int engine_add_worker(struct engine *eng, int cpu)
+{
+    if (eng->nr_workers >= ENGINE_MAX_WORKERS) {
+        printf("too many workers, max %d\n", ENGINE_MAX_WORKERS);
+        return -1;
+    }
+    struct engine_worker *w = &eng->workers[eng->nr_workers];
+    w->id = eng->nr_workers;
+    w->cpu = cpu;
+    w->engine = eng;
+    return eng->nr_workers++;
+}
+
+/**
+ * @brief 把端口分配给工作线程，每个端口只能属于一个线程
+ */
+int engine_assign(struct engine *eng, int worker, int port_id)
+{
+    if (worker < 0 || worker >= eng->nr_workers)
+        return -1;
+    if (!e1000_device_at(port_id)) {
+        printf("invalid port %d\n", port_id);
+        return -1;
+    }
+    if (eng->port_owner[port_id] >= 0) {
+        printf("port %d is already assigned to worker %d\n", port_id, eng->port_owner[port_id]);
+        return -1;
+    }
+    struct engine_worker *w = &eng->workers[worker];
+    w->ports[w->nr_ports++] = port_id;
+    eng->port_owner[port_id] = worker;
+    return 0;
+}
+
+/**
+ * @brief 解析 <cpu>@<port>[,<port>...]，添加一个绑定到cpu的工作线程
+ *
+ * cpu为*时不绑定，例如 0@0,1 表示CPU 0上的线程负责端口0和1。
+ */
+int engine_parse(struct engine *eng, const char *spec)
+{
+    char *end;
+    int cpu = -1;
+
+    if (spec[0] == '*') {
+        end = (char *)spec + 1;
+    } else {
+        cpu = strtol(spec, &end, 10);
+        if (end == spec || cpu < 0)
+            goto error;
+    }
+    if (*end != '@')
+        goto error;
+
+    int worker = engine_add_worker(eng, cpu);
+    if (worker < 0)
+        return -1;
+    const char *p = end + 1;
+    do {
+        int port = strtol(p, &end, 10);
+        if (end == p)
+            goto error;
+        if (engine_assign(eng, worker, port) < 0)
+            return -1;
+        p = end + 1;
+    } while (*end == ',');
+    if (*end != '\0')
+        goto error;
+    return 0;
+
+error:
+    printf("invalid worker spec: %s, expect <cpu|*>@<port>[,<port>...]\n", spec);
+    return -1;
+}
+
+/**
+ * @brief 只由工作线程自己更新，用原子写避免读者看到撕裂的值
+ */
+static inline void engine_stat_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static void *engine_worker_main(void *arg)
+{
+    struct engine_worker *w = (struct engine_worker *)arg;
+    struct engine *eng = w->engine;
+    struct engine_worker_stats *stats = &w->stats;
+    struct e1000_device *devs[E1000_MAX_DEVICES];
+    struct pktbuf *pkts[ENGINE_BURST];
+
+    for (int i = 0; i < w->nr_ports; i++)
+        devs[i] = e1000_device_at(w->ports[i]);
+
+    while (eng->running) {
+        int total = 0;
+        for (int i = 0; i < w->nr_ports; i++) {
+            int n = e1000_rx_burst(devs[i], pkts, ENGINE_BURST);
+            if (n == 0)
+                continue;
+            total += n;
+
+            int tx_port = w->ports[i];
+            int nb = eng->handler(w->ports[i], pkts, n, &tx_port, eng->arg);
+            int sent = 0;
+            if (nb > 0 && tx_port >= 0 && tx_port < E1000_MAX_DEVICES
+                && eng->port_owner[tx_port] == w->id)
+                sent = e1000_tx_burst(e1000_device_at(tx_port), pkts, nb);
+            for (int j = sent; j < nb; j++)
+                pktbuf_free(pkts[j]);
+
+            engine_stat_add(&stats->rx_packets, n);
+            engine_stat_add(&stats->tx_packets, sent);
+            if (nb > sent)
+                engine_stat_add(&stats->tx_drops, nb - sent);
+        }
+        engine_stat_add(&stats->loops, 1);
+        if (total == 0) {
+            engine_stat_add(&stats->idle_loops, 1);
+            // 和其它线程共享CPU时（比如模拟网卡），空闲时让出CPU
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 启动所有工作线程，没有端口的线程不启动
+ */
+int engine_start(struct engine *eng)
+{
+    eng->running = 1;
+    for (int i = 0; i < eng->nr_workers; i++) {
+        struct engine_worker *w = &eng->workers[i];
+        if (w->nr_ports == 0)
+            continue;
+        // 创建时就绑定好CPU，线程不会先在别的CPU上跑起来
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (w->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(w->cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        int ret = pthread_create(&w->tid, &attr, engine_worker_main, w);
+        pthread_attr_destroy(&attr);
+        if (ret != 0) {
+            printf("worker %d: pthread_create failed on cpu %d\n", i, w->cpu);
+            w->tid = 0;
+            goto error;
+        }
+    }
+    return 0;
+
+error:
+    engine_stop(eng);
+    return -1;
+}
+
+void engine_stop(struct engine *eng)
+{
+    eng->running = 0;
+    for (int i = 0; i < eng->nr_workers; i++) {
+        struct engine_worker *w = &eng->workers[i];
+        if (w->tid) {
+            pthread_join(w->tid, NULL);
+            w->tid = 0;
+        }
+    }
+}
+
+void engine_stats_get(struct engine *eng, int worker, struct engine_worker_stats *stats)
+{
+    struct engine_worker_stats *s = &eng->workers[worker].stats;
+    stats->rx_packets = __atomic_load_n(&s->rx_packets, __ATOMIC_RELAXED);
+    stats->tx_packets = __atomic_load_n(&s->tx_packets, __ATOMIC_RELAXED);
+    stats->tx_drops = __atomic_load_n(&s->tx_drops, __ATOMIC_RELAXED);
+    stats->loops = __atomic_load_n(&s->loops, __ATOMIC_RELAXED);
+    stats->idle_loops = __atomic_load_n(&s->idle_loops, __ATOMIC_RELAXED);
+}
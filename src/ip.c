@@ -0,0 +1,82 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include "ip.h"
+
+/**
+ * @brief 把data按16位累加到sum上，不折叠进位
+ */
+uint32_t ip_cksum_add(uint32_t sum, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t acc = sum;
+    // 按32位累加到64位里，最后再折叠，结果和逐个16位累加相同
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        acc += word;
+        p += 4;
+        len -= 4;
+    }
+    while (len >= 2) {
+        uint16_t word;
+        memcpy(&word, p, 2);
+        acc += word;
+        p += 2;
+        len -= 2;
+    }
+    // 奇数长度时最后一个字节补0
+    if (len) {
+        uint16_t word = 0;
+        memcpy(&word, p, 1);
+        acc += word;
+    }
+    acc = (acc & 0xffffffff) + (acc >> 32);
+    acc = (acc & 0xffffffff) + (acc >> 32);
+    return (uint32_t)acc;
+}
+
+/**
+ * @brief 把32位的累加和折叠成16位，不取反
+ */
+uint16_t ip_cksum_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/**
+ * @brief 互联网校验和，比如IPv4首部校验和，计算前校验和字段要先清零
+ */
+uint16_t ip_cksum(const void *data, size_t len)
+{
+    return (uint16_t)~ip_cksum_fold(ip_cksum_add(0, data, len));
+}
+
+/**
+ * @brief IPv4伪首部的累加和（不取反）
+ *
+ * 网卡做TCP/UDP校验和卸载时，要先把这个值填进TCP/UDP的校验和字段。
+ *
+ * @param l4_len: TCP/UDP首部加负载的长度
+ */
+uint16_t ipv4_phdr_cksum(const struct ipv4_hdr *ip, uint16_t l4_len)
+{
+    uint32_t sum = ip_cksum_add(0, &ip->src, 8); // 源地址和目的地址
+    sum += htons(ip->proto);
+    sum += htons(l4_len);
+    return ip_cksum_fold(sum);
+}
+
+/**
+ * @brief 软件计算TCP/UDP校验和，计算前校验和字段要先清零
+ */
+uint16_t ipv4_udptcp_cksum(const struct ipv4_hdr *ip, const void *l4, uint16_t l4_len)
+{
+    uint32_t sum = ipv4_phdr_cksum(ip, l4_len);
+    uint16_t cksum = (uint16_t)~ip_cksum_fold(ip_cksum_add(sum, l4, l4_len));
+    // UDP校验和为0表示没有校验和，算出来是0时发送0xffff
+    if (cksum == 0 && ip->proto == IP_PROTO_UDP)
+        cksum = 0xffff;
+    return cksum;
+}
@@ -1,53 +1,629 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
 #include "e1000.h"
 #include "ethernet.h"
 #include "assert.h"
 #include "arpa/inet.h"
 #include "ethernet.h"
 #include "arp.h"
+#include "bench.h"
+#include "engine.h"
+#include "pcap.h"
+#include "pktgen.h"
 
 #define RECV_MODE 0
 #define SEND_MODE 1
+#define BENCH_MODE 2
+#define FWD_MODE 3
+#define CAPTURE_MODE 4
+#define GEN_MODE 5
 
-static char PCI_ID[PCI_PRI_STR_SIZE + 1] = {0};
+#define RX_BURST 32
+
+static char PCI_IDS[E1000_MAX_DEVICES][256]; // PCI ID，或者 emu[N][:<pcap文件>]
+static int NR_PORTS = 0;
+static int NR_THREADS = 1;
+static int QUIET = 0;
+static char *WORKER_SPECS[ENGINE_MAX_WORKERS]; // -w <cpu>@<port>[,<port>...]
+static int NR_WORKER_SPECS = 0;
 static int MODE = RECV_MODE;
+static char BENCH_NAME[32] = "rx";
+static int RX_NR = RX_DESC_NR;
+static int TX_NR = TX_DESC_NR;
+static int IDLE_BUDGET_US = E1000_IDLE_BUDGET_US;
+static int ITR_NS = -1; // -1: 不设置，-2: 自动调节
+static int MTU = E1000_MTU_DEFAULT;
+static char *VLAN_SPEC = NULL; // -V <vid>[,<vid>...]
+static int PROMISC = 0;
+static char *CAPTURE_PATH = NULL; // -c <file>
+static uint32_t SNAPLEN = PCAP_SNAPLEN_MAX;
+static uint64_t ROTATE_SIZE = 0;
+static unsigned ROTATE_FILES = 0;
+static struct pcap_writer *CAPTURES[E1000_MAX_DEVICES];
+static struct pktgen_cfg GEN_CFG = {
+    .pkt_len = PKTGEN_PKT_LEN_MIN,
+    .nr_flows = 1,
+    .dst_mac = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff},
+};
+static volatile int RUNNING = 1;
+
+/**
+ * @brief 接收线程，端口按 port_id % NR_THREADS 分配给线程
+ */
+struct worker {
+    pthread_t tid;
+    int id;
+    int nr_ports;
+    struct e1000_device *ports[E1000_MAX_DEVICES];
+};
+
+static void on_signal(int sig)
+{
+    RUNNING = 0;
+}
+
+static void print_poll_stats(struct e1000_device *dev)
+{
+    struct e1000_poll_stats stats;
+    e1000_poll_stats_get(dev, &stats);
+    uint64_t total = stats.busy_ns + stats.sleep_ns;
+    printf("busy poll: %.3f s (%.1f%%), sleep: %.3f s, sleeps: %lu, wakeups: %lu, timeouts: %lu\n",
+           stats.busy_ns / 1e9, total ? stats.busy_ns * 100.0 / total : 0.0,
+           stats.sleep_ns / 1e9, stats.sleeps, stats.wakeups, stats.timeouts);
+}
 
 static void usage()
 {
-    printf("usage: ./e1000_test -i <pci_id> -m <recv|send>\n");
+    printf("usage: ./e1000_test -i <pci_id> [-i <pci_id> ...] -m <recv|send|fwd|capture|gen> [-r <rx ring size>] [-t <tx ring size>]\n");
+    printf("                   [-T <recv threads>] [-q quiet, print pps per second]\n");
+    printf("                   [-w <cpu|*>@<port>[,<port>...] ...] worker assignment for fwd mode\n");
+    printf("                   [-I <idle budget us, 0: always busy poll>]\n");
+    printf("                   [-M <auto|min interrupt interval ns>]\n");
+    printf("                   [-u <mtu, up to %d for jumbo frames>]\n", E1000_MTU_MAX);
+    printf("                   [-V <vid>[,<vid>...]] strip vlan tags and accept only these vlans\n");
+    printf("                   [-p promiscuous mode, receive frames for any destination]\n");
+    printf("       ./e1000_test -i <pci_id> [-i <pci_id> ...] -m capture -c <pcap file> [-s <snaplen>]\n");
+    printf("                   [-C <rotate size MB>] [-W <rotate file count>]\n");
+    printf("                   write received frames to pcap, with multiple ports each port gets <file>.port<N>\n");
+    printf("       ./e1000_test -i <pci_id> [-i <pci_id> ...] -m gen [-P <pcap file to replay>]\n");
+    printf("                   [-l <frame length>] [-f <flows>] [-d <dst mac>] udp frames when no pcap\n");
+    printf("                   [-R <pps> | -B <line rate Mbit/s>] [-n <packets>] every port sends at this rate\n");
+    printf("       ./e1000_test -m bench -b <benchmark>\n");
+    bench_list();
     exit(0);
 }
 
 static int parse_args(int argc, char **argv)
 {
     int opt;
-    while ((opt = getopt(argc, argv, "i:m:h")) != -1) {
+    while ((opt = getopt(argc, argv, "i:m:b:r:t:I:M:T:w:u:V:c:s:C:W:P:l:f:d:R:B:n:pqh")) != -1) {
         switch (opt) {
         case 'h':
             usage();
         case 'i':
-            snprintf(PCI_ID, PCI_PRI_STR_SIZE, "%s", optarg);
+            if (NR_PORTS >= E1000_MAX_DEVICES) {
+                printf("too many devices, max %d\n", E1000_MAX_DEVICES);
+                return -1;
+            }
+            snprintf(PCI_IDS[NR_PORTS++], sizeof(PCI_IDS[0]), "%s", optarg);
+            break;
+        case 'T':
+            NR_THREADS = atoi(optarg);
+            break;
+        case 'q':
+            QUIET = 1;
+            break;
+        case 'p':
+            PROMISC = 1;
+            break;
+        case 'w':
+            if (NR_WORKER_SPECS >= ENGINE_MAX_WORKERS) {
+                printf("too many workers, max %d\n", ENGINE_MAX_WORKERS);
+                return -1;
+            }
+            WORKER_SPECS[NR_WORKER_SPECS++] = optarg;
             break;
         case 'm':
             if (strcmp(optarg, "recv") == 0) {
                 MODE = RECV_MODE;
             } else if (strcmp(optarg, "send") == 0) {
                 MODE = SEND_MODE;
+            } else if (strcmp(optarg, "bench") == 0) {
+                MODE = BENCH_MODE;
+            } else if (strcmp(optarg, "fwd") == 0) {
+                MODE = FWD_MODE;
+            } else if (strcmp(optarg, "capture") == 0) {
+                MODE = CAPTURE_MODE;
+            } else if (strcmp(optarg, "gen") == 0) {
+                MODE = GEN_MODE;
             } else {
                 printf("invalid mode\n");
                 return -1;
             }
             break;
+        case 'r':
+            RX_NR = atoi(optarg);
+            break;
+        case 't':
+            TX_NR = atoi(optarg);
+            break;
+        case 'I':
+            IDLE_BUDGET_US = atoi(optarg);
+            break;
+        case 'M':
+            ITR_NS = strcmp(optarg, "auto") == 0 ? -2 : atoi(optarg);
+            break;
+        case 'u':
+            // e1000_set_mtu()的参数是16位的，先检查范围，否则大的值会截断成合法的MTU
+            MTU = atoi(optarg);
+            if (MTU < 68 || MTU > E1000_MTU_MAX) {
+                printf("invalid mtu %s, must be in [68, %d]\n", optarg, E1000_MTU_MAX);
+                return -1;
+            }
+            break;
+        case 'V':
+            VLAN_SPEC = optarg;
+            break;
+        case 'c':
+            CAPTURE_PATH = optarg;
+            break;
+        case 's':
+            SNAPLEN = atoi(optarg);
+            break;
+        case 'C':
+            ROTATE_SIZE = strtoull(optarg, NULL, 10) << 20;
+            break;
+        case 'W':
+            ROTATE_FILES = atoi(optarg);
+            break;
+        case 'P':
+            GEN_CFG.pcap = optarg;
+            break;
+        case 'l':
+            GEN_CFG.pkt_len = atoi(optarg);
+            break;
+        case 'f':
+            GEN_CFG.nr_flows = atoi(optarg);
+            break;
+        case 'd': {
+            uint8_t *mac = GEN_CFG.dst_mac;
+            if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                       &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6) {
+                printf("invalid mac address: %s\n", optarg);
+                return -1;
+            }
+            break;
+        }
+        case 'R':
+            GEN_CFG.rate_pps = strtoull(optarg, NULL, 10);
+            break;
+        case 'B':
+            GEN_CFG.rate_bps = atof(optarg) * 1e6;
+            break;
+        case 'n':
+            GEN_CFG.count = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            snprintf(BENCH_NAME, sizeof(BENCH_NAME), "%s", optarg);
+            break;
         default:
             printf("invalid args\n");
             return -1;
         }
     }
-    if (PCI_ID[0] == '\0') {
+    if (MODE != BENCH_MODE && NR_PORTS == 0) {
         printf("please specify pci id\n");
         return -1;
     }
+    if (MODE == CAPTURE_MODE && !CAPTURE_PATH) {
+        printf("please specify capture file\n");
+        return -1;
+    }
+    if (NR_THREADS < 1 || NR_THREADS > NR_PORTS)
+        NR_THREADS = NR_PORTS > 0 ? NR_PORTS : 1;
+    return 0;
+}
+
+static void print_stats(struct e1000_device *dev)
+{
+    struct e1000_stats stats;
+    e1000_stats_get(dev, &stats);
+    printf("port %d (%s):\n", dev->port_id, dev->name);
+    printf("rx: %lu packets, %lu bytes, %lu drops, %lu ring full, %lu checksum errors\n",
+           stats.rx.packets, stats.rx.bytes, stats.rx.drops, stats.rx.ring_full, stats.rx.cksum_errors);
+    printf("tx: %lu packets, %lu bytes, %lu ring full\n",
+           stats.tx.packets, stats.tx.bytes, stats.tx.ring_full);
+    printf("hw: gprc %lu, gorc %lu, gptc %lu, gotc %lu, mpc %lu, rnbc %lu, crcerrs %lu\n",
+           stats.hw.gprc, stats.hw.gorc, stats.hw.gptc, stats.hw.gotc,
+           stats.hw.mpc, stats.hw.rnbc, stats.hw.crcerrs);
+}
+
+static void handle_packets(struct e1000_device *dev, struct pktbuf **pkts, int n)
+{
+    struct pcap_writer *w = CAPTURES[dev->port_id];
+    if (w) {
+        // 一批报文共用一个时间戳，clock_gettime走vDSO，不陷入内核
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t ts_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        for (int i = 0; i < n; i++) {
+            pcap_write_pkt(w, ts_ns, pkts[i]);
+            pktbuf_free(pkts[i]);
+        }
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!QUIET) {
+            struct eth_hdr *hdr = (struct eth_hdr *)pktbuf_data(pkts[i]);
+            printf("port %d receive packet src:  %02x:%02x:%02x:%02x:%02x:%02x\n",
+                    dev->port_id,
+                    hdr->src[0], hdr->src[1], hdr->src[2],
+                    hdr->src[3], hdr->src[4], hdr->src[5]);
+            printf("                      dest: %02x:%02x:%02x:%02x:%02x:%02x\n",
+                    hdr->dst[0], hdr->dst[1], hdr->dst[2],
+                    hdr->dst[3], hdr->dst[4], hdr->dst[5]);
+            if (pkts[i]->ol_flags & PKTBUF_RX_VLAN)
+                printf("                      vlan: %u priority: %u\n",
+                       pkts[i]->vlan_tci & 0xfff, pkts[i]->vlan_tci >> 13);
+        }
+        pktbuf_free(pkts[i]);
+    }
+}
+
+/**
+ * @brief 接收线程
+ * 
+ * 只负责一个端口时使用自适应轮询，空闲时可以睡眠等中断；
+ * 负责多个端口时不能阻塞在某一个端口上，轮流突发接收，都空闲时让出CPU。
+ */
+static void *recv_worker(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct pktbuf *pkts[RX_BURST];
+
+    if (w->nr_ports == 1) {
+        struct e1000_device *dev = w->ports[0];
+        while (RUNNING) {
+            int n = e1000_rx_poll(dev, pkts, RX_BURST);
+            handle_packets(dev, pkts, n);
+        }
+        return NULL;
+    }
+
+    while (RUNNING) {
+        int total = 0;
+        for (int i = 0; i < w->nr_ports; i++) {
+            int n = e1000_rx_burst(w->ports[i], pkts, RX_BURST);
+            handle_packets(w->ports[i], pkts, n);
+            total += n;
+        }
+        if (total == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void do_recv(void)
+{
+    struct worker workers[E1000_MAX_DEVICES];
+    memset(workers, 0, sizeof(workers));
+
+    for (int i = 0; i < NR_PORTS; i++) {
+        struct e1000_device *dev = e1000_device_at(i);
+        struct worker *w = &workers[i % NR_THREADS];
+        w->ports[w->nr_ports++] = dev;
+        e1000_rx_set_idle_budget(dev, IDLE_BUDGET_US);
+        if (ITR_NS == -2) {
+            e1000_intr_mod_auto(dev, 1);
+        } else if (ITR_NS >= 0) {
+            struct e1000_intr_mod mod = {0};
+            mod.itr_ns = ITR_NS;
+            e1000_intr_mod_set(dev, &mod);
+        }
+    }
+
+    printf("start recv on %d ports with %d threads...\n", NR_PORTS, NR_THREADS);
+    for (int i = 0; i < NR_THREADS; i++) {
+        workers[i].id = i;
+        if (pthread_create(&workers[i].tid, NULL, recv_worker, &workers[i]) != 0) {
+            printf("pthread_create failed\n");
+            RUNNING = 0;
+            for (int j = 0; j < i; j++)
+                pthread_join(workers[j].tid, NULL);
+            return;
+        }
+    }
+
+    // 安静模式下每秒打印各端口的收包速率
+    uint64_t last[E1000_MAX_DEVICES] = {0};
+    while (RUNNING) {
+        sleep(1);
+        if (!QUIET)
+            continue;
+        for (int i = 0; i < NR_PORTS; i++) {
+            struct e1000_stats stats;
+            e1000_stats_get(e1000_device_at(i), &stats);
+            printf("port %d: %lu pps%s", i, stats.rx.packets - last[i],
+                   i == NR_PORTS - 1 ? "\n" : ", ");
+            last[i] = stats.rx.packets;
+        }
+    }
+
+    for (int i = 0; i < NR_THREADS; i++)
+        pthread_join(workers[i].tid, NULL);
+
+    for (int i = 0; i < NR_PORTS; i++) {
+        struct e1000_device *dev = e1000_device_at(i);
+        printf("port %d ", i);
+        print_poll_stats(dev);
+        print_stats(dev);
+    }
+}
+
+/**
+ * @brief 抓包：接收方式和recv模式相同，每个端口写自己的pcap文件
+ */
+static void do_capture(void)
+{
+    for (int i = 0; i < NR_PORTS; i++) {
+        char path[PCAP_PATH_MAX];
+        int len;
+        if (NR_PORTS > 1)
+            len = snprintf(path, sizeof(path), "%s.port%d", CAPTURE_PATH, i);
+        else
+            len = snprintf(path, sizeof(path), "%s", CAPTURE_PATH);
+        if (len >= (int)sizeof(path)) {
+            printf("capture path too long: %s\n", CAPTURE_PATH);
+            goto out;
+        }
+        CAPTURES[i] = pcap_writer_open(path, SNAPLEN, ROTATE_SIZE, ROTATE_FILES);
+        if (!CAPTURES[i]) {
+            printf("pcap_writer_open %s failed\n", path);
+            goto out;
+        }
+        printf("port %d capture to %s, snaplen %u\n", i, path, CAPTURES[i]->snaplen);
+    }
+
+    do_recv();
+
+out:
+    for (int i = 0; i < NR_PORTS; i++) {
+        if (!CAPTURES[i])
+            continue;
+        struct pcap_writer_stats stats;
+        pcap_writer_close(CAPTURES[i], &stats);
+        CAPTURES[i] = NULL;
+        printf("port %d capture: %lu packets, %lu bytes, %lu files, %lu stalls\n",
+               i, stats.packets, stats.bytes, stats.files, stats.stalls);
+    }
+}
+
+static void *gen_worker(void *arg)
+{
+    pktgen_run((struct pktgen *)arg, &RUNNING);
+    return NULL;
+}
+
+/**
+ * @brief 报文生成：每个端口一个发送线程，主线程每秒打印实际速率
+ */
+static void do_gen(void)
+{
+    static struct pktgen gens[E1000_MAX_DEVICES];
+    pthread_t tids[E1000_MAX_DEVICES];
+    int nr = 0;
+
+    for (int i = 0; i < NR_PORTS; i++) {
+        if (pktgen_init(&gens[i], e1000_device_at(i), &GEN_CFG) < 0)
+            goto out;
+        nr++;
+    }
+    if (GEN_CFG.pcap)
+        printf("replay %u frames from %s", gens[0].trace.nr, GEN_CFG.pcap);
+    else
+        printf("send %u bytes udp frames in %u flows", GEN_CFG.pkt_len, GEN_CFG.nr_flows);
+    if (GEN_CFG.rate_bps)
+        printf(" at %.1f Mbit/s line rate", GEN_CFG.rate_bps / 1e6);
+    else if (GEN_CFG.rate_pps)
+        printf(" at %lu pps", GEN_CFG.rate_pps);
+    printf(" on %d ports, tsc %.3f GHz\n", NR_PORTS, pktgen_tsc_hz() / 1e9);
+
+    for (int i = 0; i < nr; i++) {
+        if (pthread_create(&tids[i], NULL, gen_worker, &gens[i]) != 0) {
+            printf("pthread_create failed\n");
+            RUNNING = 0;
+            for (int j = 0; j < i; j++)
+                pthread_join(tids[j], NULL);
+            goto out;
+        }
+    }
+
+    // 线路速率包括前导码、帧间隔和FCS，和-B的单位相同
+    struct pktgen_stats last[E1000_MAX_DEVICES];
+    memset(last, 0, sizeof(last));
+    uint64_t start = 0;
+    int done = 0;
+    while (RUNNING && done < nr) {
+        sleep(1);
+        start++;
+        done = 0;
+        for (int i = 0; i < nr; i++) {
+            struct pktgen_stats stats;
+            pktgen_stats_get(&gens[i], &stats);
+            uint64_t pkts = stats.tx_packets - last[i].tx_packets;
+            uint64_t bytes = stats.tx_bytes - last[i].tx_bytes;
+            printf("port %d: %lu pps, %.1f Mbit/s, line %.1f Mbit/s, ring full %lu, late %lu%s", i, pkts,
+                   bytes * 8 / 1e6, (bytes + pkts * PKTGEN_WIRE_OVERHEAD) * 8 / 1e6,
+                   stats.ring_full - last[i].ring_full, stats.late - last[i].late,
+                   i == nr - 1 ? "\n" : "; ");
+            last[i] = stats;
+            done += GEN_CFG.count && stats.tx_packets >= GEN_CFG.count;
+        }
+    }
+    RUNNING = 0;
+    for (int i = 0; i < nr; i++)
+        pthread_join(tids[i], NULL);
+
+    for (int i = 0; i < nr; i++) {
+        struct pktgen_stats stats;
+        pktgen_stats_get(&gens[i], &stats);
+        printf("port %d sent %lu packets, %lu bytes, average %.0f pps\n",
+               i, stats.tx_packets, stats.tx_bytes, start ? (double)stats.tx_packets / start : 0.0);
+        print_stats(e1000_device_at(i));
+    }
+
+out:
+    for (int i = 0; i < nr; i++)
+        pktgen_free(&gens[i]);
+}
+
+static int build_arp(struct e1000_device *dev, char *buf)
+{
+    struct eth_hdr *hdr = (struct eth_hdr *)buf;
+    for (int i = 0; i < 6; i++) {
+        hdr->dst[i] = 0xff;
+        hdr->src[i] = dev->mac_addr[i];
+    }
+    hdr->type = htons(ETH_TYPE_ARP);
+    struct arp_hdr *arp = (struct arp_hdr *)(buf + sizeof(struct eth_hdr));
+
+    arp->hw_type = htons(ARP_HW_TYPE_ETHERNET);
+    arp->proto_type = htons(ETH_TYPE_IP);
+    arp->hw_addr_len = 6;
+    arp->proto_addr_len = 4;
+    arp->opcode = htons(ARP_OP_REQUEST);
+    for (int i = 0; i < 6; i++) {
+        arp->sender_hw_addr[i] = dev->mac_addr[i];
+        arp->target_hw_addr[i] = 0xff;
+    }
+
+    arp->sender_ip_addr = inet_addr("1.2.3.4");
+    arp->target_ip_addr = inet_addr("1.2.3.4");
+    return sizeof(struct eth_hdr) + sizeof(struct arp_hdr);
+}
+
+static void do_send(void)
+{
+    // send arp gratuitous per 1s on every port
+    printf("sending arp gratuitous\n");
+    char *buf = malloc(2048);
+    int count = 0;
+    while (RUNNING) {
+        printf("send arp gratuitous %d\n", count++);
+        for (int i = 0; i < NR_PORTS; i++) {
+            struct e1000_device *dev = e1000_device_at(i);
+            int len = build_arp(dev, buf);
+            e1000_send(dev, buf, len);
+        }
+        sleep(1);
+    }
+    free(buf);
+    for (int i = 0; i < NR_PORTS; i++)
+        print_stats(e1000_device_at(i));
+}
+
+/**
+ * @brief 转发：端口2k和2k+1互相转发，端口数为奇数时最后一个端口原路发回
+ */
+static int fwd_handler(int port_id, struct pktbuf **pkts, int n, int *tx_port, void *arg)
+{
+    int peer = port_id ^ 1;
+    if (peer >= NR_PORTS)
+        peer = port_id;
+    struct e1000_device *dev = e1000_device_at(peer);
+    for (int i = 0; i < n; i++) {
+        struct eth_hdr *hdr = (struct eth_hdr *)pktbuf_data(pkts[i]);
+        memcpy(hdr->src, dev->mac_addr, 6);
+    }
+    *tx_port = peer;
+    return n;
+}
+
+static void do_fwd(void)
+{
+    struct engine eng;
+    engine_init(&eng, fwd_handler, NULL);
+
+    if (NR_WORKER_SPECS > 0) {
+        for (int i = 0; i < NR_WORKER_SPECS; i++) {
+            if (engine_parse(&eng, WORKER_SPECS[i]) < 0)
+                return;
+        }
+    } else {
+        // 默认不绑定CPU，每对端口交给同一个线程
+        int nr_pairs = (NR_PORTS + 1) / 2;
+        int nr_workers = NR_THREADS < nr_pairs ? NR_THREADS : nr_pairs;
+        for (int i = 0; i < nr_workers; i++)
+            engine_add_worker(&eng, -1);
+        for (int i = 0; i < NR_PORTS; i++)
+            engine_assign(&eng, (i / 2) % nr_workers, i);
+    }
+    for (int i = 0; i < NR_PORTS; i++) {
+        int peer = (i ^ 1) < NR_PORTS ? (i ^ 1) : i;
+        if (eng.port_owner[i] < 0)
+            printf("warning: port %d is not assigned to any worker\n", i);
+        else if (eng.port_owner[peer] != eng.port_owner[i])
+            printf("warning: port %d and %d are on different workers, packets will be dropped\n", i, peer);
+    }
+
+    if (engine_start(&eng) < 0)
+        return;
+    printf("start forwarding on %d ports with %d workers...\n", NR_PORTS, eng.nr_workers);
+
+    // 每秒打印各工作线程的转发速率
+    struct engine_worker_stats last[ENGINE_MAX_WORKERS];
+    memset(last, 0, sizeof(last));
+    while (RUNNING) {
+        sleep(1);
+        for (int i = 0; i < eng.nr_workers; i++) {
+            struct engine_worker_stats stats;
+            engine_stats_get(&eng, i, &stats);
+            printf("worker %d (cpu %d): rx %lu pps, tx %lu pps, drop %lu pps%s", i, eng.workers[i].cpu,
+                   stats.rx_packets - last[i].rx_packets, stats.tx_packets - last[i].tx_packets,
+                   stats.tx_drops - last[i].tx_drops, i == eng.nr_workers - 1 ? "\n" : "; ");
+            last[i] = stats;
+        }
+    }
+    engine_stop(&eng);
+
+    for (int i = 0; i < eng.nr_workers; i++) {
+        struct engine_worker_stats stats;
+        engine_stats_get(&eng, i, &stats);
+        printf("worker %d (cpu %d): rx %lu, tx %lu, drops %lu, idle loops %.1f%%\n",
+               i, eng.workers[i].cpu, stats.rx_packets, stats.tx_packets, stats.tx_drops,
+               stats.loops ? stats.idle_loops * 100.0 / stats.loops : 0.0);
+    }
+    for (int i = 0; i < NR_PORTS; i++)
+        print_stats(e1000_device_at(i));
+}
+
+/**
+ * @brief 按-V打开VLAN剥离和过滤，只接收列出的VLAN
+ */
+static int setup_vlan(struct e1000_device *dev, const char *spec)
+{
+    const char *p = spec;
+    char *end;
+    do {
+        long vid = strtol(p, &end, 10);
+        if (end == p || vid < 0 || vid > 4095) {
+            printf("invalid vlan list: %s\n", spec);
+            return -1;
+        }
+        e1000_vlan_filter_set(dev, vid, 1);
+        p = end + 1;
+    } while (*end == ',');
+    if (*end != '\0') {
+        printf("invalid vlan list: %s\n", spec);
+        return -1;
+    }
+    e1000_vlan_strip(dev, 1);
+    e1000_vlan_filter(dev, 1);
     return 0;
 }
 
@@ -58,61 +634,56 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    struct e1000_device *dev = e1000_device_get(PCI_ID);
-    if (!dev) {
-        printf("e1000_device_get failed\n");
-        return -1;
+    if (MODE == BENCH_MODE)
+        return bench_run(BENCH_NAME) < 0 ? -1 : 0;
+
+    for (int i = 0; i < NR_PORTS; i++) {
+        if (!e1000_device_get(PCI_IDS[i])) {
+            printf("e1000_device_get %s failed\n", PCI_IDS[i]);
+            return -1;
+        }
     }
 
-    e1000_init(dev);
-    printf("get NIC MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
-           dev->mac_addr[0], dev->mac_addr[1],
-           dev->mac_addr[2], dev->mac_addr[3],
-           dev->mac_addr[4], dev->mac_addr[5]);
+    // 所有端口的描述符环和缓冲池都从同一块DMA内存分配
+    size_t dma_size = (size_t)NR_PORTS * e1000_dma_mem_size(RX_NR, TX_NR);
+    if (MODE == GEN_MODE)
+        dma_size += (size_t)NR_PORTS * pktgen_dma_mem_size(TX_NR);
+    if (dma_mem_init(dma_size > DMA_MEM_DEFAULT_SIZE ? dma_size : DMA_MEM_DEFAULT_SIZE) < 0) {
+        printf("dma_mem_init failed\n");
+        return -1;
+    }
 
-    if (MODE == RECV_MODE) {
-        printf("start recv...\n");
-        char *buf = malloc(2048);
-        while (1) {
-            e1000_recv(dev, buf, 2048);
-            struct eth_hdr *hdr = (struct eth_hdr *)buf;
-            printf("receive packet src:  %02x:%02x:%02x:%02x:%02x:%02x\n",
-                    hdr->src[0], hdr->src[1], hdr->src[2],
-                    hdr->src[3], hdr->src[4], hdr->src[5]);
-            printf("               dest: %02x:%02x:%02x:%02x:%02x:%02x\n",
-                    hdr->dst[0], hdr->dst[1], hdr->dst[2],
-                    hdr->dst[3], hdr->dst[4], hdr->dst[5]); 
-        }
-    } else {
-        // send arp gratuitous per 1s
-        printf("sending arp gratuitous\n");
-        char *buf = malloc(2048);
-        struct eth_hdr *hdr = (struct eth_hdr *)buf;
-        for (int i = 0; i < 6; i++) {
-            hdr->dst[i] = 0xff;
-            hdr->src[i] = dev->mac_addr[i];
-        }
-        hdr->type = htons(ETH_TYPE_ARP);
-        struct arp_hdr *arp = (struct arp_hdr *)(buf + sizeof(struct eth_hdr));
-
-        arp->hw_type = htons(ARP_HW_TYPE_ETHERNET);
-        arp->proto_type = htons(ETH_TYPE_IP);
-        arp->hw_addr_len = 6;
-        arp->proto_addr_len = 4;
-        arp->opcode = htons(ARP_OP_REQUEST);
-        for (int i = 0; i < 6; i++) {
-            arp->sender_hw_addr[i] = dev->mac_addr[i];
-            arp->target_hw_addr[i] = 0xff;
-        }
-
-        arp->sender_ip_addr = inet_addr("1.2.3.4");
-        arp->target_ip_addr = inet_addr("1.2.3.4");
-        int count = 0;
-        while (1) {
-            printf("send arp gratuitous %d\n", count++);
-            e1000_send(dev, buf, sizeof(struct eth_hdr) + sizeof(struct arp_hdr));
-            sleep(1);
+    for (int i = 0; i < NR_PORTS; i++) {
+        struct e1000_device *dev = e1000_device_at(i);
+        if (e1000_set_mtu(dev, MTU) < 0)
+            return -1;
+        if (VLAN_SPEC && setup_vlan(dev, VLAN_SPEC) < 0)
+            return -1;
+        e1000_promisc(dev, PROMISC);
+        if (e1000_init(dev, RX_NR, TX_NR) < 0) {
+            printf("e1000_init %s failed\n", dev->name);
+            return -1;
         }
+        printf("port %d %s MAC: %02x:%02x:%02x:%02x:%02x:%02x\n", i, dev->name,
+               dev->mac_addr[0], dev->mac_addr[1],
+               dev->mac_addr[2], dev->mac_addr[3],
+               dev->mac_addr[4], dev->mac_addr[5]);
+        e1000_stats_start(dev, E1000_STATS_INTERVAL_MS);
     }
+    signal(SIGINT, on_signal);
+
+    if (MODE == RECV_MODE)
+        do_recv();
+    else if (MODE == CAPTURE_MODE)
+        do_capture();
+    else if (MODE == GEN_MODE)
+        do_gen();
+    else if (MODE == FWD_MODE)
+        do_fwd();
+    else
+        do_send();
+
+    for (int i = 0; i < NR_PORTS; i++)
+        e1000_stats_stop(e1000_device_at(i));
     return 0;
-}
\ No newline at end of file
+}
@@ -1,94 +1,328 @@
-
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <sys/mman.h>
 #include "mem_alloc.h"
 
-#define PAGE_TABLE_NR 2048
-static struct page page_table[PAGE_TABLE_NR];
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
 
-static struct page *get_free_page() {
-    for (int i = 0; i < PAGE_TABLE_NR; i++) {
-        if (page_table[i].addr == NULL) {
-            return &page_table[i];
-        }
+#define HUGEPAGE_2MB (1UL << 21)
+#define HUGEPAGE_1GB (1UL << 30)
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+/**
+ * DMA内存区
+ * 
+ * 启动时一次性映射一整块内存，优先使用大页，没有配置大页时退化成锁定的4K页。
+ * 每个页的物理地址只在初始化时解析一次，记录在dma_map里，
+ * 之后描述符环和报文缓冲区都从这里切分。
+ */
+static struct {
+    char *base;
+    size_t size;
+    size_t used;
+    size_t page_size;
+} arena;
+
+static struct addr_map dma_map;
+static int iova_va = 0; // 为1时直接用虚拟地址充当DMA地址，仅用于软件模拟的网卡
+
+// 斐波那契散列，页帧号通常是连续的，乘法散列能把它们打散
+static inline size_t addr_map_hash(const struct addr_map *m, uint64_t frame)
+{
+    return (size_t)((frame * 0x9E3779B97F4A7C15ULL) >> 32) & m->mask;
+}
+
+/**
+ * @brief 初始化地址映射表
+ * 
+ * 虚拟地址->物理地址、物理地址->虚拟地址各一张开放寻址散列表，
+ * 以页帧号为键，装载因子不超过1/2，两个方向的查找都是常数时间。
+ * 
+ * @param nr_pages: 最多登记的页数
+ * @param page_shift: 页大小的log2
+ */
+int addr_map_init(struct addr_map *m, size_t nr_pages, unsigned page_shift)
+{
+    size_t buckets = 16;
+    while (buckets < nr_pages * 2)
+        buckets <<= 1;
+
+    m->page_shift = page_shift;
+    m->mask = buckets - 1;
+    m->nr = 0;
+    m->v2p = calloc(buckets, sizeof(struct addr_map_entry));
+    m->p2v = calloc(buckets, sizeof(struct addr_map_entry));
+    if (!m->v2p || !m->p2v) {
+        addr_map_destroy(m);
+        return -1;
     }
-    return NULL;
+    return 0;
 }
 
-static void *get_phys_addr(void *virt_addr)
+void addr_map_destroy(struct addr_map *m)
 {
-    uint64_t page_frame_num;
-    int fd = open("/proc/self/pagemap", O_RDONLY);
-    if (fd < 0) {
-        return NULL;
+    free(m->v2p);
+    free(m->p2v);
+    m->v2p = NULL;
+    m->p2v = NULL;
+    m->nr = 0;
+}
+
+static int addr_map_insert(struct addr_map *m, struct addr_map_entry *table,
+                           uint64_t key, uint64_t val)
+{
+    size_t i = addr_map_hash(m, key);
+    // 键存页帧号+1，0表示空槽
+    while (table[i].key != 0) {
+        if (table[i].key == key + 1)
+            return -1;
+        i = (i + 1) & m->mask;
     }
+    table[i].key = key + 1;
+    table[i].val = val;
+    return 0;
+}
 
+/**
+ * @brief 登记一个页的虚拟地址和物理地址，两个地址都必须按页对齐
+ */
+int addr_map_add(struct addr_map *m, void *virt, void *phys)
+{
+    if (m->nr * 2 >= m->mask + 1)
+        return -1;
+    uint64_t vframe = (uint64_t)virt >> m->page_shift;
+    uint64_t pframe = (uint64_t)phys >> m->page_shift;
+    if (addr_map_insert(m, m->v2p, vframe, pframe) < 0)
+        return -1;
+    if (addr_map_insert(m, m->p2v, pframe, vframe) < 0)
+        return -1;
+    m->nr++;
+    return 0;
+}
+
+static inline void *addr_map_lookup(const struct addr_map *m,
+                                    const struct addr_map_entry *table, void *addr)
+{
+    uint64_t frame = (uint64_t)addr >> m->page_shift;
+    uint64_t offset = (uint64_t)addr & ((1ULL << m->page_shift) - 1);
+    size_t i = addr_map_hash(m, frame);
+    while (table[i].key != 0) {
+        if (table[i].key == frame + 1)
+            return (void *)((table[i].val << m->page_shift) | offset);
+        i = (i + 1) & m->mask;
+    }
+    return NULL;
+}
+
+void *addr_map_v2p(const struct addr_map *m, void *virt)
+{
+    return addr_map_lookup(m, m->v2p, virt);
+}
+
+void *addr_map_p2v(const struct addr_map *m, void *phys)
+{
+    return addr_map_lookup(m, m->p2v, phys);
+}
+
+static void *get_phys_addr(int fd, void *virt_addr)
+{
+    uint64_t page_frame_num;
     int page_size = getpagesize();
 
     off_t offset = ((uint64_t)virt_addr / page_size) * sizeof(uint64_t);
 
-    // Seek to the offset
-    if (lseek(fd, offset, SEEK_SET) == (off_t)-1) {
-        printf("lseek failed\n");
-        close(fd);
-        return NULL;
-    }
-
     // Read the page frame number from the pagemap
-    if (read(fd, &page_frame_num, sizeof(uint64_t)) != sizeof(uint64_t)) {
-        printf("read failed\n");
-        close(fd);
+    if (pread(fd, &page_frame_num, sizeof(uint64_t), offset) != sizeof(uint64_t)) {
+        printf("read pagemap failed\n");
         return NULL;
     }
 
+    // 没有CAP_SYS_ADMIN权限时，读到的页帧号是0
     page_frame_num &= ((1ULL << 55) - 1);
-    uint64_t phys_addr = ((page_frame_num & 0x7fffffffffffffULL) * page_size)
+    if (page_frame_num == 0)
+        return NULL;
+
+    uint64_t phys_addr = (page_frame_num * page_size)
                 + ((unsigned long)virt_addr % page_size);
     return (void *)phys_addr;
 }
 
-struct page *alloc_page() {
+/**
+ * @brief 映射DMA内存
+ * 
+ * 依次尝试1G大页、2M大页，都失败时使用锁定的4K页。
+ * 4K页锁不住时物理地址随时会变，网卡可能DMA到换出或者迁移走的页，这时返回NULL；
+ * 软件模拟的网卡直接用虚拟地址，不需要锁定。
+ */
+static void *dma_mem_map(size_t *size, size_t *page_size)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
     void *addr;
-    int page_size = getpagesize();
-    posix_memalign(&addr, page_size, page_size);
-    memset(addr, 0, page_size);
-    struct page *p = get_free_page();
-    p->addr = addr;
-    p->phys_addr = get_phys_addr(addr);
-    if (p->phys_addr == NULL) {
-        free(p);
+
+    if (*size >= HUGEPAGE_1GB) {
+        size_t len = ALIGN_UP(*size, HUGEPAGE_1GB);
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        if (addr != MAP_FAILED) {
+            *size = len;
+            *page_size = HUGEPAGE_1GB;
+            return addr;
+        }
+    }
+
+    size_t len = ALIGN_UP(*size, HUGEPAGE_2MB);
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    if (addr != MAP_FAILED) {
+        *size = len;
+        *page_size = HUGEPAGE_2MB;
+        return addr;
+    }
+
+    printf("no hugepages available, fallback to 4K pages\n");
+    len = ALIGN_UP(*size, getpagesize());
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (addr == MAP_FAILED)
         return NULL;
+    // 锁定在内存里，保证物理地址不会变
+    if (mlock(addr, len) < 0) {
+        perror("mlock");
+        if (!iova_va) {
+            munmap(addr, len);
+            return NULL;
+        }
+    }
+    *size = len;
+    *page_size = getpagesize();
+    return addr;
+}
+
+/**
+ * @brief 初始化DMA内存区
+ * 
+ * 可以不调用，第一次dma_alloc()时会按DMA_MEM_DEFAULT_SIZE初始化。
+ * 
+ * @param size: 内存区大小，会向上对齐到页大小
+ */
+int dma_mem_init(size_t size)
+{
+    if (arena.base)
+        return 0;
+
+    size_t page_size;
+    char *base = dma_mem_map(&size, &page_size);
+    if (!base) {
+        printf("dma_mem_map failed\n");
+        return -1;
+    }
+    memset(base, 0, size);
+
+    size_t nr_pages = size / page_size;
+    if (addr_map_init(&dma_map, nr_pages, __builtin_ctzl(page_size)) < 0)
+        goto error;
+
+    int fd = -1;
+    if (!iova_va) {
+        fd = open("/proc/self/pagemap", O_RDONLY);
+        if (fd < 0) {
+            perror("open pagemap");
+            goto error;
+        }
+    }
+    for (size_t i = 0; i < nr_pages; i++) {
+        void *addr = base + i * page_size;
+        void *phys = iova_va ? addr : get_phys_addr(fd, addr);
+        if (phys == NULL) {
+            printf("get_phys_addr failed, are you root?\n");
+            close(fd);
+            goto error;
+        }
+        // 表满了或者页重复时这一页没法转换，DMA到它的地址会失败
+        if (addr_map_add(&dma_map, addr, phys) < 0) {
+            printf("addr_map_add failed, page %zu\n", i);
+            if (fd >= 0)
+                close(fd);
+            goto error;
+        }
     }
-    return p->addr;
+    if (fd >= 0)
+        close(fd);
+
+    arena.base = base;
+    arena.size = size;
+    arena.used = 0;
+    arena.page_size = page_size;
+    printf("dma memory: %zu MB, page size %zu KB\n", size >> 20, page_size >> 10);
+    return 0;
+
+error:
+    addr_map_destroy(&dma_map);
+    munmap(base, size);
+    return -1;
 }
 
-void free_page(struct page *p) {
-    free(p->addr);
-    p->addr = NULL;
-    p->phys_addr = NULL;
+/**
+ * @brief 检查[off, off + size)是否物理连续
+ * 
+ * @return 连续时返回0，否则返回第一个不连续处的下一页的偏移
+ */
+static size_t dma_phys_contig(size_t off, size_t size)
+{
+    size_t first = off / arena.page_size;
+    size_t last = (off + size - 1) / arena.page_size;
+    for (size_t i = first; i < last; i++) {
+        char *phys = virt_to_phys(arena.base + i * arena.page_size);
+        char *next = virt_to_phys(arena.base + (i + 1) * arena.page_size);
+        if (next != phys + arena.page_size)
+            return (i + 1) * arena.page_size;
+    }
+    return 0;
 }
 
-void *phys_to_virt(void *phys_addr)
+/**
+ * @brief 从DMA内存区分配一块物理连续的内存
+ * 
+ * 内存已经清零，不支持释放，描述符环和缓冲池在程序运行期间一直存在。
+ * 
+ * @param align: 对齐，必须是2的幂
+ */
+void *dma_alloc(size_t size, size_t align)
 {
-    for (int i = 0; i < PAGE_TABLE_NR; i++) {
-        if (page_table[i].phys_addr == phys_addr) {
-            return page_table[i].addr;
+    if (!arena.base && dma_mem_init(DMA_MEM_DEFAULT_SIZE) < 0)
+        return NULL;
+
+    size_t off = ALIGN_UP(arena.used, align);
+    while (off + size <= arena.size) {
+        size_t next = dma_phys_contig(off, size);
+        if (next == 0) {
+            arena.used = off + size;
+            return arena.base + off;
         }
+        // 跨越了物理不连续的页，从不连续处重新开始
+        off = ALIGN_UP(next, align);
     }
+    printf("dma_alloc: out of memory, size %zu\n", size);
     return NULL;
 }
 
+void mem_set_iova_va(int enable)
+{
+    iova_va = enable;
+}
+
+void *phys_to_virt(void *phys_addr)
+{
+    return addr_map_p2v(&dma_map, phys_addr);
+}
+
 void *virt_to_phys(void *virt_addr)
 {
-    for (int i = 0; i < PAGE_TABLE_NR; i++) {
-        if (page_table[i].addr == virt_addr) {
-            return page_table[i].phys_addr;
-        }
-    }
-    return NULL;
+    return addr_map_v2p(&dma_map, virt_addr);
 }
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "mem_alloc.h"
+#include "mempool.h"
+
+static __thread int thread_id = -1;
+static int thread_id_next = 0;
+
+/**
+ * @brief 当前线程的编号，第一次调用时分配
+ * 
+ * @return 超过MEMPOOL_MAX_THREADS时返回-1，表示不使用缓存
+ */
+static inline int mempool_thread_id(void)
+{
+    if (thread_id == -1) {
+        int id = __atomic_fetch_add(&thread_id_next, 1, __ATOMIC_RELAXED);
+        thread_id = id < MEMPOOL_MAX_THREADS ? id : -2;
+    }
+    return thread_id >= 0 ? thread_id : -1;
+}
+
+/**
+ * @brief 创建缓冲池
+ * 
+ * @param n: 对象个数
+ * @param elt_size: 每个对象的大小，按cache line对齐分配
+ * @param init: 对象初始化函数，可以为NULL
+ */
+struct mempool *mempool_create(unsigned n, unsigned elt_size, mempool_obj_init_t init, void *arg)
+{
+    struct mempool *mp = aligned_alloc(64, sizeof(struct mempool));
+    if (!mp)
+        return NULL;
+    memset(mp, 0, sizeof(struct mempool));
+
+    mp->ring = ring_create(n, 0);
+    if (!mp->ring) {
+        free(mp);
+        return NULL;
+    }
+    mp->size = n;
+    mp->elt_size = elt_size;
+
+    for (unsigned i = 0; i < n; i++) {
+        void *obj = dma_alloc(elt_size, 64);
+        if (!obj) {
+            printf("dma_alloc failed\n");
+            ring_free(mp->ring);
+            free(mp);
+            return NULL;
+        }
+        if (init)
+            init(mp, obj, arg);
+        ring_enqueue_bulk(mp->ring, &obj, 1);
+    }
+    return mp;
+}
+
+/**
+ * @brief 批量分配n个对象，要么全部成功，要么一个都不分配
+ * 
+ * @return 成功返回0，对象不够时返回-1
+ */
+int mempool_get_bulk(struct mempool *mp, void **objs, unsigned n)
+{
+    int id = mempool_thread_id();
+    if (id < 0 || n > MEMPOOL_CACHE_SIZE)
+        return ring_dequeue_bulk(mp->ring, objs, n) ? 0 : -1;
+
+    struct mempool_cache *cache = &mp->caches[id];
+    if (cache->len < n) {
+        // 缓存不够，从共享环补充一批
+        unsigned want = MEMPOOL_CACHE_SIZE + n - cache->len;
+        if (!ring_dequeue_bulk(mp->ring, &cache->objs[cache->len], want)) {
+            if (!ring_dequeue_bulk(mp->ring, objs, n))
+                return -1;
+            return 0;
+        }
+        cache->len += want;
+    }
+    for (unsigned i = 0; i < n; i++)
+        objs[i] = cache->objs[--cache->len];
+    return 0;
+}
+
+void mempool_put_bulk(struct mempool *mp, void **objs, unsigned n)
+{
+    int id = mempool_thread_id();
+    if (id < 0 || n > MEMPOOL_CACHE_SIZE) {
+        ring_enqueue_bulk(mp->ring, objs, n);
+        return;
+    }
+
+    struct mempool_cache *cache = &mp->caches[id];
+    // n通常很小，逐个拷贝比调用memcpy快
+    for (unsigned i = 0; i < n; i++)
+        cache->objs[cache->len + i] = objs[i];
+    cache->len += n;
+    // 缓存太满，多出来的还给共享环
+    if (cache->len >= MEMPOOL_CACHE_FLUSH) {
+        ring_enqueue_bulk(mp->ring, &cache->objs[MEMPOOL_CACHE_SIZE],
+                             cache->len - MEMPOOL_CACHE_SIZE);
+        cache->len = MEMPOOL_CACHE_SIZE;
+    }
+}
+
+void *mempool_get(struct mempool *mp)
+{
+    void *obj;
+    if (mempool_get_bulk(mp, &obj, 1) < 0)
+        return NULL;
+    return obj;
+}
+
+void mempool_put(struct mempool *mp, void *obj)
+{
+    mempool_put_bulk(mp, &obj, 1);
+}
+
+/**
+ * @brief 把当前线程缓存的对象全部还给共享环
+ */
+void mempool_cache_flush(struct mempool *mp)
+{
+    int id = mempool_thread_id();
+    if (id < 0)
+        return;
+    struct mempool_cache *cache = &mp->caches[id];
+    ring_enqueue_bulk(mp->ring, cache->objs, cache->len);
+    cache->len = 0;
+}
+
+/**
+ * @brief 可用对象个数，其他线程正在分配释放时只是个近似值
+ */
+unsigned mempool_avail(struct mempool *mp)
+{
+    unsigned count = ring_count(mp->ring);
+    for (int i = 0; i < MEMPOOL_MAX_THREADS; i++)
+        count += mp->caches[i].len;
+    return count;
+}
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include "e1000.h"
+#include "pcap.h"
+
+/**
+ * @brief 把pcap文件整个读进内存并建立报文索引
+ * 
+ * 支持微秒和纳秒两种时间戳精度，以及大小端两种字节序。
+ */
+int pcap_load(const char *path, struct pcap_trace *trace)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open pcap");
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct pcap_file_hdr)) {
+        printf("invalid pcap file %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    memset(trace, 0, sizeof(struct pcap_trace));
+    trace->buf = malloc(st.st_size);
+    if (!trace->buf) {
+        close(fd);
+        return -1;
+    }
+    size_t size = 0;
+    while (size < (size_t)st.st_size) {
+        ssize_t ret = read(fd, trace->buf + size, st.st_size - size);
+        if (ret <= 0)
+            break;
+        size += ret;
+    }
+    close(fd);
+
+    struct pcap_file_hdr *fh = (struct pcap_file_hdr *)trace->buf;
+    int swap = 0, nsec = 0;
+    if (fh->magic == PCAP_MAGIC || fh->magic == PCAP_MAGIC_NSEC) {
+        nsec = fh->magic == PCAP_MAGIC_NSEC;
+    } else if (fh->magic == __builtin_bswap32(PCAP_MAGIC) ||
+               fh->magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        swap = 1;
+        nsec = fh->magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+    } else {
+        printf("%s is not a pcap file\n", path);
+        goto error;
+    }
+    uint32_t linktype = swap ? __builtin_bswap32(fh->linktype) : fh->linktype;
+    if (linktype != PCAP_LINKTYPE_ETHERNET) {
+        printf("unsupported pcap linktype %u\n", linktype);
+        goto error;
+    }
+
+    // 先数一遍报文个数
+    unsigned cap = 0;
+    size_t off = sizeof(struct pcap_file_hdr);
+    while (off + sizeof(struct pcap_pkt_hdr) <= size) {
+        struct pcap_pkt_hdr *ph = (struct pcap_pkt_hdr *)(trace->buf + off);
+        uint32_t caplen = swap ? __builtin_bswap32(ph->caplen) : ph->caplen;
+        off += sizeof(struct pcap_pkt_hdr) + caplen;
+        if (off > size)
+            break;
+        cap++;
+    }
+    trace->pkts = malloc((cap ? cap : 1) * sizeof(struct pcap_pkt));
+    if (!trace->pkts)
+        goto error;
+
+    off = sizeof(struct pcap_file_hdr);
+    for (unsigned i = 0; i < cap; i++) {
+        struct pcap_pkt_hdr *ph = (struct pcap_pkt_hdr *)(trace->buf + off);
+        uint32_t ts_sec = swap ? __builtin_bswap32(ph->ts_sec) : ph->ts_sec;
+        uint32_t ts_frac = swap ? __builtin_bswap32(ph->ts_frac) : ph->ts_frac;
+        uint32_t caplen = swap ? __builtin_bswap32(ph->caplen) : ph->caplen;
+        struct pcap_pkt *pkt = &trace->pkts[trace->nr++];
+        pkt->data = trace->buf + off + sizeof(struct pcap_pkt_hdr);
+        pkt->len = caplen;
+        pkt->ts_ns = (uint64_t)ts_sec * 1000000000ULL + (nsec ? ts_frac : (uint64_t)ts_frac * 1000);
+        off += sizeof(struct pcap_pkt_hdr) + caplen;
+    }
+    return 0;
+
+error:
+    pcap_trace_free(trace);
+    return -1;
+}
+
+void pcap_trace_free(struct pcap_trace *trace)
+{
+    free(trace->buf);
+    free(trace->pkts);
+    memset(trace, 0, sizeof(struct pcap_trace));
+}
+
+static void pcap_file_name(struct pcap_writer *w, char *name, size_t size)
+{
+    unsigned seq = w->file_seq++;
+    if (!w->rotate_size)
+        snprintf(name, size, "%s", w->path);
+    else if (w->rotate_files)
+        snprintf(name, size, "%s.%u", w->path, seq % w->rotate_files);
+    else
+        snprintf(name, size, "%s.%u", w->path, seq);
+}
+
+// 块写满后所在的文件是否也写满了
+static int pcap_chunk_last(struct pcap_writer *w, struct pcap_chunk *c)
+{
+    return w->rotate_size && (uint64_t)c->off + c->size >= w->rotate_size;
+}
+
+/**
+ * @brief 准备prev之后的一块：扩展文件并映射，MAP_POPULATE让缺页在后台线程里完成
+ * 
+ * prev所在的文件写满时打开新文件，并写好文件头。
+ */
+static int pcap_chunk_prepare(struct pcap_writer *w, struct pcap_chunk *c, struct pcap_chunk *prev)
+{
+    int fd;
+    off_t off;
+    int new_file = !prev || pcap_chunk_last(w, prev);
+    if (new_file) {
+        char name[PCAP_PATH_MAX - sizeof(".part") + 1];
+        pcap_file_name(w, name, sizeof(name));
+        // 提前建好的文件先不占用正式的文件名，轮转时不会过早覆盖最早的文件
+        snprintf(c->path, sizeof(c->path), prev ? "%s.part" : "%s", name);
+        fd = open(c->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("open pcap");
+            return -1;
+        }
+        off = 0;
+    } else {
+        strcpy(c->path, prev->path);
+        fd = prev->fd;
+        off = prev->off + prev->size;
+    }
+
+    int err = posix_fallocate(fd, off, PCAP_CHUNK_SIZE);
+    if (err && ftruncate(fd, off + PCAP_CHUNK_SIZE) < 0) {
+        printf("extend %s: %s\n", c->path, strerror(errno));
+        goto error;
+    }
+    void *base = mmap(NULL, PCAP_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, off);
+    if (base == MAP_FAILED) {
+        perror("mmap pcap");
+        goto error;
+    }
+    c->base = base;
+    c->size = PCAP_CHUNK_SIZE;
+    c->used = 0;
+    c->off = off;
+    c->fd = fd;
+
+    if (new_file) {
+        struct pcap_file_hdr fh = {
+            .magic = PCAP_MAGIC_NSEC,
+            .version_major = 2,
+            .version_minor = 4,
+            .snaplen = w->snaplen,
+            .linktype = PCAP_LINKTYPE_ETHERNET,
+        };
+        memcpy(c->base, &fh, sizeof(fh));
+        c->used = sizeof(fh);
+    }
+    return 0;
+
+error:
+    if (new_file) {
+        close(fd);
+        unlink(c->path);
+    }
+    return -1;
+}
+
+// 解除映射，文件写完时截掉预留的部分
+static void pcap_chunk_release(struct pcap_chunk *c, int last)
+{
+    munmap(c->base, c->size);
+    c->base = NULL;
+    if (last) {
+        if (ftruncate(c->fd, c->off + c->used) < 0)
+            printf("truncate %s: %s\n", c->path, strerror(errno));
+        close(c->fd);
+    }
+}
+
+// 开始写提前建好的文件时改成正式的文件名
+static void pcap_file_commit(struct pcap_chunk *c)
+{
+    char name[sizeof(c->path)];
+    size_t len = strlen(c->path);
+    if (len < 5 || strcmp(c->path + len - 5, ".part") != 0)
+        return;
+    snprintf(name, sizeof(name), "%.*s", (int)(len - 5), c->path);
+    if (rename(c->path, name) < 0)
+        printf("rename %s: %s\n", c->path, strerror(errno));
+    else
+        strcpy(c->path, name);
+}
+
+// 后台线程：回收换下来的块，准备下一块
+static void *pcap_writer_thread(void *arg)
+{
+    struct pcap_writer *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->running) {
+        if (w->next_ready || w->error) {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+        struct pcap_chunk *cur = &w->chunks[w->cur];
+        struct pcap_chunk *next = &w->chunks[!w->cur];
+        int retire = w->retire;
+        pthread_mutex_unlock(&w->lock);
+
+        if (retire) {
+            pcap_chunk_release(next, pcap_chunk_last(w, next));
+            if (cur->off == 0)
+                pcap_file_commit(cur);
+        }
+        int ret = pcap_chunk_prepare(w, next, cur);
+
+        pthread_mutex_lock(&w->lock);
+        w->retire = 0;
+        if (ret < 0)
+            w->error = 1;
+        else
+            w->next_ready = 1;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/**
+ * @brief 创建pcap文件
+ * 
+ * @param snaplen 每个报文最多保存的长度，0表示PCAP_SNAPLEN_MAX
+ * @param rotate_size 每个文件的大小上限，超过后依次写到path.0、path.1...，0表示只写path一个文件
+ * @param rotate_files 轮转的文件个数，写满后从path.0开始覆盖，0表示不限
+ */
+struct pcap_writer *pcap_writer_open(const char *path, uint32_t snaplen,
+                                     uint64_t rotate_size, unsigned rotate_files)
+{
+    struct pcap_writer *w = calloc(1, sizeof(struct pcap_writer));
+    if (!w)
+        return NULL;
+    if (strlen(path) >= sizeof(w->path)) {
+        printf("pcap path too long, max %zu bytes: %s\n", sizeof(w->path) - 1, path);
+        free(w);
+        return NULL;
+    }
+    strcpy(w->path, path);
+    w->snaplen = snaplen && snaplen < PCAP_SNAPLEN_MAX ? snaplen : PCAP_SNAPLEN_MAX;
+    if (rotate_size) {
+        w->rotate_size = (rotate_size + PCAP_CHUNK_SIZE - 1) / PCAP_CHUNK_SIZE * PCAP_CHUNK_SIZE;
+        // 准备新文件时当前文件还在写，至少要两个文件轮流用
+        if (rotate_files == 1)
+            rotate_files = 2;
+        w->rotate_files = rotate_files;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pcap_chunk_prepare(w, &w->chunks[0], NULL) < 0)
+        goto error;
+    w->stats.files = 1;
+    w->stats.bytes = sizeof(struct pcap_file_hdr);
+    w->running = 1;
+    if (pthread_create(&w->tid, NULL, pcap_writer_thread, w)) {
+        pcap_chunk_release(&w->chunks[0], 1);
+        goto error;
+    }
+    return w;
+
+error:
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w);
+    return NULL;
+}
+
+// 换到后台线程准备好的下一块
+static int pcap_writer_switch(struct pcap_writer *w)
+{
+    pthread_mutex_lock(&w->lock);
+    if (!w->next_ready && !w->error) {
+        w->stats.stalls++;
+        while (!w->next_ready && !w->error)
+            pthread_cond_wait(&w->cond, &w->lock);
+    }
+    if (w->error) {
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+    w->cur = !w->cur;
+    w->next_ready = 0;
+    w->retire = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    if (w->chunks[w->cur].off == 0) {
+        w->stats.files++;
+        w->stats.bytes += sizeof(struct pcap_file_hdr);
+    }
+    return 0;
+}
+
+/**
+ * @brief 写报文头，之后由调用者用pcap_writer_append()写入caplen字节的数据
+ * 
+ * @param len 报文原始长度
+ * @param caplen 返回实际保存的长度，不超过snaplen
+ */
+int pcap_writer_begin(struct pcap_writer *w, uint64_t ts_ns, uint32_t len, uint32_t *caplen)
+{
+    uint32_t n = len < w->snaplen ? len : w->snaplen;
+    struct pcap_chunk *c = &w->chunks[w->cur];
+
+    // 报文可以跨块，但不能跨文件
+    if (c->size - c->used < sizeof(struct pcap_pkt_hdr) + n &&
+        pcap_chunk_last(w, c) && pcap_writer_switch(w) < 0)
+        return -1;
+
+    struct pcap_pkt_hdr ph = {
+        .ts_sec = ts_ns / 1000000000ULL,
+        .ts_frac = ts_ns % 1000000000ULL,
+        .caplen = n,
+        .len = len,
+    };
+    if (pcap_writer_append(w, &ph, sizeof(ph)) < 0)
+        return -1;
+    w->stats.packets++;
+    *caplen = n;
+    return 0;
+}
+
+int pcap_writer_append(struct pcap_writer *w, const void *data, uint32_t n)
+{
+    const uint8_t *p = data;
+    while (n) {
+        struct pcap_chunk *c = &w->chunks[w->cur];
+        if (c->used == c->size) {
+            if (pcap_writer_switch(w) < 0)
+                return -1;
+            continue;
+        }
+        size_t len = c->size - c->used;
+        if (len > n)
+            len = n;
+        memcpy(c->base + c->used, p, len);
+        c->used += len;
+        p += len;
+        n -= len;
+        w->stats.bytes += len;
+    }
+    return 0;
+}
+
+int pcap_write(struct pcap_writer *w, uint64_t ts_ns, const void *data, uint32_t len)
+{
+    uint32_t caplen;
+    if (pcap_writer_begin(w, ts_ns, len, &caplen) < 0)
+        return -1;
+    return pcap_writer_append(w, data, caplen);
+}
+
+// 从报文的第off字节开始写最多n字节，可以跨段
+static void pcap_write_segs(struct pcap_writer *w, struct pktbuf *pkt, uint32_t off, uint32_t n)
+{
+    for (struct pktbuf *seg = pkt; seg && n; seg = seg->next) {
+        if (off >= seg->data_len) {
+            off -= seg->data_len;
+            continue;
+        }
+        uint32_t len = seg->data_len - off < n ? seg->data_len - off : n;
+        pcap_writer_append(w, pktbuf_data(seg) + off, len);
+        off = 0;
+        n -= len;
+    }
+}
+
+/**
+ * @brief 写一个接收到的报文，硬件剥掉的VLAN标签放回源MAC之后
+ * 
+ * 没有剥离时标签还在报文里，PKTBUF_RX_VLAN只说明vlan_tci有效，不能再插一次。
+ */
+int pcap_write_pkt(struct pcap_writer *w, uint64_t ts_ns, struct pktbuf *pkt)
+{
+    uint32_t len = pktbuf_pkt_len(pkt), caplen;
+    if (!(pkt->ol_flags & PKTBUF_RX_VLAN_STRIPPED)) {
+        if (pcap_writer_begin(w, ts_ns, len, &caplen) < 0)
+            return -1;
+        pcap_write_segs(w, pkt, 0, caplen);
+        return 0;
+    }
+
+    struct vlan_tag {
+        uint16_t tpid;
+        uint16_t tci;
+    } tag = { htons(E1000_VLAN_ETHERTYPE), htons(pkt->vlan_tci) };
+    uint32_t mac_len = 12;
+    if (pcap_writer_begin(w, ts_ns, len + sizeof(tag), &caplen) < 0)
+        return -1;
+    if (caplen <= mac_len) {
+        pcap_write_segs(w, pkt, 0, caplen);
+        return 0;
+    }
+    pcap_write_segs(w, pkt, 0, mac_len);
+    caplen -= mac_len;
+    uint32_t n = caplen < sizeof(tag) ? caplen : sizeof(tag);
+    pcap_writer_append(w, &tag, n);
+    pcap_write_segs(w, pkt, mac_len, caplen - n);
+    return 0;
+}
+
+/**
+ * @brief 写完剩下的数据并关闭文件
+ * 
+ * @param stats 不为NULL时返回统计
+ */
+void pcap_writer_close(struct pcap_writer *w, struct pcap_writer_stats *stats)
+{
+    // 等后台线程做完手上的事再停下来
+    pthread_mutex_lock(&w->lock);
+    while (!w->next_ready && !w->error)
+        pthread_cond_wait(&w->cond, &w->lock);
+    w->running = 0;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->tid, NULL);
+
+    struct pcap_chunk *cur = &w->chunks[w->cur];
+    struct pcap_chunk *next = &w->chunks[!w->cur];
+    if (w->next_ready) {
+        munmap(next->base, next->size);
+        // 提前建好但没用上的文件
+        if (next->fd != cur->fd) {
+            close(next->fd);
+            unlink(next->path);
+        }
+    }
+    pcap_chunk_release(cur, 1);
+
+    if (stats)
+        *stats = w->stats;
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w);
+}
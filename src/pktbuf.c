@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "mem_alloc.h"
+#include "pktbuf.h"
+#include "ip.h"
+
+static void pktbuf_init(struct mempool *mp, void *obj, void *arg)
+{
+    struct pktbuf *p = (struct pktbuf *)obj;
+    uint16_t data_size = *(uint16_t *)arg;
+    p->buf_addr = (char *)obj + PKTBUF_HDR_SIZE;
+    p->buf_phys = (uint64_t)virt_to_phys(obj) + PKTBUF_HDR_SIZE;
+    p->buf_len = PKTBUF_HEADROOM + data_size;
+    p->data_off = PKTBUF_HEADROOM;
+    p->data_len = 0;
+    p->pool = mp;
+    p->ol_flags = 0;
+    p->next = NULL;
+    p->nb_segs = 1;
+    p->pkt_len = 0;
+}
+
+/**
+ * @brief 创建报文缓冲池
+ * 
+ * 缓冲区从DMA内存区切分，struct pktbuf 放在每块内存的开头。
+ * 
+ * @param n: 缓冲区个数
+ */
+struct mempool *pktbuf_pool_create(unsigned n)
+{
+    return pktbuf_pool_create_size(n, PKTBUF_DATA_SIZE);
+}
+
+/**
+ * @brief 创建数据区大小为data_size的报文缓冲池，比如存放TSO的大块负载
+ * 
+ * 每个缓冲区都是物理连续的，数据区很大时需要大页或者IOVA-as-VA。
+ */
+struct mempool *pktbuf_pool_create_size(unsigned n, uint16_t data_size)
+{
+    if (data_size > PKTBUF_DATA_SIZE_MAX) {
+        printf("pktbuf data size %u too large, max %u\n", data_size, PKTBUF_DATA_SIZE_MAX);
+        return NULL;
+    }
+    return mempool_create(n, PKTBUF_HDR_SIZE + PKTBUF_HEADROOM + data_size,
+                          pktbuf_init, &data_size);
+}
+
+struct pktbuf *pktbuf_alloc(struct mempool *pool)
+{
+    struct pktbuf *p = mempool_get(pool);
+    if (!p)
+        return NULL;
+    p->data_off = PKTBUF_HEADROOM;
+    p->data_len = 0;
+    p->ol_flags = 0;
+    p->next = NULL;
+    p->nb_segs = 1;
+    p->pkt_len = 0;
+    return p;
+}
+
+/**
+ * @brief 释放整个报文，包括串在后面的所有段
+ */
+void pktbuf_free(struct pktbuf *p)
+{
+    while (p) {
+        struct pktbuf *next = p->next;
+        mempool_put(p->pool, p);
+        p = next;
+    }
+}
+
+/**
+ * @brief 只释放这一段，发送完成后驱动按描述符逐段释放
+ */
+void pktbuf_free_seg(struct pktbuf *p)
+{
+    mempool_put(p->pool, p);
+}
+
+/**
+ * @brief 把tail接到head的最后一段后面，更新head的nb_segs和pkt_len
+ * 
+ * @return 成功返回0，段数超过上限返回-1
+ */
+int pktbuf_chain(struct pktbuf *head, struct pktbuf *tail)
+{
+    if (head->nb_segs + tail->nb_segs > UINT16_MAX)
+        return -1;
+    struct pktbuf *last = head;
+    while (last->next)
+        last = last->next;
+    head->pkt_len = pktbuf_pkt_len(head) + pktbuf_pkt_len(tail);
+    head->nb_segs += tail->nb_segs;
+    last->next = tail;
+    return 0;
+}
+
+/**
+ * @brief 发送前为校验和卸载准备报文
+ * 
+ * 按ol_flags把IPv4首部校验和清零，把伪首部累加和填进TCP/UDP校验和字段，
+ * 网卡在此基础上累加负载。调用前要设置好l2_len和l3_len。
+ * 
+ * @return 成功返回0，报文太短返回-1
+ */
+int pktbuf_tx_cksum_prepare(struct pktbuf *p)
+{
+    if (p->l2_len + p->l3_len > p->data_len)
+        return -1;
+    struct ipv4_hdr *ip = (struct ipv4_hdr *)(pktbuf_data(p) + p->l2_len);
+    uint16_t l4_len = pktbuf_pkt_len(p) - p->l2_len - p->l3_len;
+    uint16_t l4_room = p->data_len - p->l2_len - p->l3_len; // L4首部要在第一段里
+    char *l4 = (char *)ip + p->l3_len;
+
+    if (p->ol_flags & PKTBUF_TX_IP_CKSUM)
+        ip->cksum = 0;
+    if (p->ol_flags & PKTBUF_TX_TCP_CKSUM) {
+        if (l4_room < sizeof(struct tcp_hdr))
+            return -1;
+        ((struct tcp_hdr *)l4)->cksum = ipv4_phdr_cksum(ip, l4_len);
+    } else if (p->ol_flags & PKTBUF_TX_UDP_CKSUM) {
+        if (l4_room < sizeof(struct udp_hdr))
+            return -1;
+        ((struct udp_hdr *)l4)->cksum = ipv4_phdr_cksum(ip, l4_len);
+    }
+    return 0;
+}
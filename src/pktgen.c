@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include "pktgen.h"
+#include "ethernet.h"
+#include "ip.h"
+
+#define PKTGEN_HDR_LEN (sizeof(struct eth_hdr) + sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr))
+#define PKTGEN_SRC_IP  0x0a000001 // 10.0.0.1，第i个流是10.0.0.1 + i
+#define PKTGEN_DST_IP  0x0aff0001 // 10.255.0.1
+#define PKTGEN_SRC_PORT 1024
+#define PKTGEN_DST_PORT 9         // discard
+
+static uint64_t pktgen_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief 时间戳计数器，x86以外的平台用纳秒代替
+ */
+static inline uint64_t pktgen_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return pktgen_now_ns();
+#endif
+}
+
+static inline void pktgen_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * @brief TSC频率，第一次调用时对照CLOCK_MONOTONIC测量100ms
+ */
+uint64_t pktgen_tsc_hz(void)
+{
+    static uint64_t hz;
+    if (hz)
+        return hz;
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns = pktgen_now_ns(), tsc = pktgen_tsc();
+    struct timespec ts = {0, 100 * 1000 * 1000};
+    nanosleep(&ts, NULL);
+    hz = (pktgen_tsc() - tsc) * 1000000000ULL / (pktgen_now_ns() - ns);
+#else
+    hz = 1000000000ULL;
+#endif
+    return hz;
+}
+
+static unsigned pktgen_pool_size(int tx_nr)
+{
+    // 发送环里挂着的报文，加上攒批和重发的报文
+    return tx_nr + PKTGEN_BURST * 2;
+}
+
+size_t pktgen_dma_mem_size(int tx_nr)
+{
+    return (size_t)pktgen_pool_size(tx_nr) * 4096;
+}
+
+/**
+ * @brief 合成报文：每个流的首部预先算好IP和UDP校验和，负载在缓冲池里一次填好
+ */
+static int pktgen_synth_init(struct pktgen *gen)
+{
+    struct pktgen_cfg *cfg = &gen->cfg;
+    uint16_t len = cfg->pkt_len;
+    uint8_t frame[PKTBUF_DATA_SIZE];
+    for (int i = PKTGEN_HDR_LEN; i < len; i++)
+        frame[i] = i & 0xff;
+
+    gen->hdrs = malloc(cfg->nr_flows * sizeof(gen->hdrs[0]));
+    if (!gen->hdrs)
+        return -1;
+    for (uint32_t f = 0; f < cfg->nr_flows; f++) {
+        struct eth_hdr *eth = (struct eth_hdr *)frame;
+        struct ipv4_hdr *ip = (struct ipv4_hdr *)(eth + 1);
+        struct udp_hdr *udp = (struct udp_hdr *)(ip + 1);
+        memcpy(eth->dst, cfg->dst_mac, 6);
+        memcpy(eth->src, gen->dev->mac_addr, 6);
+        eth->type = htons(ETH_TYPE_IP);
+        memset(ip, 0, sizeof(*ip));
+        ip->ver_ihl = 0x45;
+        ip->total_len = htons(len - sizeof(struct eth_hdr));
+        ip->frag_off = htons(0x4000); // DF，id固定为0
+        ip->ttl = 64;
+        ip->proto = IP_PROTO_UDP;
+        ip->src = htonl(PKTGEN_SRC_IP + f);
+        ip->dst = htonl(PKTGEN_DST_IP);
+        ip->cksum = ip_cksum(ip, sizeof(*ip));
+        uint16_t l4_len = len - sizeof(struct eth_hdr) - sizeof(struct ipv4_hdr);
+        udp->src_port = htons(PKTGEN_SRC_PORT + f % (65536 - PKTGEN_SRC_PORT));
+        udp->dst_port = htons(PKTGEN_DST_PORT);
+        udp->len = htons(l4_len);
+        udp->cksum = 0;
+        udp->cksum = ipv4_udptcp_cksum(ip, udp, l4_len);
+        memcpy(gen->hdrs[f], frame, PKTGEN_HDR_LEN);
+    }
+
+    // 负载不随流变化，先把所有缓冲区填好，发送时只拷贝首部
+    unsigned n = 0;
+    struct pktbuf **bufs = malloc(gen->pool->size * sizeof(struct pktbuf *));
+    if (!bufs)
+        return -1;
+    while (n < gen->pool->size && (bufs[n] = pktbuf_alloc(gen->pool)) != NULL) {
+        memcpy(pktbuf_data(bufs[n]), frame, len);
+        n++;
+    }
+    for (unsigned i = 0; i < n; i++)
+        pktbuf_free(bufs[i]);
+    mempool_cache_flush(gen->pool);
+    free(bufs);
+    return 0;
+}
+
+/**
+ * @brief 读入要回放的pcap，去掉发不出去的帧
+ */
+static int pktgen_replay_init(struct pktgen *gen, uint16_t max_len)
+{
+    struct pcap_trace *trace = &gen->trace;
+    if (pcap_load(gen->cfg.pcap, trace) < 0)
+        return -1;
+    unsigned nr = 0, skipped = 0;
+    for (unsigned i = 0; i < trace->nr; i++) {
+        if (trace->pkts[i].len < sizeof(struct eth_hdr) || trace->pkts[i].len > max_len) {
+            skipped++;
+            continue;
+        }
+        trace->pkts[nr++] = trace->pkts[i];
+    }
+    trace->nr = nr;
+    if (skipped)
+        printf("pktgen: skip %u frames shorter than %zu or longer than %u bytes in %s\n",
+               skipped, sizeof(struct eth_hdr), max_len, gen->cfg.pcap);
+    if (nr == 0) {
+        printf("pktgen: no frames to send in %s\n", gen->cfg.pcap);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 初始化生成器，设备要先用e1000_init()初始化
+ *
+ * 缓冲池从DMA内存区分配，大小见pktgen_dma_mem_size()。
+ */
+int pktgen_init(struct pktgen *gen, struct e1000_device *dev, const struct pktgen_cfg *cfg)
+{
+    memset(gen, 0, sizeof(*gen));
+    gen->cfg = *cfg;
+    gen->dev = dev;
+    uint16_t max_len = dev->max_frame < PKTBUF_DATA_SIZE ? dev->max_frame : PKTBUF_DATA_SIZE;
+
+    gen->pool = pktbuf_pool_create(pktgen_pool_size(dev->tx_nr));
+    if (!gen->pool) {
+        printf("pktgen: create pool failed\n");
+        return -1;
+    }
+
+    if (cfg->pcap) {
+        if (pktgen_replay_init(gen, max_len) < 0)
+            goto error;
+    } else {
+        if (cfg->pkt_len < PKTGEN_PKT_LEN_MIN || cfg->pkt_len > max_len) {
+            printf("pktgen: packet length must be %d~%u\n", PKTGEN_PKT_LEN_MIN, max_len);
+            goto error;
+        }
+        if (cfg->nr_flows == 0 || cfg->nr_flows > PKTGEN_MAX_FLOWS) {
+            printf("pktgen: flows must be 1~%d\n", PKTGEN_MAX_FLOWS);
+            goto error;
+        }
+        if (pktgen_synth_init(gen) < 0)
+            goto error;
+    }
+
+    gen->tsc_hz = pktgen_tsc_hz();
+    if (cfg->rate_bps)
+        gen->gap = (gen->tsc_hz * 8 << 16) / cfg->rate_bps;
+    else if (cfg->rate_pps)
+        gen->gap = (gen->tsc_hz << 16) / cfg->rate_pps;
+    return 0;
+
+error:
+    pktgen_free(gen);
+    return -1;
+}
+
+// 取一个报文填好下一帧，缓冲池空了返回NULL
+static inline struct pktbuf *pktgen_next(struct pktgen *gen)
+{
+    struct pktbuf *p = pktbuf_alloc(gen->pool);
+    if (!p)
+        return NULL;
+    if (gen->trace.nr) {
+        struct pcap_pkt *pkt = &gen->trace.pkts[gen->next_pkt];
+        memcpy(pktbuf_data(p), pkt->data, pkt->len);
+        p->data_len = pkt->len;
+        if (++gen->next_pkt == gen->trace.nr)
+            gen->next_pkt = 0;
+    } else {
+        memcpy(pktbuf_data(p), gen->hdrs[gen->next_pkt], PKTGEN_HDR_LEN);
+        p->data_len = gen->cfg.pkt_len;
+        if (++gen->next_pkt == gen->cfg.nr_flows)
+            gen->next_pkt = 0;
+    }
+    return p;
+}
+
+// 计数只由发送线程写，用原子写保证其它线程读到的是完整的值
+static inline void pktgen_stat_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 发送直到*running变成0或者发够cfg.count个报文
+ *
+ * 限速时每个报文有一个计划发送时间，每轮把已经到时间的报文（最多一批）
+ * 一起交给e1000_tx_burst()，速率高时自然攒成整批，速率低时逐个发送；
+ * 还没到时间就空转等待。发送环满时剩下的报文留到下一轮。
+ * 落后计划超过PKTGEN_MAX_LAG_US时从当前时间重新开始，不会为了追赶而突发。
+ */
+int pktgen_run(struct pktgen *gen, volatile int *running)
+{
+    struct pktbuf *pkts[PKTGEN_BURST];
+    uint64_t max_lag = gen->tsc_hz * PKTGEN_MAX_LAG_US / 1000000;
+    uint64_t next = pktgen_tsc(), frac = 0, queued = 0, bytes = 0;
+    uint64_t count = gen->cfg.count;
+    int n = 0;
+
+    while (*running && (!count || gen->stats.tx_packets < count)) {
+        uint64_t now = pktgen_tsc();
+        if (gen->gap && (int64_t)(now - next) > (int64_t)max_lag) {
+            next = now;
+            frac = 0;
+            pktgen_stat_add(&gen->stats.late, 1);
+        }
+        while (n < PKTGEN_BURST && (!count || queued < count) &&
+               (!gen->gap || (int64_t)(now - next) >= 0)) {
+            struct pktbuf *p = pktgen_next(gen);
+            if (!p)
+                break;
+            pkts[n++] = p;
+            bytes += p->data_len;
+            queued++;
+            if (gen->gap) {
+                frac += gen->cfg.rate_bps ? gen->gap * (p->data_len + PKTGEN_WIRE_OVERHEAD) : gen->gap;
+                next += frac >> 16;
+                frac &= 0xffff;
+            }
+        }
+        if (n == 0) {
+            pktgen_pause();
+            continue;
+        }
+
+        // 放进发送环的报文随时可能被回收，只能从留下的报文算字节数
+        int sent = e1000_tx_burst(gen->dev, pkts, n);
+        uint64_t unsent = 0;
+        for (int i = sent; i < n; i++)
+            unsent += pkts[i]->data_len;
+        pktgen_stat_add(&gen->stats.tx_packets, sent);
+        pktgen_stat_add(&gen->stats.tx_bytes, bytes - unsent);
+        if (sent < n) {
+            pktgen_stat_add(&gen->stats.ring_full, 1);
+            memmove(pkts, pkts + sent, (n - sent) * sizeof(pkts[0]));
+            // 发送环满时让出CPU，和网卡模拟线程共用一个核时它才能运行
+            if (sent == 0)
+                sched_yield();
+        }
+        n -= sent;
+        bytes = unsent;
+    }
+
+    for (int i = 0; i < n; i++)
+        pktbuf_free(pkts[i]);
+    e1000_tx_reclaim(gen->dev);
+    mempool_cache_flush(gen->pool);
+    return 0;
+}
+
+void pktgen_stats_get(struct pktgen *gen, struct pktgen_stats *stats)
+{
+    struct pktgen_stats *s = &gen->stats;
+    stats->tx_packets = __atomic_load_n(&s->tx_packets, __ATOMIC_RELAXED);
+    stats->tx_bytes = __atomic_load_n(&s->tx_bytes, __ATOMIC_RELAXED);
+    stats->ring_full = __atomic_load_n(&s->ring_full, __ATOMIC_RELAXED);
+    stats->late = __atomic_load_n(&s->late, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 释放回放的报文和首部模板，缓冲池和其它DMA内存一样不归还
+ */
+void pktgen_free(struct pktgen *gen)
+{
+    pcap_trace_free(&gen->trace);
+    free(gen->hdrs);
+    gen->hdrs = NULL;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * @brief 创建环形队列
+ *
+ * @param count: 至少能放下的对象个数，向上取整到2的幂
+ * @param flags: RING_F_SP_ENQ | RING_F_SC_DEQ
+ */
+struct ring *ring_create(unsigned count, unsigned flags)
+{
+    if (count == 0 || count > (1U << 31)) {
+        printf("invalid ring size %u\n", count);
+        return NULL;
+    }
+    uint32_t size = 1;
+    while (size < count)
+        size <<= 1;
+
+    size_t bytes = sizeof(struct ring) + size * sizeof(void *);
+    struct ring *r = aligned_alloc(64, (bytes + 63) & ~(size_t)63);
+    if (!r)
+        return NULL;
+    memset(r, 0, sizeof(struct ring));
+    r->size = size;
+    r->mask = size - 1;
+    r->flags = flags;
+    r->prod.single = !!(flags & RING_F_SP_ENQ);
+    r->cons.single = !!(flags & RING_F_SC_DEQ);
+    return r;
+}
+
+void ring_free(struct ring *r)
+{
+    free(r);
+}
+
+/**
+ * @brief 生产者占住[*head, *head + n)
+ *
+ * @param fixed: 1表示不够n个时一个都不占，0表示能占多少占多少
+ * @return 占住的个数
+ */
+static inline unsigned ring_move_prod_head(struct ring *r, unsigned n, int fixed, uint32_t *head)
+{
+    uint32_t next;
+    unsigned free;
+    do {
+        *head = __atomic_load_n(&r->prod.head, __ATOMIC_RELAXED);
+        uint32_t cons_tail = __atomic_load_n(&r->cons.tail, __ATOMIC_ACQUIRE);
+        free = r->size + cons_tail - *head;
+        if (n > free) {
+            if (fixed || free == 0)
+                return 0;
+            n = free;
+        }
+        next = *head + n;
+        if (r->prod.single) {
+            r->prod.head = next;
+            break;
+        }
+    } while (!__atomic_compare_exchange_n(&r->prod.head, head, next, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return n;
+}
+
+static inline unsigned ring_move_cons_head(struct ring *r, unsigned n, int fixed, uint32_t *head)
+{
+    uint32_t next;
+    unsigned entries;
+    do {
+        *head = __atomic_load_n(&r->cons.head, __ATOMIC_RELAXED);
+        uint32_t prod_tail = __atomic_load_n(&r->prod.tail, __ATOMIC_ACQUIRE);
+        entries = prod_tail - *head;
+        if (n > entries) {
+            if (fixed || entries == 0)
+                return 0;
+            n = entries;
+        }
+        next = *head + n;
+        if (r->cons.single) {
+            r->cons.head = next;
+            break;
+        }
+    } while (!__atomic_compare_exchange_n(&r->cons.head, head, next, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return n;
+}
+
+/**
+ * @brief 发布[head, head + n)，多线程时要等前面占位的线程先发布
+ */
+static inline void ring_update_tail(struct ring_headtail *ht, uint32_t head, unsigned n)
+{
+    if (!ht->single) {
+        while (__atomic_load_n(&ht->tail, __ATOMIC_RELAXED) != head)
+            cpu_relax();
+    }
+    __atomic_store_n(&ht->tail, head + n, __ATOMIC_RELEASE);
+}
+
+static inline unsigned ring_do_enqueue(struct ring *r, void *const *objs, unsigned n, int fixed)
+{
+    uint32_t head;
+    n = ring_move_prod_head(r, n, fixed, &head);
+    if (n == 0)
+        return 0;
+    // n通常很小，逐个拷贝比调用memcpy快
+    for (unsigned i = 0; i < n; i++)
+        r->objs[(head + i) & r->mask] = objs[i];
+    ring_update_tail(&r->prod, head, n);
+    return n;
+}
+
+static inline unsigned ring_do_dequeue(struct ring *r, void **objs, unsigned n, int fixed)
+{
+    uint32_t head;
+    n = ring_move_cons_head(r, n, fixed, &head);
+    if (n == 0)
+        return 0;
+    for (unsigned i = 0; i < n; i++)
+        objs[i] = r->objs[(head + i) & r->mask];
+    ring_update_tail(&r->cons, head, n);
+    return n;
+}
+
+/**
+ * @brief 放入n个对象，要么全部放入，要么一个都不放
+ *
+ * @return 放入的个数，n或0
+ */
+unsigned ring_enqueue_bulk(struct ring *r, void *const *objs, unsigned n)
+{
+    return ring_do_enqueue(r, objs, n, 1);
+}
+
+/**
+ * @brief 放入最多n个对象
+ *
+ * @return 放入的个数
+ */
+unsigned ring_enqueue_burst(struct ring *r, void *const *objs, unsigned n)
+{
+    return ring_do_enqueue(r, objs, n, 0);
+}
+
+/**
+ * @brief 取出n个对象，要么全部取出，要么一个都不取
+ */
+unsigned ring_dequeue_bulk(struct ring *r, void **objs, unsigned n)
+{
+    return ring_do_dequeue(r, objs, n, 1);
+}
+
+/**
+ * @brief 取出最多n个对象
+ */
+unsigned ring_dequeue_burst(struct ring *r, void **objs, unsigned n)
+{
+    return ring_do_dequeue(r, objs, n, 0);
+}
+
+/**
+ * @brief 环中的对象个数，有并发操作时只是个近似值
+ */
+unsigned ring_count(const struct ring *r)
+{
+    return __atomic_load_n(&r->prod.tail, __ATOMIC_ACQUIRE)
+         - __atomic_load_n(&r->cons.tail, __ATOMIC_ACQUIRE);
+}
+
+unsigned ring_free_count(const struct ring *r)
+{
+    return r->size - ring_count(r);
+}